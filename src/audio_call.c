@@ -251,8 +251,9 @@ int stop_transmission(int call_index)
  * Callbacks
  */
 
-#define CB_BODY(call_idx, Arg, onFunc) do { ToxWindow* windows = (Arg); int i;\
-for (i = 0; i < MAX_WINDOWS_NUM; ++i) if (windows[i].onFunc != NULL) windows[i].onFunc(&windows[i], ASettins.av, call_idx); } while (0)
+#define CB_BODY(call_idx, Arg, onFunc) do { int i;\
+for (i = 0; i < get_num_active_windows(); ++i) { ToxWindow *w_ = get_open_window(i);\
+if (w_->onFunc != NULL) w_->onFunc(w_, ASettins.av, call_idx); } } while (0)
 
 void callback_recv_invite ( void* av, int32_t call_index, void* arg )
 {
@@ -264,16 +265,17 @@ void callback_recv_ringing ( void* av, int32_t call_index, void* arg )
 }
 void callback_recv_starting ( void* av, int32_t call_index, void* arg )
 {
-    ToxWindow* windows = arg; 
     int i;
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) 
-        if (windows[i].onStarting != NULL && windows[i].call_idx == call_index) { 
-            windows[i].onStarting(&windows[i], ASettins.av, call_index);
-            if ( 0 != start_transmission(&windows[i]) ) {/* YEAH! */
-                line_info_add(&windows[i], NULL, NULL, NULL, SYS_MSG, 0, 0 , "Error starting transmission!");
+    for (i = 0; i < get_num_active_windows(); ++i) {
+        ToxWindow *w = get_open_window(i);
+        if (w->onStarting != NULL && w->call_idx == call_index) { 
+            w->onStarting(w, ASettins.av, call_index);
+            if ( 0 != start_transmission(w) ) {/* YEAH! */
+                line_info_add(w, NULL, NULL, NULL, SYS_MSG, 0, 0 , "Error starting transmission!");
             }
             return;
         }
+    }
 }
 void callback_recv_ending ( void* av, int32_t call_index, void* arg )
 {
@@ -283,16 +285,17 @@ void callback_recv_ending ( void* av, int32_t call_index, void* arg )
 
 void callback_call_started ( void* av, int32_t call_index, void* arg )
 {    
-    ToxWindow* windows = arg; 
     int i;
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) 
-        if (windows[i].onStart != NULL && windows[i].call_idx == call_index) { 
-            windows[i].onStart(&windows[i], ASettins.av, call_index);
-            if ( 0 != start_transmission(&windows[i]) ) {/* YEAH! */
-                line_info_add(&windows[i], NULL, NULL, NULL, SYS_MSG, 0, 0, "Error starting transmission!");
+    for (i = 0; i < get_num_active_windows(); ++i) {
+        ToxWindow *w = get_open_window(i);
+        if (w->onStart != NULL && w->call_idx == call_index) { 
+            w->onStart(w, ASettins.av, call_index);
+            if ( 0 != start_transmission(w) ) {/* YEAH! */
+                line_info_add(w, NULL, NULL, NULL, SYS_MSG, 0, 0, "Error starting transmission!");
                 return;
             }
         }
+    }
 }
 void callback_call_canceled ( void* av, int32_t call_index, void* arg )
 {
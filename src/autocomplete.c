@@ -230,16 +230,17 @@ static void complt_home_dir(ToxWindow *self, char *path, int pathsize)
 }
 
 /*  attempts to match /sendfile "<incomplete-dir>" line to matching directories.
+    cmd is the part of line before the path, e.g. L"/sendfile \"".
 
     if only one match, auto-complete line.
     return diff between old len and new len of ctx->line, -1 if no matches or > 1 match */
 #define MAX_DIRS 512
 
-int dir_match(ToxWindow *self, Tox *m, const wchar_t *line)
+int dir_match(ToxWindow *self, Tox *m, const wchar_t *line, const wchar_t *cmd)
 {
     char b_path[MAX_STR_SIZE];
     char b_name[MAX_STR_SIZE];
-    const wchar_t *tmpline = &line[11];   /* start after "/sendfile \"" */
+    const wchar_t *tmpline = &line[wcslen(cmd)];
 
     if (wcs_to_mbs_buf(b_path, tmpline, sizeof(b_path)) == -1)
         return -1; 
@@ -34,9 +34,10 @@
 int complete_line(ToxWindow *self, const void *list, int n_items, int size);
 
 /*  attempts to match /sendfile "<incomplete-dir>" line to matching directories.
+    cmd is the part of line before the path, e.g. L"/sendfile \"".
 
     if only one match, auto-complete line.
     return diff between old len and new len of ctx->line, -1 if no matches or > 1 match */
-int dir_match(ToxWindow *self, Tox *m, const wchar_t *line);
+int dir_match(ToxWindow *self, Tox *m, const wchar_t *line, const wchar_t *cmd);
 
 #endif  /* #define _autocomplete_h */
\ No newline at end of file
@@ -29,9 +29,12 @@
 #include <time.h>
 #include <wchar.h>
 #include <assert.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 #include "toxic.h"
 #include "windows.h"
+#include "chat.h"
 #include "execute.h"
 #include "misc_tools.h"
 #include "friendlist.h"
@@ -43,6 +46,9 @@
 #include "help.h"
 #include "autocomplete.h"
 #include "notify.h"
+#include "message_queue.h"
+#include "file_writer.h"
+#include "checkpoint.h"
 
 #ifdef _AUDIO
     #include "audio_call.h"
@@ -51,8 +57,6 @@
 
 extern char *DATA_FILE;
 
-extern FileSender file_senders[MAX_FILES];
-extern ToxicFriend friends[MAX_FRIENDS_NUM];
 
 extern struct _Winthread Winthread;
 extern struct user_settings *user_settings_;
@@ -63,9 +67,9 @@ static void kill_infobox(ToxWindow *self);
 #endif  /* _AUDIO */
 
 #ifdef _AUDIO
-#define AC_NUM_CHAT_COMMANDS 26
+#define AC_NUM_CHAT_COMMANDS 29
 #else
-#define AC_NUM_CHAT_COMMANDS 18
+#define AC_NUM_CHAT_COMMANDS 21
 #endif /* _AUDIO */
 
 /* Array of chat command names used for tab completion. */
@@ -82,12 +86,15 @@ static const char chat_cmd_list[AC_NUM_CHAT_COMMANDS][MAX_CMDNAME_SIZE] = {
     { "/join"       },
     { "/log"        },
     { "/myid"       },
+    { "/netstats"   },
     { "/nick"       },
     { "/note"       },
     { "/quit"       },
+    { "/ratelimit"  },
     { "/savefile"   },
     { "/sendfile"   },
     { "/status"     },
+    { "/weight"     },
 
 #ifdef _AUDIO
 
@@ -112,6 +119,51 @@ static void set_self_typingstatus(ToxWindow *self, Tox *m, uint8_t is_typing)
 
     tox_set_user_is_typing(m, self->num, is_typing);
     ctx->self_is_typing = is_typing;
+    ++ctx->typing_sent;
+}
+
+/* Records the typing state the input line asks for; the notification itself is sent by
+   do_typing_notifications(). If the line goes back to the state we last sent before that
+   happens, the start and stop notifications the keystrokes asked for are both saved */
+static void chat_typing_key(ChatContext *ctx, bool want)
+{
+    ctx->typing_last_key = get_time_ms();
+
+    if (want == ctx->typing_want)
+        return;
+
+    ctx->typing_want = want;
+
+    if (want == (ctx->self_is_typing == 1))
+        ctx->typing_suppressed += 2;
+}
+
+void do_typing_notifications(Tox *m)
+{
+    if (user_settings_->show_typing_self == SHOW_TYPING_OFF)
+        return;
+
+    uint64_t curtime = get_time_ms();
+    int i;
+
+    for (i = 0; i < get_num_active_windows(); ++i) {
+        ToxWindow *w = get_open_window(i);
+
+        if (!w->is_chat)
+            continue;
+
+        ChatContext *ctx = w->chatwin;
+        uint64_t idle = curtime - ctx->typing_last_key;
+
+        if (ctx->self_is_typing) {
+            if (ctx->typing_stop_now || idle >= TYPING_IDLE_TIMEOUT || (!ctx->typing_want && idle >= TYPING_STOP_DELAY))
+                set_self_typingstatus(w, m, 0);
+        } else if (ctx->typing_want && idle < TYPING_IDLE_TIMEOUT && w->stb->is_online) {
+            set_self_typingstatus(w, m, 1);
+        }
+
+        ctx->typing_stop_now = false;
+    }
 }
 
 static void chat_set_window_name(ToxWindow *self, char *nick, int len)
@@ -131,6 +183,7 @@ void kill_chat_window(ToxWindow *self)
 
     log_disable(ctx->log);
     line_info_cleanup(ctx->hst);
+    cqueue_cleanup(ctx->cqueue);
 
 #ifdef _AUDIO
     stop_current_call(self);
@@ -142,6 +195,7 @@ void kill_chat_window(ToxWindow *self)
 
     free(ctx->log);
     free(ctx->hst);
+    free(ctx->cqueue);
     free(ctx);
     free(self->help);
     free(statusbar);
@@ -182,16 +236,18 @@ static void chat_onConnectionChange(ToxWindow *self, Tox *m, int32_t num, uint8_
 
     if (status == 1) { /* Friend goes online */
         statusbar->is_online = true;
-        friends[num].is_typing = user_settings_->show_typing_other == SHOW_TYPING_ON 
+        get_friend(num)->is_typing = user_settings_->show_typing_other == SHOW_TYPING_ON 
                                  ? tox_get_is_typing(m, num) : 0;
                                  
     } else { /* Friend goes offline */
         statusbar->is_online = false;
-        friends[num].is_typing = 0;
+        get_friend(num)->is_typing = 0;
 
         if (self->chatwin->self_is_typing)
             set_self_typingstatus(self, m, 0);
     }
+
+    publish_friend_presence(num);
 }
 
 static void chat_onTypingChange(ToxWindow *self, Tox *m, int32_t num, uint8_t is_typing)
@@ -199,7 +255,16 @@ static void chat_onTypingChange(ToxWindow *self, Tox *m, int32_t num, uint8_t is
     if (self->num != num)
         return;
 
-    friends[num].is_typing = is_typing;
+    get_friend(num)->is_typing = is_typing;
+    publish_friend_presence(num);
+}
+
+static void chat_onReadReceipt(ToxWindow *self, Tox *m, int32_t num, uint32_t receipt)
+{
+    if (self->num != num)
+        return;
+
+    cqueue_receipt(self, receipt);
 }
 
 static void chat_onAction(ToxWindow *self, Tox *m, int32_t num, const char *action, uint16_t len)
@@ -263,6 +328,22 @@ static void chat_onStatusMessageChange(ToxWindow *self, int32_t num, const char
     statusbar->statusmsg_len = strlen(statusbar->statusmsg);
 }
 
+/* returns the checkpoint of an interrupted transfer of file id from friend num that can be resumed, or NULL */
+static struct checkpoint *get_resumable_receive(int32_t num, uint64_t id, uint64_t filesize)
+{
+    struct checkpoint *cp = checkpoint_find(CHECKPOINT_RECV, get_friend(num)->pub_key, id);
+    struct stat st;
+
+    if (cp == NULL || cp->in_use || cp->size != filesize || cp->confirmed == 0 || cp->confirmed >= filesize)
+        return NULL;
+
+    /* the partial file must still hold everything we wrote to it */
+    if (stat(cp->path, &st) == -1 || !S_ISREG(st.st_mode) || (uint64_t) st.st_size < cp->confirmed)
+        return NULL;
+
+    return cp;
+}
+
 static void chat_onFileSendRequest(ToxWindow *self, Tox *m, int32_t num, uint8_t filenum,
                                    uint64_t filesize, const char *pathname, uint16_t path_len)
 {
@@ -281,27 +362,27 @@ static void chat_onFileSendRequest(ToxWindow *self, Tox *m, int32_t num, uint8_t
     line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "File transfer request for '%s' (%llu bytes).",
                                                    filename_nopath, (long long unsigned int) filesize);
 
-    if (filenum >= MAX_FILES) {
-        errmsg = "Too many pending file requests; discarding.";
-        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
-        return;
-    }
-
     /* use specified path in config if possible */
     if (user_settings_->download_path[0]) {
         snprintf(filename_path, sizeof(filename_path), "%s%s", user_settings_->download_path, filename_nopath);
         len += strlen(user_settings_->download_path);
     }
 
-    if (len >= sizeof(friends[num].file_receiver.filenames[filenum])) {
+    if (len >= MAX_STR_SIZE) {
         errmsg = "File name too long; discarding.";
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
         return;
     }
 
+    uint64_t id = file_identity(filename_nopath, filesize);
+    struct checkpoint *cp = get_resumable_receive(num, id, filesize);
+
     char filename[MAX_STR_SIZE];
 
-    if (filename_path[0])
+    /* an interrupted transfer of the same file continues in the partial file */
+    if (cp)
+        snprintf(filename, sizeof(filename), "%s", cp->path);
+    else if (filename_path[0])
         strcpy(filename, filename_path);
     else
         strcpy(filename, filename_nopath);
@@ -310,7 +391,7 @@ static void chat_onFileSendRequest(ToxWindow *self, Tox *m, int32_t num, uint8_t
     FILE *filecheck = NULL;
     int count = 1;
 
-    while ((filecheck = fopen(filename, "r"))) {
+    while (cp == NULL && (filecheck = fopen(filename, "r"))) {
         filename[len] = '\0';
         char d[9];
         sprintf(d, "(%d)", count++);
@@ -331,11 +412,19 @@ static void chat_onFileSendRequest(ToxWindow *self, Tox *m, int32_t num, uint8_t
         }
     }
 
-    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Type '/savefile %d' to accept the file transfer.", filenum);
+    if (cp)
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Type '/savefile %d' to resume the file transfer "
+                      "(%.2f%% received earlier).", filenum, cp->confirmed * 100.0 / filesize);
+    else
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Type '/savefile %d' to accept the file transfer.",
+                      filenum);
 
-    friends[num].file_receiver.pending[filenum] = true;
-    friends[num].file_receiver.size[filenum] = filesize;
-    strcpy(friends[num].file_receiver.filenames[filenum], filename);
+    struct FileReceiver *rx = new_file_receiver(num, filenum);
+    rx->pending = true;
+    rx->size = filesize;
+    rx->file_id = id;
+    rx->resume = cp ? cp->confirmed : 0;
+    strcpy(rx->filename, filename);
 
     if (self->active_box != -1)
         box_notify2(self, transfer_pending, NT_WNDALERT_2 | NT_NOFOCUS, self->active_box, 
@@ -345,47 +434,57 @@ static void chat_onFileSendRequest(ToxWindow *self, Tox *m, int32_t num, uint8_t
                    "Incoming file: %s", filename );
 }
 
-static void chat_close_file_receiver(int32_t num, uint8_t filenum)
-{
-    FILE *file = friends[num].file_receiver.files[filenum];
-
-    if (file != NULL) {
-        fclose(file);
-        friends[num].file_receiver.files[filenum] = NULL;
-    }
-}
-
 static void chat_onFileControl(ToxWindow *self, Tox *m, int32_t num, uint8_t receive_send,
                                uint8_t filenum, uint8_t control_type, const char *data, uint16_t length)
 {
     if (self->num != num)
         return;
 
-    const char *filename;
     char msg[MAX_STR_SIZE] = {0};
-    int i = 0;   /* file_sender index */
+    FileSender *fs = NULL;
+    struct FileReceiver *rx = NULL;
 
-    if (receive_send == 0) {
-        filename = friends[num].file_receiver.filenames[filenum];
-    } else {
-        for (i = 0; i < MAX_FILES; ++i) {
-            if (file_senders[i].filenum == filenum)
-                break;
-        }
+    if (receive_send == 0)
+        rx = get_file_receiver(num, filenum);
+    else
+        fs = get_file_sender(num, filenum);
 
-        filename = file_senders[i].pathname;
-    }
+    if (rx == NULL && fs == NULL)
+        return;
+
+    /* copied as closing the transfer frees it */
+    char filename[MAX_STR_SIZE];
+    snprintf(filename, sizeof(filename), "%s", rx ? rx->filename : fs->pathname);
 
     switch (control_type) {
         case TOX_FILECONTROL_ACCEPT:
-            if (receive_send == 1) {
+            /* the sender confirmed the offset we asked to resume at */
+            if (rx) {
+                if (rx->writer == NULL && !rx->pending && length == sizeof(uint64_t)
+                        && file_receiver_start(self, m, num, filenum, rx->resume) == 0)
+                    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Resuming file '%s'.", filename);
+
+                break;
+            }
+
+            /* a receiver with part of the file sends the offset to continue at */
+            if (length == sizeof(uint64_t) && file_sender_resume(self, m, fs, data, length) == 0)
+                break;
+
+            /* the receiver paused the transfer, e.g. for its download limit, and is continuing it */
+            if (fs->accepted)
+                break;
+
+            fs->accepted = true;
+
+            /* a batch's transfers share the progress line made when the batch started */
+            if (fs->batch == NULL) {
                 line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "File transfer for '%s' accepted.", filename);
 
                 /* prep progress bar line */
                 char progline[MAX_STR_SIZE];
                 prep_prog_line(progline);
-                line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", progline);
-                file_senders[i].line_id = self->chatwin->hst->line_end->id + 2;
+                fs->line_id = line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", progline);
                 sound_notify(self, silent, NT_NOFOCUS | NT_BEEP | NT_WNDALERT_2, NULL);
             }
 
@@ -395,8 +494,10 @@ static void chat_onFileControl(ToxWindow *self, Tox *m, int32_t num, uint8_t rec
             snprintf(msg, sizeof(msg), "File transfer for '%s' failed.", filename);
 
             if (receive_send == 0)
-                chat_close_file_receiver(num, filenum);
-            
+                close_file_receiver(num, filenum, false);
+            else
+                file_sender_killed(self, m, fs);
+
             if (self->active_box != -1)
                 box_notify2(self, error, NT_NOFOCUS | NT_WNDALERT_2, 
                             self->active_box, "File transfer for '%s' failed!", filename );
@@ -408,7 +509,12 @@ static void chat_onFileControl(ToxWindow *self, Tox *m, int32_t num, uint8_t rec
         case TOX_FILECONTROL_FINISHED:
             if (receive_send == 0) {
                 snprintf(msg, sizeof(msg), "File transfer for '%s' complete.", filename);
-                chat_close_file_receiver(num, filenum);
+
+                /* the file is checked against the sender's hash once it's all written */
+                if (length == FILE_HASH_SIZE && rx->writer)
+                    file_writer_expect_hash(rx->writer, (const uint8_t *) data);
+
+                close_file_receiver(num, filenum, true);
                 
                 if (self->active_box != -1)
                     box_notify2(self, transfer_completed, NT_NOFOCUS | NT_WNDALERT_2, 
@@ -432,27 +538,42 @@ static void chat_onFileData(ToxWindow *self, Tox *m, int32_t num, uint8_t filenu
     if (self->num != num)
         return;
 
-    FILE *fp = friends[num].file_receiver.files[filenum];
+    struct FileReceiver *rx = get_file_receiver(num, filenum);
 
-    if (fp) {
-        if (fwrite(data, length, 1, fp) != 1) {
-            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, RED, " * Error writing to file.");
-            tox_file_send_control(m, num, 1, filenum, TOX_FILECONTROL_KILL, 0, 0);
-            chat_close_file_receiver(num, filenum);
-        }
+    if (rx == NULL)
+        return;
+
+    /* data without a confirmed resume means the sender started over */
+    if (rx->writer == NULL && !rx->pending) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "The sender can't resume '%s'; receiving it from the start.",
+                      rx->filename);
+
+        if (file_receiver_start(self, m, num, filenum, 0) == -1)
+            return;
     }
 
-    friends[num].file_receiver.bps[filenum] += length;
-    double remain = (double) tox_file_data_remaining(m, num, filenum, 1);
+    struct file_writer *fw = rx->writer;
+
+    /* the error itself is reported by do_file_writers() */
+    if (fw && file_writer_write(fw, data, length) == -1) {
+        tox_file_send_control(m, num, 1, filenum, TOX_FILECONTROL_KILL, 0, 0);
+        close_file_receiver(num, filenum, false);
+        return;
+    }
+
+    rate_limit_received(m, num, filenum, length);
+
+    /* the writer's offset also counts the data received before a resume */
+    rx->bps += length;
+    double remain = fw ? (double) (fw->size - fw->offset) : (double) tox_file_data_remaining(m, num, filenum, 1);
     uint64_t curtime = get_unix_time();
 
     /* refresh line with percentage complete and transfer speed (must be called once per second) */
-    if (!remain || timed_out(friends[num].file_receiver.last_progress[filenum], curtime, 1)) {
-        friends[num].file_receiver.last_progress[filenum] = curtime;
-        uint64_t size = friends[num].file_receiver.size[filenum];
-        double pct_remain = remain > 0 ? (1 - (remain / size)) * 100 : 100;
-        print_progress_bar(self, filenum, num, pct_remain);
-        friends[num].file_receiver.bps[filenum] = 0;
+    if (!remain || timed_out(rx->last_progress, curtime, 1)) {
+        rx->last_progress = curtime;
+        double pct_remain = remain > 0 ? (1 - (remain / rx->size)) * 100 : 100;
+        print_progress_bar(self, num, filenum, false, pct_remain);
+        rx->bps = 0;
     }
 }
 
@@ -467,9 +588,9 @@ static void chat_onGroupInvite(ToxWindow *self, Tox *m, int32_t friendnumber, co
     line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s has invited you to a group chat.", name);
     line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Type \"/join\" to join the chat.");
 
-    memcpy(friends[friendnumber].groupchat_key, group_pub_key, 
-           sizeof(friends[friendnumber].groupchat_key));
-    friends[friendnumber].groupchat_pending = true;
+    memcpy(get_friend(friendnumber)->groupchat_key, group_pub_key, 
+           sizeof(get_friend(friendnumber)->groupchat_key));
+    get_friend(friendnumber)->groupchat_pending = true;
 
     
     sound_notify(self, generic_message, NT_WNDALERT_2, NULL);
@@ -640,13 +761,17 @@ static void init_infobox(ToxWindow *self)
 {
     ChatContext *ctx = self->chatwin;
 
-    int x2, y2;
-    getmaxyx(self->window, y2, x2);
-    (void) y2;
-
     memset(&ctx->infobox, 0, sizeof(struct infobox));
 
-    ctx->infobox.win = newwin(INFOBOX_HEIGHT, INFOBOX_WIDTH + 1, 1, x2 - INFOBOX_WIDTH);
+    /* if the window has no curses windows yet the infobox is created along with them */
+    if (self->window) {
+        int x2, y2;
+        getmaxyx(self->window, y2, x2);
+        (void) y2;
+
+        ctx->infobox.win = newwin(INFOBOX_HEIGHT, INFOBOX_WIDTH + 1, 1, x2 - INFOBOX_WIDTH);
+    }
+
     ctx->infobox.starttime = get_unix_time();
     ctx->infobox.vad_lvl = user_settings_->VAD_treshold;
     ctx->infobox.active = true;
@@ -657,10 +782,12 @@ static void kill_infobox(ToxWindow *self)
 {
     ChatContext *ctx = self->chatwin;
 
-    if (!ctx->infobox.win)
+    if (!ctx->infobox.active)
         return;
 
-    delwin(ctx->infobox.win);
+    if (ctx->infobox.win)
+        delwin(ctx->infobox.win);
+
     memset(&ctx->infobox, 0, sizeof(struct infobox));
 }
 
@@ -725,26 +852,12 @@ static void send_action(ToxWindow *self, ChatContext *ctx, Tox *m, char *action)
     if (action == NULL)
         return;
 
-    char selfname[TOX_MAX_NAME_LENGTH];
-    uint16_t len = tox_get_self_name(m, (uint8_t *) selfname);
-    selfname[len] = '\0';
-
-    char timefrmt[TIME_STR_SIZE];
-    get_time_str(timefrmt, sizeof(timefrmt));
-
-    line_info_add(self, timefrmt, selfname, NULL, ACTION, 0, 0, "%s", action);
-
-    if (tox_send_action(m, self->num, (uint8_t *) action, strlen(action)) == 0) {
-        line_info_add(self, NULL, selfname, NULL, SYS_MSG, 0, RED, " * Failed to send action.");
-    } else {
-        write_to_log(action, selfname, ctx->log, true);
-    }
+    cqueue_add(self, m, action, ACTION);
 }
 
 static void chat_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
 {
     ChatContext *ctx = self->chatwin;
-    StatusBar *statusbar = self->stb;
 
     int x, y, y2, x2;
     getyx(self->window, y, x);
@@ -760,10 +873,7 @@ static void chat_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
 
     if (ltr) {    /* char is printable */
         input_new_char(self, key, x, y, x2, y2);
-
-        if (ctx->line[0] != '/' && !ctx->self_is_typing && statusbar->is_online)
-            set_self_typingstatus(self, m, 1);
-
+        chat_typing_key(ctx, ctx->line[0] != '/');
         return;
     }
 
@@ -776,7 +886,9 @@ static void chat_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
         int diff = -1;
 
         if (wcsncmp(ctx->line, L"/sendfile \"", wcslen(L"/sendfile \"")) == 0) {
-            diff = dir_match(self, m, ctx->line);
+            diff = dir_match(self, m, ctx->line, L"/sendfile \"");
+        } else if (wcsncmp(ctx->line, L"/sendfile -r \"", wcslen(L"/sendfile -r \"")) == 0) {
+            diff = dir_match(self, m, ctx->line, L"/sendfile -r \"");
         } else {
             diff = complete_line(self, chat_cmd_list, AC_NUM_CHAT_COMMANDS, MAX_CMDNAME_SIZE);
         }
@@ -793,9 +905,11 @@ static void chat_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
     } else if (key == '\n') {
         rm_trailing_spaces_buf(ctx);
 
-        char line[MAX_STR_SIZE];
+        /* a full line of multibyte characters can be longer than the core accepts;
+           the message queue splits it */
+        char line[MAX_STR_SIZE * MB_LEN_MAX];
 
-        if (wcs_to_mbs_buf(line, ctx->line, MAX_STR_SIZE) == -1)
+        if (wcs_to_mbs_buf(line, ctx->line, sizeof(line)) == -1)
             memset(&line, 0, sizeof(line));
 
         if (!string_is_empty(line))
@@ -807,33 +921,23 @@ static void chat_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
                 return;
             } else if (strncmp(line, "/me ", strlen("/me ")) == 0) {
                 send_action(self, ctx, m, line + strlen("/me "));
+            } else if (strlen(line) >= MAX_STR_SIZE) {
+                line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, RED, " * Command is too long.");
             } else {
                 execute(ctx->history, self, m, line, CHAT_COMMAND_MODE);
             }
         } else if (!string_is_empty(line)) {
-            char selfname[TOX_MAX_NAME_LENGTH];
-            uint16_t len = tox_get_self_name(m, (uint8_t *) selfname);
-            selfname[len] = '\0';
-
-            char timefrmt[TIME_STR_SIZE];
-            get_time_str(timefrmt, sizeof(timefrmt));
-
-            line_info_add(self, timefrmt, selfname, NULL, OUT_MSG, 0, 0, "%s", line);
-
-            if (!statusbar->is_online || tox_send_message(m, self->num, (uint8_t *) line, strlen(line)) == 0) {
-                line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, RED, " * Failed to send message.");
-            } else {
-                write_to_log(line, selfname, ctx->log, false);
-            }
+            cqueue_add(self, m, line, OUT_MSG);
         }
 
         wclear(ctx->linewin);
         wmove(self->window, y2 - CURS_Y_OFFSET, 0);
         reset_buf(ctx);
+        ctx->typing_stop_now = true;
     }
 
-    if (ctx->len <= 0 && ctx->self_is_typing)
-        set_self_typingstatus(self, m, 0);
+    if (ctx->len <= 0)
+        chat_typing_key(ctx, false);
 }
 
 static void chat_onDraw(ToxWindow *self, Tox *m)
@@ -856,10 +960,13 @@ static void chat_onDraw(ToxWindow *self, Tox *m)
     mvwhline(statusbar->topline, 1, 0, ACS_HLINE, x2);
     wmove(statusbar->topline, 0, 0);
 
-    /* Draw name, status and note in statusbar */
-    if (statusbar->is_online) {
+    /* Draw name, status and note in statusbar from the published presence so we never wait on the core thread */
+    struct FriendPresence presence;
+    get_friend_presence(self->num, &presence);
+
+    if (presence.online) {
         int colour = WHITE;
-        uint8_t status = statusbar->status;
+        uint8_t status = presence.status;
 
         switch (status) {
             case TOX_USERSTATUS_NONE:
@@ -883,46 +990,29 @@ static void chat_onDraw(ToxWindow *self, Tox *m)
         wprintw(statusbar->topline, " %s", ONLINE_CHAR);
         wattroff(statusbar->topline, COLOR_PAIR(colour) | A_BOLD);
 
-        if (friends[self->num].is_typing)
+        if (presence.is_typing)
             wattron(statusbar->topline, COLOR_PAIR(YELLOW));
 
         wattron(statusbar->topline, A_BOLD);
-        wprintw(statusbar->topline, " %s ", statusbar->nick);
+        wprintw(statusbar->topline, " %s ", presence.name);
         wattroff(statusbar->topline, A_BOLD);
 
-        if (friends[self->num].is_typing)
+        if (presence.is_typing)
             wattroff(statusbar->topline, COLOR_PAIR(YELLOW));
     } else {
         wprintw(statusbar->topline, " %s", OFFLINE_CHAR);
         wattron(statusbar->topline, A_BOLD);
-        wprintw(statusbar->topline, " %s ", statusbar->nick);
+        wprintw(statusbar->topline, " %s ", presence.name);
         wattroff(statusbar->topline, A_BOLD);
     }
 
-    /* Reset statusbar->statusmsg on window resize */
-    if (x2 != self->x) {
-        char statusmsg[TOX_MAX_STATUSMESSAGE_LENGTH] = {'\0'};
-
-        pthread_mutex_lock(&Winthread.lock);
-        tox_get_status_message(m, self->num, (uint8_t *) statusmsg, TOX_MAX_STATUSMESSAGE_LENGTH);
-        pthread_mutex_unlock(&Winthread.lock);
-
-        snprintf(statusbar->statusmsg, sizeof(statusbar->statusmsg), "%s", statusmsg);
-        statusbar->statusmsg_len = strlen(statusbar->statusmsg);
-    }
-
     self->x = x2;
 
     /* Truncate note if it doesn't fit in statusbar */
-    uint16_t maxlen = x2 - getcurx(statusbar->topline) - (KEY_IDENT_DIGITS * 2) - 7;
+    int maxlen = x2 - getcurx(statusbar->topline) - (KEY_IDENT_DIGITS * 2) - 7;
 
-    if (statusbar->statusmsg_len > maxlen) {
-        statusbar->statusmsg[maxlen] = '\0';
-        statusbar->statusmsg_len = maxlen;
-    }
-
-    if (statusbar->statusmsg[0])
-        wprintw(statusbar->topline, "- %s ", statusbar->statusmsg);
+    if (presence.statusmsg[0] && maxlen > 0)
+        wprintw(statusbar->topline, "- %.*s ", maxlen, presence.statusmsg);
 
     wclrtoeol(statusbar->topline);
     wmove(statusbar->topline, 0, x2 - (KEY_IDENT_DIGITS * 2) - 3);
@@ -931,7 +1021,7 @@ static void chat_onDraw(ToxWindow *self, Tox *m)
     int i;
 
     for (i = 0; i < KEY_IDENT_DIGITS; ++i)
-        wprintw(statusbar->topline, "%02X", friends[self->num].pub_key[i] & 0xff);
+        wprintw(statusbar->topline, "%02X", get_friend(self->num)->pub_key[i] & 0xff);
 
     wprintw(statusbar->topline, "}\n");
 
@@ -959,9 +1049,6 @@ static void chat_onDraw(ToxWindow *self, Tox *m)
 static void chat_onInit(ToxWindow *self, Tox *m)
 {
     curs_set(1);
-    int x2, y2;
-    getmaxyx(self->window, y2, x2);
-    self->x = x2;
 
     /* Init statusbar info */
     StatusBar *statusbar = self->stb;
@@ -980,28 +1067,22 @@ static void chat_onInit(ToxWindow *self, Tox *m)
     snprintf(statusbar->nick, sizeof(statusbar->nick), "%s", nick);
     statusbar->nick_len = n_len;
 
-    /* Init subwindows */
+    /* the curses sub-windows are created when the window is first focused */
     ChatContext *ctx = self->chatwin;
 
-    statusbar->topline = subwin(self->window, 2, x2, 0, 0);
-    ctx->history = subwin(self->window, y2 - CHATBOX_HEIGHT + 1, x2, 0, 0);
-    ctx->linewin = subwin(self->window, CHATBOX_HEIGHT, x2, y2 - CHATBOX_HEIGHT, 0);
-
     ctx->hst = calloc(1, sizeof(struct history));
     ctx->log = calloc(1, sizeof(struct chatlog));
+    ctx->cqueue = calloc(1, sizeof(struct chat_queue));
 
-    if (ctx->log == NULL || ctx->hst == NULL)
+    if (ctx->log == NULL || ctx->hst == NULL || ctx->cqueue == NULL)
         exit_toxic_err("failed in chat_onInit", FATALERR_MEMORY);
 
     line_info_init(ctx->hst);
 
-    if (friends[self->num].logging_on)
-        log_enable(nick, friends[self->num].pub_key, ctx->log);
+    if (get_friend(self->num)->logging_on)
+        log_enable(nick, get_friend(self->num)->pub_key, ctx->log);
 
     execute(ctx->history, self, m, "/log", GLOBAL_COMMAND_MODE);
-
-    scrollok(ctx->history, 0);
-    wmove(self->window, y2 - CURS_Y_OFFSET, 0);
 }
 
 ToxWindow new_chat(Tox *m, int32_t friendnum)
@@ -1018,6 +1099,7 @@ ToxWindow new_chat(Tox *m, int32_t friendnum)
     ret.onMessage = &chat_onMessage;
     ret.onConnectionChange = &chat_onConnectionChange;
     ret.onTypingChange = & chat_onTypingChange;
+    ret.onReadReceipt = & chat_onReadReceipt;
     ret.onGroupInvite = &chat_onGroupInvite;
     ret.onNickChange = &chat_onNickChange;
     ret.onStatusChange = &chat_onStatusChange;
@@ -26,7 +26,13 @@
 #include "windows.h"
 #include "toxic.h"
 
+#define TYPING_STOP_DELAY 1000    /* ms the input line must stay empty before we report that we stopped typing */
+#define TYPING_IDLE_TIMEOUT 5000    /* ms without a keystroke after which we report that we stopped typing */
+
 void kill_chat_window(ToxWindow *self);
 ToxWindow new_chat(Tox *m, int32_t friendnum);
 
+/* sends the typing notifications asked for by the input lines of the open chats. Call once per do_toxic loop */
+void do_typing_notifications(Tox *m);
+
 #endif /* end of include guard: CHAT_H_6489PZ13 */
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "toxic.h"
 #include "windows.h"
@@ -30,14 +31,10 @@
 #include "execute.h"
 #include "line_info.h"
 #include "groupchat.h"
+#include "file_writer.h"
 
 extern ToxWindow *prompt;
 
-extern ToxicFriend friends[MAX_FRIENDS_NUM];
-
-extern FileSender file_senders[MAX_FILES];
-extern uint8_t max_file_senders_index;
-extern uint8_t num_active_file_senders;
 
 void cmd_groupinvite(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
 {
@@ -76,9 +73,9 @@ void cmd_join_group(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*ar
         return;
     }
 
-    const char *groupkey = friends[self->num].groupchat_key;
+    const char *groupkey = get_friend(self->num)->groupchat_key;
 
-    if (!friends[self->num].groupchat_pending) {
+    if (!get_friend(self->num)->groupchat_pending) {
         errmsg = "No pending group chat invite.";
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
         return;
@@ -110,53 +107,54 @@ void cmd_savefile(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv
         return;
     }
 
-    uint8_t filenum = atoi(argv[1]);
+    int filenum = atoi(argv[1]);
 
-    if ((filenum == 0 && strcmp(argv[1], "0")) || filenum >= MAX_FILES) {
+    if ((filenum == 0 && strcmp(argv[1], "0")) || filenum < 0 || filenum >= MAX_FILES) {
         errmsg = "No pending file transfers with that number.";
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
         return;
     }
 
-    if (!friends[self->num].file_receiver.pending[filenum]) {
+    struct FileReceiver *rx = get_file_receiver(self->num, filenum);
+
+    if (rx == NULL || !rx->pending) {
         errmsg = "No pending file transfers with that number.";
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
         return;
     }
 
-    const char *filename = friends[self->num].file_receiver.filenames[filenum];
-
-    if (tox_file_send_control(m, self->num, 1, filenum, TOX_FILECONTROL_ACCEPT, 0, 0) == 0) {
-        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Saving file as: '%s'", filename);
+    uint64_t offset = rx->resume;
+    uint8_t data[sizeof(uint64_t)];
+    memcpy(data, &offset, sizeof(uint64_t));
+    host_to_net(data, sizeof(uint64_t));
 
-        /* prep progress bar line */
-        char progline[MAX_STR_SIZE];
-        prep_prog_line(progline);
-        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", progline);
-        friends[self->num].file_receiver.line_id[filenum] = self->chatwin->hst->line_end->id + 2;
-
-        if ((friends[self->num].file_receiver.files[filenum] = fopen(filename, "a")) == NULL) {
-            errmsg = "* Error writing to file.";
-            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, RED, errmsg);
-            tox_file_send_control(m, self->num, 1, filenum, TOX_FILECONTROL_KILL, 0, 0);
-        }
-    } else {
+    /* to resume an interrupted transfer the offset is sent with the accept. A sender that can resume
+       confirms it before sending any data; otherwise the file is received from the start */
+    if (tox_file_send_control(m, self->num, 1, filenum, TOX_FILECONTROL_ACCEPT, offset ? data : NULL,
+                              offset ? sizeof(data) : 0) != 0) {
         errmsg = "File transfer failed.";
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
+        close_file_receiver(self->num, filenum, false);
+        return;
+    }
+
+    rx->pending = false;
+
+    if (offset) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Asking to resume file '%s' at %.2f%%", rx->filename,
+                      offset * 100.0 / rx->size);
+        return;
     }
 
-    friends[self->num].file_receiver.pending[filenum] = false;
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Saving file as: '%s'", rx->filename);
+    file_receiver_start(self, m, self->num, filenum, 0);
 }
 
 void cmd_sendfile(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
 {
     const char *errmsg;
-
-    if (max_file_senders_index >= (MAX_FILES - 1)) {
-        errmsg = "Please wait for some of your outgoing file transfers to complete.";
-        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
-        return;
-    }
+    bool recursive = argc >= 2 && strcmp(argv[1], "-r") == 0;
+    const char *arg = recursive ? argv[2] : argv[1];
 
     if (argc < 1) {
         errmsg = "Invalid syntax.";
@@ -164,7 +162,7 @@ void cmd_sendfile(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv
         return;
     }
 
-    if (argv[1][0] != '\"') {
+    if (arg[0] != '\"') {
         errmsg = "File path must be enclosed in quotes.";
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
         return;
@@ -172,7 +170,7 @@ void cmd_sendfile(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv
 
     /* remove opening and closing quotes */
     char path[MAX_STR_SIZE];
-    snprintf(path, sizeof(path), "%s", &argv[1][1]);
+    snprintf(path, sizeof(path), "%s", &arg[1]);
     int path_len = strlen(path) - 1;
     path[path_len] = '\0';
 
@@ -182,52 +180,39 @@ void cmd_sendfile(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv
         return;
     }
 
-    FILE *file_to_send = fopen(path, "r");
+    if (recursive) {
+        if (send_directory(self, m, path, &errmsg) == -1)
+            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
 
-    if (file_to_send == NULL) {
-        errmsg = "File not found.";
-        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
         return;
     }
 
-    fseek(file_to_send, 0, SEEK_END);
-    uint64_t filesize = ftell(file_to_send);
-    fseek(file_to_send, 0, SEEK_SET);
-
-    char filename[MAX_STR_SIZE] = {0};
-    get_file_name(filename, sizeof(filename), path);
-    int filenum = tox_new_file_sender(m, self->num, filesize, (const uint8_t *) filename, strlen(filename));
-
-    if (filenum == -1) {
-        errmsg = "Error sending file.";
+    if (new_file_sender(m, self->num, path, NULL, NULL, &errmsg) == -1) {
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
         return;
     }
 
-    int i;
-
-    for (i = 0; i < MAX_FILES; ++i) {
-        if (!file_senders[i].active) {
-            file_senders[i].queue_pos = num_active_file_senders;
-            memcpy(file_senders[i].pathname, path, path_len + 1);
-            file_senders[i].active = true;
-            file_senders[i].toxwin = self;
-            file_senders[i].file = file_to_send;
-            file_senders[i].filenum = filenum;
-            file_senders[i].friendnum = self->num;
-            file_senders[i].timestamp = get_unix_time();
-            file_senders[i].size = filesize;
-            file_senders[i].piecelen = fread(file_senders[i].nextpiece, 1,
-                                             tox_file_data_size(m, self->num), file_to_send);
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Sending file: '%s'", path);
+}
 
-            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Sending file: '%s'", path);
+void cmd_weight(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
+{
+    ToxicFriend *f = get_friend(self->num);
 
-            ++num_active_file_senders;
+    if (argc == 0) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "File transfer weight is %d.",
+                      f->file_weight ? f->file_weight : 1);
+        return;
+    }
 
-            if (i == max_file_senders_index)
-                ++max_file_senders_index;
+    int weight = atoi(argv[1]);
 
-            return;
-        }
+    if (argc != 1 || weight < 1 || weight > MAX_FILE_WEIGHT) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Weight must be a number from 1 to %d.",
+                      MAX_FILE_WEIGHT);
+        return;
     }
+
+    f->file_weight = weight;
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "File transfer weight set to %d.", weight);
 }
@@ -0,0 +1,314 @@
+/*  checkpoint.c
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "toxic.h"
+#include "checkpoint.h"
+#include "misc_tools.h"
+
+extern char *TRANSFERS_FILE;
+extern struct arg_opts arg_opts;
+
+/* The file is a header followed by num_checkpoints records of fixed width little-endian fields:
+   header: magic[8] version:u32 num_checkpoints:u32
+   record: direction:u8 pub_key[TOX_CLIENT_ID_SIZE] id:u64 size:u64 confirmed:u64 mtime:i64 last_used:u64 path[MAX_STR_SIZE] */
+#define CHECKPOINT_MAGIC "TOXICCP"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_HEADER_SIZE 16
+#define CHECKPOINT_RECORD_SIZE (1 + TOX_CLIENT_ID_SIZE + 5 * 8 + MAX_STR_SIZE)
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i)
+        p[i] = v >> (i * 8);
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    int i;
+
+    for (i = 0; i < 8; ++i)
+        p[i] = v >> (i * 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    int i;
+
+    for (i = 0; i < 4; ++i)
+        v |= (uint32_t) p[i] << (i * 8);
+
+    return v;
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    int i;
+
+    for (i = 0; i < 8; ++i)
+        v |= (uint64_t) p[i] << (i * 8);
+
+    return v;
+}
+
+static void checkpoint_pack(uint8_t *rec, const struct checkpoint *cp)
+{
+    rec[0] = cp->direction;
+    memcpy(rec + 1, cp->pub_key, TOX_CLIENT_ID_SIZE);
+
+    uint8_t *p = rec + 1 + TOX_CLIENT_ID_SIZE;
+    put_le64(p, cp->id);
+    put_le64(p + 8, cp->size);
+    put_le64(p + 16, cp->confirmed);
+    put_le64(p + 24, (uint64_t) cp->mtime);
+    put_le64(p + 32, cp->last_used);
+    memcpy(p + 40, cp->path, MAX_STR_SIZE);
+}
+
+static void checkpoint_unpack(struct checkpoint *cp, const uint8_t *rec)
+{
+    memset(cp, 0, sizeof(struct checkpoint));
+    cp->direction = rec[0];
+    memcpy(cp->pub_key, rec + 1, TOX_CLIENT_ID_SIZE);
+
+    const uint8_t *p = rec + 1 + TOX_CLIENT_ID_SIZE;
+    cp->id = get_le64(p);
+    cp->size = get_le64(p + 8);
+    cp->confirmed = get_le64(p + 16);
+    cp->mtime = (int64_t) get_le64(p + 24);
+    cp->last_used = get_le64(p + 32);
+    memcpy(cp->path, p + 40, MAX_STR_SIZE);
+    cp->path[MAX_STR_SIZE - 1] = '\0';
+}
+
+static struct checkpoint checkpoints[MAX_CHECKPOINTS];
+static bool checkpoints_changed;
+static uint64_t last_save;
+
+uint64_t file_identity(const char *filename, uint64_t size)
+{
+    const char *name = strrchr(filename, '/');
+    name = name ? name + 1 : filename;
+
+    /* FNV-1a of the name followed by the size in little-endian order */
+    uint8_t size_le[sizeof(uint64_t)];
+    put_le64(size_le, size);
+
+    uint64_t hash = fnv1a_update(FNV1A_INIT, name, strlen(name));
+    return fnv1a_update(hash, size_le, sizeof(size_le));
+}
+
+struct checkpoint *checkpoint_find(uint8_t direction, const char *pub_key, uint64_t id)
+{
+    int i;
+
+    for (i = 0; i < MAX_CHECKPOINTS; ++i) {
+        struct checkpoint *cp = &checkpoints[i];
+
+        if (cp->active && cp->direction == direction && cp->id == id
+                && memcmp(cp->pub_key, pub_key, TOX_CLIENT_ID_SIZE) == 0)
+            return cp;
+    }
+
+    return NULL;
+}
+
+struct checkpoint *checkpoint_new(uint8_t direction, const char *pub_key, uint64_t id, uint64_t size,
+                                  const char *path)
+{
+    struct checkpoint *cp = checkpoint_find(direction, pub_key, id);
+    int i;
+
+    if (cp && cp->in_use)
+        return NULL;
+
+    for (i = 0; i < MAX_CHECKPOINTS && cp == NULL; ++i) {
+        if (!checkpoints[i].active)
+            cp = &checkpoints[i];
+    }
+
+    for (i = 0; i < MAX_CHECKPOINTS && cp == NULL; ++i) {
+        if (!checkpoints[i].in_use && (cp == NULL || checkpoints[i].last_used < cp->last_used))
+            cp = &checkpoints[i];
+    }
+
+    if (cp == NULL)
+        return NULL;
+
+    memset(cp, 0, sizeof(struct checkpoint));
+    cp->active = true;
+    cp->in_use = true;
+    cp->direction = direction;
+    memcpy(cp->pub_key, pub_key, TOX_CLIENT_ID_SIZE);
+    cp->id = id;
+    cp->size = size;
+    cp->last_used = get_unix_time();
+    snprintf(cp->path, sizeof(cp->path), "%s", path);
+
+    checkpoints_changed = true;
+    return cp;
+}
+
+void checkpoint_update(struct checkpoint *cp, uint64_t confirmed)
+{
+    if (cp->confirmed == confirmed)
+        return;
+
+    cp->confirmed = confirmed;
+    cp->last_used = get_unix_time();
+    checkpoints_changed = true;
+}
+
+void checkpoint_release(struct checkpoint *cp, bool forget)
+{
+    cp->in_use = false;
+
+    if (forget)
+        memset(cp, 0, sizeof(struct checkpoint));
+
+    checkpoints_changed = true;
+}
+
+int checkpoint_count(uint8_t direction, const char *pub_key)
+{
+    int count = 0;
+    int i;
+
+    for (i = 0; i < MAX_CHECKPOINTS; ++i) {
+        struct checkpoint *cp = &checkpoints[i];
+
+        if (cp->active && !cp->in_use && cp->direction == direction
+                && memcmp(cp->pub_key, pub_key, TOX_CLIENT_ID_SIZE) == 0)
+            ++count;
+    }
+
+    return count;
+}
+
+void checkpoint_load(void)
+{
+    if (arg_opts.ignore_data_file || TRANSFERS_FILE == NULL)
+        return;
+
+    FILE *fp = fopen(TRANSFERS_FILE, "rb");
+
+    if (fp == NULL)
+        return;
+
+    uint8_t hdr[CHECKPOINT_HEADER_SIZE];
+
+    if (fread(hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr, CHECKPOINT_MAGIC, 8) != 0
+            || get_le32(hdr + 8) != CHECKPOINT_VERSION) {
+        fclose(fp);
+        return;
+    }
+
+    uint32_t num_checkpoints = get_le32(hdr + 12);
+    uint8_t rec[CHECKPOINT_RECORD_SIZE];
+    uint32_t i;
+
+    for (i = 0; i < num_checkpoints && i < MAX_CHECKPOINTS; ++i) {
+        if (fread(rec, sizeof(rec), 1, fp) != 1)
+            break;
+
+        checkpoint_unpack(&checkpoints[i], rec);
+        checkpoints[i].active = true;
+    }
+
+    fclose(fp);
+}
+
+int checkpoint_save(void)
+{
+    if (!checkpoints_changed || arg_opts.ignore_data_file || TRANSFERS_FILE == NULL)
+        return 0;
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", TRANSFERS_FILE);
+
+    FILE *fp = fopen(tmp_path, "wb");
+
+    if (fp == NULL)
+        return -1;
+
+    uint32_t num_checkpoints = 0;
+    int i;
+
+    for (i = 0; i < MAX_CHECKPOINTS; ++i) {
+        if (checkpoints[i].active)
+            ++num_checkpoints;
+    }
+
+    uint8_t hdr[CHECKPOINT_HEADER_SIZE];
+    memcpy(hdr, CHECKPOINT_MAGIC, 8);
+    put_le32(hdr + 8, CHECKPOINT_VERSION);
+    put_le32(hdr + 12, num_checkpoints);
+
+    int ret = 0;
+
+    if (fwrite(hdr, sizeof(hdr), 1, fp) != 1)
+        ret = -1;
+
+    uint8_t rec[CHECKPOINT_RECORD_SIZE];
+
+    for (i = 0; i < MAX_CHECKPOINTS && ret == 0; ++i) {
+        if (!checkpoints[i].active)
+            continue;
+
+        checkpoint_pack(rec, &checkpoints[i]);
+
+        if (fwrite(rec, sizeof(rec), 1, fp) != 1)
+            ret = -1;
+    }
+
+    if (fclose(fp) != 0)
+        ret = -1;
+
+    if (ret == 0 && rename(tmp_path, TRANSFERS_FILE) != 0)
+        ret = -1;
+
+    if (ret != 0)
+        remove(tmp_path);
+    else
+        checkpoints_changed = false;
+
+    return ret;
+}
+
+void do_checkpoints(void)
+{
+    uint64_t curtime = get_unix_time();
+
+    if (!checkpoints_changed || !timed_out(last_save, curtime, CHECKPOINT_SAVE_INTERVAL))
+        return;
+
+    last_save = curtime;
+    checkpoint_save();
+}
@@ -0,0 +1,81 @@
+/*  checkpoint.h
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef _checkpoint_h
+#define _checkpoint_h
+
+#include "toxic.h"
+
+#define MAX_CHECKPOINTS 64    /* max number of interrupted transfers remembered */
+#define CHECKPOINT_SAVE_INTERVAL 5    /* min seconds between saves of the checkpoint file */
+
+enum {
+    CHECKPOINT_SEND,
+    CHECKPOINT_RECV,
+} CHECKPOINT_DIRECTION;
+
+/* A file transfer that can be resumed. Both sides identify the file by file_identity() of its name and
+   size, the only things the receiver knows about it before the transfer starts. Checkpoints are saved
+   to TRANSFERS_FILE so transfers can also be resumed after a restart. */
+struct checkpoint {
+    bool active;
+    uint8_t direction;
+    char pub_key[TOX_CLIENT_ID_SIZE];
+    uint64_t id;
+    uint64_t size;
+    uint64_t confirmed;    /* bytes written to the receiver's disk, or handed to the core by the sender */
+    int64_t mtime;    /* sender: modification time of the file, which must not change before a resume */
+    uint64_t last_used;    /* the least recently used checkpoint is replaced when the table is full */
+    char path[MAX_STR_SIZE];    /* the file being sent, or the partial file being received */
+    bool in_use;    /* a transfer is running for it; not saved */
+};
+
+/* returns the identity of a file named filename of size bytes; any directories in filename are ignored */
+uint64_t file_identity(const char *filename, uint64_t size);
+
+/* returns the checkpoint of the transfer of file id to or from the friend with pub_key, or NULL if there is none */
+struct checkpoint *checkpoint_find(uint8_t direction, const char *pub_key, uint64_t id);
+
+/* Returns a checkpoint for a transfer that is starting, reusing the checkpoint of the same file if there
+   is one. Returns NULL if all checkpoints are in use. The checkpoint stays in use until it's released. */
+struct checkpoint *checkpoint_new(uint8_t direction, const char *pub_key, uint64_t id, uint64_t size,
+                                  const char *path);
+
+void checkpoint_update(struct checkpoint *cp, uint64_t confirmed);
+
+/* marks cp as no longer in use. If forget is true the transfer can't or needn't be resumed and cp is freed */
+void checkpoint_release(struct checkpoint *cp, bool forget);
+
+/* returns the number of interrupted transfers to (direction is CHECKPOINT_SEND) or from the friend with pub_key */
+int checkpoint_count(uint8_t direction, const char *pub_key);
+
+/* loads the checkpoints saved in TRANSFERS_FILE. Should be called once on startup */
+void checkpoint_load(void);
+
+/* writes the checkpoints to TRANSFERS_FILE if they changed. Returns 0 on success, -1 on failure */
+int checkpoint_save(void);
+
+/* saves changed checkpoints at most every CHECKPOINT_SAVE_INTERVAL seconds. Call once per main loop iteration */
+void do_checkpoints(void);
+
+#endif /* #define _checkpoint_h */
@@ -93,18 +93,15 @@ static int dns_error(ToxWindow *self, const char *errmsg)
     return -1;
 }
 
-static void kill_dns_thread(void *dns_obj)
+static void kill_dns_thread(void)
 {
-    if (dns_obj)
-        tox_dns3_kill(dns_obj);
-
     memset(&t_data, 0, sizeof(struct _thread_data));
     pthread_attr_destroy(&dns_thread.attr);
     pthread_exit(NULL);
 }
 
-/* puts TXT from dns response in buf. Returns length of TXT on success, -1 on fail.*/
-static int parse_dns_response(ToxWindow *self, u_char *answer, int ans_len, char *buf)
+/* puts TXT from dns response in buf. Returns length of TXT on success, -1 on fail with errmsg set. */
+static int parse_dns_response(u_char *answer, int ans_len, char *buf, const char **errmsg)
 {
     uint8_t *ans_pt = answer + sizeof(HEADER);
     uint8_t *ans_end = answer + ans_len;
@@ -112,20 +109,25 @@ static int parse_dns_response(ToxWindow *self, u_char *answer, int ans_len, char
     
     int len = dn_expand(answer, ans_end, ans_pt, exp_ans, sizeof(exp_ans));
 
-    if (len == -1)
-        return dns_error(self, "dn_expand failed."); 
+    if (len == -1) {
+        *errmsg = "dn_expand failed.";
+        return -1;
+    }
 
     ans_pt += len;
 
-    if (ans_pt > ans_end - 4)
-         return dns_error(self, "DNS reply was too short."); 
+    if (ans_pt > ans_end - 4) {
+        *errmsg = "DNS reply was too short.";
+        return -1;
+    }
 
     int type;
     GETSHORT(type, ans_pt);
 
-    if (type != T_TXT)
-        return dns_error(self, "Broken DNS reply."); 
- 
+    if (type != T_TXT) {
+        *errmsg = "Broken DNS reply.";
+        return -1;
+    }
 
     ans_pt += INT16SZ;    /* class */
     uint32_t size = 0;
@@ -135,31 +137,41 @@ static int parse_dns_response(ToxWindow *self, u_char *answer, int ans_len, char
         ans_pt += size;
         len = dn_expand(answer, ans_end, ans_pt, exp_ans, sizeof(exp_ans));
 
-        if (len == -1)
-            return dns_error(self, "Second dn_expand failed."); 
+        if (len == -1) {
+            *errmsg = "Second dn_expand failed.";
+            return -1;
+        }
 
         ans_pt += len;
 
-        if (ans_pt > ans_end - 10)
-            return dns_error(self, "DNS reply was too short."); 
+        if (ans_pt > ans_end - 10) {
+            *errmsg = "DNS reply was too short.";
+            return -1;
+        }
 
         GETSHORT(type, ans_pt);
         ans_pt += INT16SZ;
         ans_pt += 4;
         GETSHORT(size, ans_pt);
 
-        if (ans_pt + size < answer || ans_pt + size > ans_end)
-            return dns_error(self, "RR overflow."); 
+        if (ans_pt + size < answer || ans_pt + size > ans_end) {
+            *errmsg = "RR overflow.";
+            return -1;
+        }
 
     } while (type == T_CNAME);
 
-    if (type != T_TXT)
-        return dns_error(self, "DNS response failed."); 
+    if (type != T_TXT) {
+        *errmsg = "DNS response failed.";
+        return -1;
+    }
 
     uint32_t txt_len = *ans_pt;
 
-    if (!size || txt_len >= size || !txt_len)
-        return dns_error(self, "No record found.");
+    if (!size || txt_len >= size || !txt_len) {
+        *errmsg = "No record found.";
+        return -1;
+    }
 
     ans_pt++;
     ans_pt[txt_len] = '\0';
@@ -175,11 +187,11 @@ static int parse_dns_response(ToxWindow *self, u_char *answer, int ans_len, char
 static int parse_addr(const char *addr, char *namebuf, char *dombuf)
 {
     char tmpaddr[MAX_STR_SIZE];
-    char *tmpname, *tmpdom;
+    char *tmpname, *tmpdom, *saveptr;
 
-    strcpy(tmpaddr, addr);
-    tmpname = strtok(tmpaddr, "@");
-    tmpdom = strtok(NULL, "");
+    snprintf(tmpaddr, sizeof(tmpaddr), "%s", addr);
+    tmpname = strtok_r(tmpaddr, "@", &saveptr);
+    tmpdom = strtok_r(NULL, "", &saveptr);
 
     if (tmpname == NULL || tmpdom == NULL)
         return -1;
@@ -191,19 +203,16 @@ static int parse_addr(const char *addr, char *namebuf, char *dombuf)
     return strlen(namebuf);
 }
 
-/* Does DNS lookup for addr and puts resulting tox id in id_bin. */
-void *dns3_lookup_thread(void *data)
+int dns3_resolve(const char *addr, char *id_bin, const char **errmsg)
 {
-    ToxWindow *self = t_data.self;
-
     char domain[MAX_STR_SIZE];
     char name[MAX_STR_SIZE];
 
-    int namelen = parse_addr(t_data.addr, name, domain);
+    int namelen = parse_addr(addr, name, domain);
 
     if (namelen == -1) {
-        dns_error(self, "Must be a Tox ID or an address in the form username@domain");
-        kill_dns_thread(NULL);
+        *errmsg = "Must be a Tox ID or an address in the form username@domain";
+        return -1;
     }
 
     /* get domain name/pub key */
@@ -220,15 +229,15 @@ void *dns3_lookup_thread(void *data)
     }
 
     if (domname == NULL) {
-        dns_error(self, "Domain not found.");
-        kill_dns_thread(NULL);
+        *errmsg = "Domain not found.";
+        return -1;
     }
 
     void *dns_obj = tox_dns3_new((uint8_t *) DNS_pubkey);
 
     if (dns_obj == NULL) {
-        dns_error(self, "Core failed to create DNS object.");
-        kill_dns_thread(NULL);
+        *errmsg = "Core failed to create DNS object.";
+        return -1;
     }
 
     char string[MAX_DNS_REQST_SIZE];
@@ -238,8 +247,9 @@ void *dns3_lookup_thread(void *data)
                                            (uint8_t *) name, namelen);
 
     if (str_len == -1) {
-        dns_error(self, "Core failed to generate DNS3 string.");
-        kill_dns_thread(dns_obj);
+        *errmsg = "Core failed to generate DNS3 string.";
+        tox_dns3_kill(dns_obj);
+        return -1;
     }
 
     string[str_len] = '\0';
@@ -252,38 +262,58 @@ void *dns3_lookup_thread(void *data)
     int ans_len = res_query(d_string, C_IN, T_TXT, answer, sizeof(answer));
 
     if (ans_len <= 0) {
-        dns_error(self, "DNS query failed.");
-        kill_dns_thread(dns_obj);
+        *errmsg = "DNS query failed.";
+        tox_dns3_kill(dns_obj);
+        return -1;
     }
 
     char ans_id[MAX_DNS_REQST_SIZE];
 
     /* extract TXT from DNS response */
-    if (parse_dns_response(self, answer, ans_len, ans_id) == -1)
-        kill_dns_thread(dns_obj);
+    int txt_len = parse_dns_response(answer, ans_len, ans_id, errmsg);
+
+    if (txt_len == -1) {
+        tox_dns3_kill(dns_obj);
+        return -1;
+    }
 
-    char encrypted_id[MAX_DNS_REQST_SIZE];
     int prfx_len = strlen(TOX_DNS3_TXT_PREFIX);
 
     /* extract the encrypted ID from TXT response */
     if (strncmp(ans_id, TOX_DNS3_TXT_PREFIX, prfx_len) != 0) {
-        dns_error(self, "Bad DNS3 TXT response.");
-        kill_dns_thread(dns_obj);
+        *errmsg = "Bad DNS3 TXT response.";
+        tox_dns3_kill(dns_obj);
+        return -1;
     }
 
-    memcpy(encrypted_id, ans_id + prfx_len, ans_len - prfx_len);
+    const char *encrypted_id = ans_id + prfx_len;
 
-    if (tox_decrypt_dns3_TXT(dns_obj, (uint8_t *) t_data.id_bin, (uint8_t *) encrypted_id, 
+    if (tox_decrypt_dns3_TXT(dns_obj, (uint8_t *) id_bin, (uint8_t *) encrypted_id,
                              strlen(encrypted_id), request_id) == -1) {
-        dns_error(self, "Core failed to decrypt DNS response.");
-        kill_dns_thread(dns_obj);
+        *errmsg = "Core failed to decrypt DNS response.";
+        tox_dns3_kill(dns_obj);
+        return -1;
+    }
+
+    tox_dns3_kill(dns_obj);
+    return 0;
+}
+
+/* Does DNS lookup for addr and puts resulting tox id in id_bin. */
+void *dns3_lookup_thread(void *data)
+{
+    const char *errmsg = NULL;
+
+    if (dns3_resolve(t_data.addr, t_data.id_bin, &errmsg) == -1) {
+        dns_error(t_data.self, errmsg);
+        kill_dns_thread();
     }
 
     pthread_mutex_lock(&Winthread.lock);
-    cmd_add_helper(self, t_data.m, t_data.id_bin, t_data.msg);
+    cmd_add_helper(t_data.self, t_data.m, t_data.id_bin, t_data.msg);
     pthread_mutex_unlock(&Winthread.lock);
 
-    kill_dns_thread(dns_obj);
+    kill_dns_thread();
     return 0;
 }
 
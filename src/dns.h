@@ -29,4 +29,10 @@
 /* creates new thread for dns3 lookup. Only allows one lookup at a time. */
 void dns3_lookup(ToxWindow *self, Tox *m, const char *id_bin, const char *addr, const char *msg);
 
+/* Resolves addr in the form "username@domain" and puts the resulting Tox ID in id_bin.
+   Blocks until the lookup finishes and does not touch the Tox instance or the UI, so
+   several lookups may run at once from different threads.
+   Returns 0 on success, -1 on failure with errmsg pointing to a static error string. */
+int dns3_resolve(const char *addr, char *id_bin, const char **errmsg);
+
 #endif /* #define _dns_h */
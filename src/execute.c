@@ -43,15 +43,20 @@ static struct cmd_func global_commands[] = {
     { "/add",       cmd_add           },
     { "/clear",     cmd_clear         },
     { "/connect",   cmd_connect       },
+    { "/decline",   cmd_decline       },
     { "/exit",      cmd_quit          },
     { "/groupchat", cmd_groupchat     },
     { "/help",      cmd_prompt_help   },
+    { "/import",    cmd_import        },
     { "/log",       cmd_log           },
     { "/myid",      cmd_myid          },
+    { "/netstats",  cmd_netstats      },
     { "/nick",      cmd_nick          },
     { "/note",      cmd_note          },
     { "/q",         cmd_quit          },
     { "/quit",      cmd_quit          },
+    { "/ratelimit", cmd_ratelimit     },
+    { "/requests",  cmd_requests      },
     { "/status",    cmd_status        },
 
 #ifdef _AUDIO
@@ -65,6 +70,7 @@ static struct cmd_func chat_commands[] = {
     { "/join",      cmd_join_group  },
     { "/savefile",  cmd_savefile    },
     { "/sendfile",  cmd_sendfile    },
+    { "/weight",    cmd_weight      },
 
 #ifdef _AUDIO
     { "/call",      cmd_call        },
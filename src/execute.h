@@ -29,11 +29,11 @@
 #define MAX_NUM_ARGS 4     /* Includes command */
 
 #ifdef _AUDIO
-#define GLOBAL_NUM_COMMANDS 16
-#define CHAT_NUM_COMMANDS 12
+#define GLOBAL_NUM_COMMANDS 21
+#define CHAT_NUM_COMMANDS 13
 #else
-#define GLOBAL_NUM_COMMANDS 14
-#define CHAT_NUM_COMMANDS 4
+#define GLOBAL_NUM_COMMANDS 19
+#define CHAT_NUM_COMMANDS 5
 #endif /* _AUDIO */
 
 enum {
@@ -42,6 +42,8 @@ enum {
     GROUPCHAT_COMMAND_MODE,
 };
 
+/* runs the command in input. w is the window's history window, which is NULL while the window has
+   no curses windows (e.g. from onInit); command output goes through line_info_add() regardless */
 void execute(WINDOW *w, ToxWindow *self, Tox *m, const char *input, int mode);
 
 #endif /* #define _execute_h */
@@ -0,0 +1,611 @@
+/*  file_batch.c
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "toxic.h"
+#include "windows.h"
+#include "file_batch.h"
+#include "file_senders.h"
+#include "line_info.h"
+#include "misc_tools.h"
+#include "notify.h"
+
+/* ustar header field offsets and sizes */
+#define TAR_NAME_SIZE 100
+#define TAR_PREFIX_SIZE 155
+#define TAR_MODE 100
+#define TAR_SIZE 124
+#define TAR_MTIME 136
+#define TAR_CHKSUM 148
+#define TAR_TYPEFLAG 156
+#define TAR_MAGIC 257
+#define TAR_PREFIX 345
+
+struct tar_member {
+    char *path;    /* a directory's ends with '/' */
+    size_t name_start;    /* offset of the member's name in the archive, "<dir>/<relative path>", in path */
+    size_t prefix_len;    /* length of the part of the name that goes in the prefix field; 0 if it all fits in name */
+    uint64_t size;
+    uint64_t end;    /* offset in the archive just after the member's data and padding */
+    int files_end;    /* regular files up to and including this member */
+    time_t mtime;
+    mode_t mode;
+};
+
+/* Each member is a header block followed by its data padded to a whole block, and the archive ends
+   with two zero blocks. Sizes are fixed when the directory is walked: a file that has since grown
+   is cut off and one that shrank or can't be read is padded with zeros, so the archive is always
+   as long as announced to the receiver.
+   The archive is generated by a reader thread into a ring of TAR_READ_AHEAD bytes so the core thread
+   never waits on the disk; it only copies the bytes in [pos, generated) out of the ring */
+struct tar_stream {
+    struct tar_member *members;
+    int num_members;
+    int max_members;
+    int num_files;    /* members that are regular files */
+    uint64_t size;
+    int num_sent;    /* core thread only */
+    uint64_t pos;    /* bytes copied out by the core thread */
+
+    /* reader thread only */
+    int cur;    /* member being generated */
+    uint64_t member_pos;    /* position within the current member */
+    FILE *file;    /* the current member's file once its data is reached; NULL if it couldn't be opened */
+    char header[TAR_BLOCK_SIZE];
+    int unreadable;
+
+    /* protected by lock */
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t space;    /* signalled when the core thread frees part of the ring */
+    char *ring;    /* NULL until the reader thread is started */
+    uint64_t generated;    /* bytes of the archive put in the ring */
+    int num_unreadable;
+    bool stop;
+};
+
+static uint64_t tar_padded(uint64_t size)
+{
+    return (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+}
+
+/* finds where a name of len bytes is split between the prefix and name fields of a ustar header.
+   Returns -1 if it can't be stored */
+static int tar_split_name(const char *name, size_t len, size_t *prefix_len)
+{
+    *prefix_len = 0;
+
+    if (len <= TAR_NAME_SIZE)
+        return 0;
+
+    size_t i;
+
+    for (i = MIN(len - 1, TAR_PREFIX_SIZE); i > 0; --i) {
+        if (name[i] == '/' && len - i - 1 <= TAR_NAME_SIZE) {
+            *prefix_len = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static void tar_header(char *hdr, const struct tar_member *mb)
+{
+    const char *name = mb->path + mb->name_start;
+    memset(hdr, 0, TAR_BLOCK_SIZE);
+
+    if (mb->prefix_len) {
+        memcpy(hdr + TAR_PREFIX, name, mb->prefix_len);
+        name += mb->prefix_len + 1;
+    }
+
+    memcpy(hdr, name, strlen(name));
+    snprintf(hdr + TAR_MODE, 8, "%07o", (unsigned int) (mb->mode & 07777));
+    snprintf(hdr + TAR_MODE + 8, 8, "%07o", 0);    /* uid */
+    snprintf(hdr + TAR_MODE + 16, 8, "%07o", 0);    /* gid */
+    snprintf(hdr + TAR_SIZE, 12, "%011llo", (unsigned long long) mb->size);
+    snprintf(hdr + TAR_MTIME, 12, "%011llo", MIN((unsigned long long) MAX(mb->mtime, 0), 077777777777ULL));
+    hdr[TAR_TYPEFLAG] = S_ISDIR(mb->mode) ? '5' : '0';
+    memcpy(hdr + TAR_MAGIC, "ustar\0" "00", 8);
+
+    /* the checksum is computed with its own field set to spaces */
+    memset(hdr + TAR_CHKSUM, ' ', 8);
+    unsigned int sum = 0;
+    int i;
+
+    for (i = 0; i < TAR_BLOCK_SIZE; ++i)
+        sum += (unsigned char) hdr[i];
+
+    snprintf(hdr + TAR_CHKSUM, 7, "%06o", sum);
+}
+
+uint64_t tar_size(const struct tar_stream *tar)
+{
+    return tar->size;
+}
+
+int tar_num_files(const struct tar_stream *tar)
+{
+    return tar->num_files;
+}
+
+int tar_num_unreadable(struct tar_stream *tar)
+{
+    pthread_mutex_lock(&tar->lock);
+    int n = tar->num_unreadable;
+    pthread_mutex_unlock(&tar->lock);
+    return n;
+}
+
+/* generates the next len bytes of the archive into buf. Called by the reader thread */
+static void tar_generate(struct tar_stream *tar, char *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        char *dst = buf + done;
+        size_t n = len - done;
+
+        if (tar->cur == tar->num_members) {    /* end of archive blocks */
+            memset(dst, 0, n);
+            done += n;
+            break;
+        }
+
+        struct tar_member *mb = &tar->members[tar->cur];
+        uint64_t data_end = TAR_BLOCK_SIZE + mb->size;
+
+        if (tar->member_pos < TAR_BLOCK_SIZE) {
+            if (tar->member_pos == 0)
+                tar_header(tar->header, mb);
+
+            n = MIN(n, TAR_BLOCK_SIZE - tar->member_pos);
+            memcpy(dst, tar->header + tar->member_pos, n);
+        } else if (tar->member_pos < data_end) {
+            if (tar->member_pos == TAR_BLOCK_SIZE && (tar->file = fopen(mb->path, "rb")) == NULL)
+                ++tar->unreadable;
+
+            n = MIN(n, data_end - tar->member_pos);
+            size_t got = tar->file ? fread(dst, 1, n, tar->file) : 0;
+            memset(dst + got, 0, n - got);
+        } else {
+            n = MIN(n, TAR_BLOCK_SIZE + tar_padded(mb->size) - tar->member_pos);
+            memset(dst, 0, n);
+        }
+
+        done += n;
+        tar->member_pos += n;
+
+        if (tar->member_pos == TAR_BLOCK_SIZE + tar_padded(mb->size)) {
+            if (tar->file)
+                fclose(tar->file);
+
+            tar->file = NULL;
+            tar->member_pos = 0;
+            ++tar->cur;
+        }
+    }
+}
+
+static void *tar_thread(void *data)
+{
+    struct tar_stream *tar = data;
+
+    pthread_mutex_lock(&tar->lock);
+
+    while (!tar->stop && tar->generated < tar->size) {
+        uint64_t free_space = TAR_READ_AHEAD - (tar->generated - tar->pos);
+
+        if (free_space < TAR_GENERATE_CHUNK && tar->generated + free_space < tar->size) {
+            pthread_cond_wait(&tar->space, &tar->lock);
+            continue;
+        }
+
+        size_t start = tar->generated % TAR_READ_AHEAD;
+        size_t len = MIN(MIN(free_space, TAR_READ_AHEAD - start), MIN(tar->size - tar->generated, TAR_GENERATE_CHUNK));
+        pthread_mutex_unlock(&tar->lock);
+
+        /* the core thread doesn't touch the ring past generated */
+        tar_generate(tar, tar->ring + start, len);
+
+        pthread_mutex_lock(&tar->lock);
+        tar->generated += len;
+        tar->num_unreadable = tar->unreadable;
+    }
+
+    pthread_mutex_unlock(&tar->lock);
+    return NULL;
+}
+
+/* starts the reader thread of tar. Returns -1 on failure */
+static int tar_start(struct tar_stream *tar)
+{
+    tar->ring = malloc(TAR_READ_AHEAD);
+
+    if (tar->ring == NULL)
+        exit_toxic_err("failed in tar_start", FATALERR_MEMORY);
+
+    if (pthread_create(&tar->tid, NULL, tar_thread, tar) != 0) {
+        free(tar->ring);
+        tar->ring = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t tar_read(struct tar_stream *tar, char *buf, size_t len)
+{
+    pthread_mutex_lock(&tar->lock);
+    len = MIN(len, tar->generated - tar->pos);
+    pthread_mutex_unlock(&tar->lock);
+
+    size_t start = tar->pos % TAR_READ_AHEAD;
+    size_t n = MIN(len, TAR_READ_AHEAD - start);
+    memcpy(buf, tar->ring + start, n);
+    memcpy(buf + n, tar->ring, len - n);
+
+    pthread_mutex_lock(&tar->lock);
+    tar->pos += len;
+    pthread_cond_signal(&tar->space);
+    pthread_mutex_unlock(&tar->lock);
+
+    return len;
+}
+
+int tar_files_sent(struct tar_stream *tar, uint64_t offset)
+{
+    while (tar->num_sent < tar->num_members && tar->members[tar->num_sent].end <= offset)
+        ++tar->num_sent;
+
+    return tar->num_sent ? tar->members[tar->num_sent - 1].files_end : 0;
+}
+
+void tar_close(struct tar_stream *tar)
+{
+    if (tar->ring) {
+        pthread_mutex_lock(&tar->lock);
+        tar->stop = true;
+        pthread_cond_signal(&tar->space);
+        pthread_mutex_unlock(&tar->lock);
+
+        pthread_join(tar->tid, NULL);
+        free(tar->ring);
+    }
+
+    if (tar->file)
+        fclose(tar->file);
+
+    pthread_mutex_destroy(&tar->lock);
+    pthread_cond_destroy(&tar->space);
+
+    int i;
+
+    for (i = 0; i < tar->num_members; ++i)
+        free(tar->members[i].path);
+
+    free(tar->members);
+    free(tar);
+}
+
+static void tar_add(struct tar_stream *tar, const char *path, size_t name_start, size_t prefix_len,
+                    const struct stat *st)
+{
+    if (tar->num_members == tar->max_members) {
+        tar->max_members = MAX(tar->max_members * 2, 64);
+        tar->members = realloc(tar->members, tar->max_members * sizeof(struct tar_member));
+
+        if (tar->members == NULL)
+            exit_toxic_err("failed in tar_add", FATALERR_MEMORY);
+    }
+
+    struct tar_member *mb = &tar->members[tar->num_members++];
+    mb->path = strdup(path);
+
+    if (mb->path == NULL)
+        exit_toxic_err("failed in tar_add", FATALERR_MEMORY);
+
+    mb->name_start = name_start;
+    mb->prefix_len = prefix_len;
+    mb->size = S_ISDIR(st->st_mode) ? 0 : st->st_size;
+    mb->mtime = st->st_mtime;
+    mb->mode = st->st_mode;
+    mb->end = tar->size + TAR_BLOCK_SIZE + tar_padded(mb->size);
+    tar->size = mb->end;
+
+    if (S_ISREG(st->st_mode))
+        ++tar->num_files;
+
+    mb->files_end = tar->num_files;
+}
+
+static void batch_add_large(struct file_batch *batch, const char *path)
+{
+    if ((batch->num_large & (batch->num_large - 1)) == 0) {
+        batch->large = realloc(batch->large, MAX(batch->num_large * 2, 1) * sizeof(char *));
+
+        if (batch->large == NULL)
+            exit_toxic_err("failed in batch_add_large", FATALERR_MEMORY);
+    }
+
+    batch->large[batch->num_large] = strdup(path);
+
+    if (batch->large[batch->num_large] == NULL)
+        exit_toxic_err("failed in batch_add_large", FATALERR_MEMORY);
+
+    ++batch->num_large;
+}
+
+/* adds the regular files under dirpath to the batch, and the directories that end up with nothing
+   in it to the archive so they're recreated. name_start is the offset of archive names in the paths.
+   Returns the number of entries skipped */
+static int batch_walk(struct file_batch *batch, struct tar_stream *tar, const char *dirpath, size_t name_start,
+                      int depth)
+{
+    DIR *dir = opendir(dirpath);
+
+    if (dir == NULL)
+        return 1;
+
+    struct dirent *ent;
+    int skipped = 0;
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        char path[PATH_MAX];
+        struct stat st;
+
+        if (snprintf(path, sizeof(path), "%s/%s", dirpath, ent->d_name) >= (int) sizeof(path)
+                || lstat(path, &st) != 0) {
+            ++skipped;
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (depth >= MAX_BATCH_DEPTH) {
+                ++skipped;
+                continue;
+            }
+
+            int members = tar->num_members + batch->num_large;
+            skipped += batch_walk(batch, tar, path, name_start, depth + 1);
+
+            /* stored as "<path>/" so the receiver creates it even though no file is extracted into it */
+            size_t len = strlen(path);
+            size_t prefix_len;
+
+            if (members == tar->num_members + batch->num_large && len + 1 < sizeof(path)
+                    && tar->num_members < MAX_BATCH_FILES) {
+                strcpy(path + len, "/");
+
+                if (tar_split_name(path + name_start, len + 1 - name_start, &prefix_len) == 0)
+                    tar_add(tar, path, name_start, prefix_len, &st);
+                else
+                    ++skipped;
+            }
+
+            continue;
+        }
+
+        /* symlinks aren't followed so a link can't pull in files outside the directory or loop */
+        if (!S_ISREG(st.st_mode) || batch->num_files >= MAX_BATCH_FILES) {
+            ++skipped;
+            continue;
+        }
+
+        size_t prefix_len;
+
+        if (st.st_size < BATCH_SMALL_SIZE && tar_split_name(path + name_start, strlen(path + name_start),
+                &prefix_len) == 0) {
+            tar_add(tar, path, name_start, prefix_len, &st);
+        } else {
+            batch_add_large(batch, path);
+            batch->size += st.st_size;
+        }
+
+        ++batch->num_files;
+    }
+
+    closedir(dir);
+    return skipped;
+}
+
+static void batch_free(struct file_batch *batch)
+{
+    int i;
+
+    for (i = 0; i < batch->num_large; ++i)
+        free(batch->large[i]);
+
+    free(batch->large);
+    free(batch);
+}
+
+/* starts sending large files until BATCH_MAX_SENDERS of the batch's transfers are running. self is
+   NULL if the friend's chat window is closed */
+static void batch_start_next(ToxWindow *self, Tox *m, struct file_batch *batch)
+{
+    while (batch->num_senders < BATCH_MAX_SENDERS && batch->next_large < batch->num_large) {
+        const char *path = batch->large[batch->next_large++];
+        const char *errmsg;
+
+        if (new_file_sender(m, batch->friendnum, path, NULL, batch, &errmsg) == -1) {
+            if (self != NULL)
+                line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Can't send '%s': %s", path, errmsg);
+
+            ++batch->files_failed;
+            continue;
+        }
+
+        ++batch->num_senders;
+    }
+}
+
+int send_directory(ToxWindow *self, Tox *m, const char *path, const char **errmsg)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        *errmsg = "Directory not found.";
+        return -1;
+    }
+
+    struct file_batch *batch = calloc(1, sizeof(struct file_batch));
+    struct tar_stream *tar = calloc(1, sizeof(struct tar_stream));
+
+    if (batch == NULL || tar == NULL)
+        exit_toxic_err("failed in send_directory", FATALERR_MEMORY);
+
+    pthread_mutex_init(&tar->lock, NULL);
+    pthread_cond_init(&tar->space, NULL);
+
+    batch->friendnum = self->num;
+    snprintf(batch->path, sizeof(batch->path), "%s", path);
+    int len = strlen(batch->path);
+
+    while (len > 1 && batch->path[len - 1] == '/')
+        batch->path[--len] = '\0';
+
+    /* archive names start with the directory's own name */
+    const char *base = strrchr(batch->path, '/');
+    size_t name_start = base ? base + 1 - batch->path : 0;
+
+    if (batch->path[name_start] == '\0') {
+        tar_close(tar);
+        batch_free(batch);
+        *errmsg = "Invalid directory.";
+        return -1;
+    }
+
+    int skipped = batch_walk(batch, tar, batch->path, name_start, 0);
+
+    if (batch->num_files == 0) {
+        tar_close(tar);
+        batch_free(batch);
+        *errmsg = "Directory has no files to send.";
+        return -1;
+    }
+
+    if (tar->num_members > 0) {
+        tar->size += 2 * TAR_BLOCK_SIZE;
+        batch->size += tar->size;
+
+        char archive[MAX_STR_SIZE];
+        snprintf(archive, sizeof(archive), "%s.tar", batch->path);
+
+        if (tar_start(tar) == -1) {
+            tar_close(tar);
+            batch_free(batch);
+            *errmsg = "Failed to start the archive's reader thread.";
+            return -1;
+        }
+
+        if (new_file_sender(m, self->num, archive, tar, batch, errmsg) == -1) {
+            tar_close(tar);
+            batch_free(batch);
+            return -1;
+        }
+
+        ++batch->num_senders;
+    } else {
+        tar_close(tar);
+    }
+
+    int num_packed = batch->num_files - batch->num_large;
+
+    if (num_packed > 0)
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Sending %d files from '%s' (%d packed into '%s.tar').",
+                      batch->num_files, batch->path, num_packed, batch->path);
+    else
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Sending %d files from '%s'.", batch->num_files,
+                      batch->path);
+
+    if (skipped > 0)
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Skipped %d entries that aren't regular files "
+                      "or couldn't be read.", skipped);
+
+    char progline[MAX_STR_SIZE];
+    prep_prog_line(progline);
+    batch->line_id = line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", progline);
+
+    batch_start_next(self, m, batch);
+
+    if (batch->num_senders == 0) {
+        batch_free(batch);
+        *errmsg = "Error sending files.";
+        return -1;
+    }
+
+    return 0;
+}
+
+void file_batch_sender_closed(ToxWindow *self, Tox *m, struct file_batch *batch, int files_sent, int files_failed)
+{
+    batch->files_sent += files_sent;
+    batch->files_failed += files_failed;
+    --batch->num_senders;
+
+    if (batch->stopped) {
+        if (batch->num_senders == 0)
+            batch_free(batch);
+
+        return;
+    }
+
+    batch_start_next(self, m, batch);
+
+    if (batch->num_senders > 0)
+        return;
+
+    if (self == NULL) {
+        batch_free(batch);
+        return;
+    }
+
+    uint64_t elapsed = batch->start_time ? get_time_ms() - batch->start_time : 0;
+    double files_per_sec = elapsed ? batch->files_sent * 1000.0 / elapsed : 0;
+
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Sent %d of %d files from '%s' in %llu s (%.1f files/s).",
+                  batch->files_sent, batch->num_files, batch->path, (unsigned long long) (elapsed / 1000),
+                  files_per_sec);
+
+    Notification notif = batch->files_failed ? error : transfer_completed;
+
+    if (self->active_box != -1)
+        box_notify2(self, notif, NT_NOFOCUS | NT_WNDALERT_2, self->active_box, "Sent %d of %d files from '%s'",
+                    batch->files_sent, batch->num_files, batch->path);
+    else
+        box_notify(self, notif, NT_NOFOCUS | NT_WNDALERT_2, &self->active_box, self->name,
+                   "Sent %d of %d files from '%s'", batch->files_sent, batch->num_files, batch->path);
+
+    batch_free(batch);
+}
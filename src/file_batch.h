@@ -0,0 +1,88 @@
+/*  file_batch.h
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _file_batch_h
+#define _file_batch_h
+
+#include "toxic.h"
+#include "windows.h"
+
+#define BATCH_SMALL_SIZE (1024 * 1024)    /* files smaller than this are packed into the batch's archive */
+#define BATCH_MAX_SENDERS 4    /* max large files of a batch sent at once */
+#define MAX_BATCH_FILES 100000
+#define MAX_BATCH_DEPTH 32    /* directories nested deeper than this are skipped */
+#define TAR_BLOCK_SIZE 512
+#define TAR_READ_AHEAD (4 * 1024 * 1024)    /* bytes of an archive its reader thread generates ahead of the sender */
+#define TAR_GENERATE_CHUNK (64 * 1024)    /* bytes the reader thread generates at a time */
+
+/* ustar archive of a batch's small files and empty directories, generated by a reader thread as it's sent */
+struct tar_stream;
+
+/* A directory sent with /sendfile -r. Its small files and empty directories are streamed as one ustar
+   archive while large files (and files whose path doesn't fit in a ustar header) are sent as separate
+   transfers, BATCH_MAX_SENDERS at a time. The batch is freed once its last transfer is closed */
+struct file_batch {
+    char path[MAX_STR_SIZE];
+    char **large;    /* paths of the files sent as separate transfers */
+    int num_large;
+    int next_large;    /* index in large of the next file to send */
+    int num_files;
+    int files_sent;    /* files of closed transfers that arrived */
+    int files_failed;
+    int archive_sent;    /* archive members the running archive transfer has sent */
+    int num_senders;    /* transfers running */
+    uint64_t size;    /* bytes of all transfers, including the archive's headers and padding */
+    uint64_t bytes_sent;
+    double bps;
+    uint64_t start_time;    /* ms when the first piece was handed to the core */
+    uint64_t last_progress;
+    uint32_t line_id;
+    int32_t friendnum;
+    bool stopped;    /* no more files are started: the friend was deleted or toxic is exiting */
+};
+
+/* walks the directory at path and starts sending its files to friend self->num.
+   Returns 0 on success or -1 with errmsg set */
+int send_directory(ToxWindow *self, Tox *m, const char *path, const char **errmsg);
+
+/* called by the file senders when a transfer of batch is closed. files_sent of the transfer's files
+   arrived and files_failed didn't. Starts the next large file or, after the last transfer, reports
+   the batch and frees it. self is NULL if the friend's chat window is closed: nothing is reported */
+void file_batch_sender_closed(ToxWindow *self, Tox *m, struct file_batch *batch, int files_sent, int files_failed);
+
+uint64_t tar_size(const struct tar_stream *tar);
+
+/* copies the next len bytes of the archive that the reader thread has generated into buf. Never waits:
+   returns the number of bytes copied, which is less than len if the reader thread is behind */
+size_t tar_read(struct tar_stream *tar, char *buf, size_t len);
+
+/* returns the number of regular files in the archive that end at or before offset */
+int tar_files_sent(struct tar_stream *tar, uint64_t offset);
+
+int tar_num_files(const struct tar_stream *tar);
+
+/* returns the number of members whose file couldn't be read. Their data is sent as zeros */
+int tar_num_unreadable(struct tar_stream *tar);
+
+void tar_close(struct tar_stream *tar);
+
+#endif /* #define _file_batch_h */
@@ -22,8 +22,14 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
+#include <signal.h>
+#include <setjmp.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "toxic.h"
 #include "windows.h"
@@ -32,16 +38,256 @@
 #include "line_info.h"
 #include "misc_tools.h"
 #include "notify.h"
+#include "settings.h"
+#include "file_writer.h"
+#include "checkpoint.h"
 
-FileSender file_senders[MAX_FILES];
-uint8_t max_file_senders_index;
-uint8_t num_active_file_senders;
-extern ToxicFriend friends[MAX_FRIENDS_NUM];
+extern struct user_settings *user_settings_;
 
 #define KiB 1024
 #define MiB 1048576       /* 1024 ^ 2 */
 #define GiB 1073741824    /* 1024 ^ 3 */
 
+/* Rate limits are token buckets: sending a piece needs tokens in the global and the friend's upload
+   bucket, while received data is charged after the fact and pauses the transfer once a download
+   bucket goes negative or the writer thread falls behind. do_file_receivers() resumes it when both
+   have caught up */
+static struct token_bucket upload_bucket;
+static struct token_bucket download_bucket;
+static uint64_t upload_rate;    /* global upload limit for the current call to do_file_senders() */
+static int num_paused_receivers;
+
+/* Outgoing transfers are looked up through their friend's FileTransfers table and scheduled from
+   sender_list, a compact list in the order they were started. A closed sender leaves its friend's
+   table at once but stays in the list, inactive, until the next call to do_file_senders() compacts
+   it, so the scheduler can walk the list while transfers close */
+static FileSender **sender_list;
+static int sender_list_len;    /* entries in sender_list, including closed senders */
+static int sender_list_size;
+static int num_active_file_senders;
+static int next_turn;    /* index in sender_list of the sender the scheduler visits first */
+static FileSender *credited_turn;    /* sender at next_turn whose turn was cut short after it was credited */
+static struct token_bucket send_bucket;    /* bytes all senders may hand to the core */
+
+FileSender *get_file_sender(int32_t friendnum, uint8_t filenum)
+{
+    struct FileTransfers *ft = get_friend(friendnum)->file_transfers;
+    return ft ? ft->senders[filenum] : NULL;
+}
+
+static void add_file_sender(FileSender *fs)
+{
+    if (sender_list_len == sender_list_size) {
+        sender_list_size = MAX(sender_list_size * 2, 16);
+        sender_list = realloc(sender_list, sender_list_size * sizeof(FileSender *));
+
+        if (sender_list == NULL)
+            exit_toxic_err("failed in add_file_sender", FATALERR_MEMORY);
+    }
+
+    sender_list[sender_list_len++] = fs;
+    get_file_transfers(fs->friendnum)->senders[fs->filenum] = fs;
+    ++get_friend(fs->friendnum)->num_file_senders;
+    ++num_active_file_senders;
+}
+
+/* frees closed senders and closes the gaps they leave in sender_list, keeping the scheduler's turn */
+static void compact_file_senders(void)
+{
+    int i, j = 0;
+    int turn = 0;
+
+    for (i = 0; i < sender_list_len; ++i) {
+        if (i == next_turn)
+            turn = j;
+
+        if (sender_list[i]->active) {
+            sender_list[j++] = sender_list[i];
+        } else {
+            if (sender_list[i] == credited_turn)
+                credited_turn = NULL;
+
+            free(sender_list[i]);
+        }
+    }
+
+    sender_list_len = j;
+    next_turn = j ? turn % j : 0;
+}
+
+/* returns true while a call is running in any chat window */
+static bool call_active(void)
+{
+#ifdef _AUDIO
+    int i;
+
+    for (i = 0; i < get_num_active_windows(); ++i) {
+        ToxWindow *w = get_open_window(i);
+
+        if (w->is_chat && w->call_idx != -1)
+            return true;
+    }
+#endif /* _AUDIO */
+
+    return false;
+}
+
+/* returns the lower of two rate limits where 0 means no limit */
+static uint64_t min_rate(uint64_t a, uint64_t b)
+{
+    if (a == 0 || b == 0)
+        return a + b;
+
+    return MIN(a, b);
+}
+
+/* returns the global limit in bytes per second for outgoing (send is true) or incoming transfers */
+static uint64_t global_rate(bool send)
+{
+    uint64_t rate = send ? user_settings_->upload_limit : user_settings_->download_limit;
+
+    if (call_active())
+        rate = min_rate(rate, user_settings_->call_rate_limit);
+
+    return rate * KiB;
+}
+
+static uint64_t friend_rate(int32_t friendnum, bool send)
+{
+    return (uint64_t) (send ? get_friend(friendnum)->upload_limit : get_friend(friendnum)->download_limit) * KiB;
+}
+
+uint64_t get_rate_limit(int32_t friendnum, bool send)
+{
+    return min_rate(global_rate(send), friend_rate(friendnum, send));
+}
+
+/* adds the tokens earned at rate bytes per second since the last refill, keeping at most
+   RATE_LIMIT_BURST ms worth */
+static void bucket_refill(struct token_bucket *b, uint64_t rate, uint64_t now)
+{
+    if (rate == 0) {
+        b->tokens = 0;
+        b->last_refill = now;
+        return;
+    }
+
+    uint64_t earned = rate * MIN(now - b->last_refill, 1000) / 1000;
+
+    if (earned == 0)    /* wait until at least a byte is earned so slow rates aren't rounded away */
+        return;
+
+    int64_t burst = MAX(rate * RATE_LIMIT_BURST / 1000, FILE_PIECE_SIZE);
+    b->tokens = MIN(b->tokens + (int64_t) earned, burst);
+    b->last_refill = now;
+}
+
+/* returns true if the upload limits let fs send its next piece */
+static bool upload_allowed(FileSender *fs)
+{
+    ToxicFriend *f = get_friend(fs->friendnum);
+
+    if (upload_rate && upload_bucket.tokens < fs->piecelen)
+        return false;
+
+    if (f->upload_limit == 0)
+        return true;
+
+    bucket_refill(&f->upload_bucket, friend_rate(fs->friendnum, true), get_time_ms());
+    return f->upload_bucket.tokens >= fs->piecelen;
+}
+
+static void upload_charge(FileSender *fs)
+{
+    if (upload_rate)
+        upload_bucket.tokens -= fs->piecelen;
+
+    if (get_friend(fs->friendnum)->upload_limit)
+        get_friend(fs->friendnum)->upload_bucket.tokens -= fs->piecelen;
+}
+
+void rate_limit_received(Tox *m, int32_t friendnum, uint8_t filenum, uint16_t length)
+{
+    struct FileReceiver *rx = get_file_receiver(friendnum, filenum);
+
+    if (rx == NULL)
+        return;
+
+    uint64_t rate = global_rate(false);
+    uint64_t f_rate = friend_rate(friendnum, false);
+    uint64_t now = get_time_ms();
+    bool over = file_writer_backlogged();
+
+    if (rate) {
+        bucket_refill(&download_bucket, rate, now);
+        download_bucket.tokens -= length;
+        over = over || download_bucket.tokens < 0;
+    }
+
+    if (f_rate) {
+        bucket_refill(&get_friend(friendnum)->download_bucket, f_rate, now);
+        get_friend(friendnum)->download_bucket.tokens -= length;
+        over = over || get_friend(friendnum)->download_bucket.tokens < 0;
+    }
+
+    if (!over || rx->paused)
+        return;
+
+    if (tox_file_send_control(m, friendnum, 1, filenum, TOX_FILECONTROL_PAUSE, 0, 0) == 0) {
+        rx->paused = true;
+        ++num_paused_receivers;
+    }
+}
+
+void rate_limit_forget(int32_t friendnum, uint8_t filenum)
+{
+    struct FileReceiver *rx = get_file_receiver(friendnum, filenum);
+
+    if (rx && rx->paused) {
+        rx->paused = false;
+        --num_paused_receivers;
+    }
+}
+
+void do_file_receivers(Tox *m)
+{
+    if (num_paused_receivers == 0 || file_writer_backlogged())
+        return;
+
+    uint64_t now = get_time_ms();
+    uint64_t rate = global_rate(false);
+    bucket_refill(&download_bucket, rate, now);
+
+    if (rate && download_bucket.tokens < 0)
+        return;
+
+    int i, j;
+
+    for (i = 0; i < get_max_friends_index() && num_paused_receivers > 0; ++i) {
+        struct FileTransfers *ft = get_friend(i)->file_transfers;
+
+        if (!get_friend(i)->active || ft == NULL)
+            continue;
+
+        uint64_t f_rate = friend_rate(i, false);
+        bucket_refill(&get_friend(i)->download_bucket, f_rate, now);
+
+        if (f_rate && get_friend(i)->download_bucket.tokens < 0)
+            continue;
+
+        for (j = 0; j < MAX_FILES; ++j) {
+            struct FileReceiver *rx = ft->receivers[j];
+
+            if (rx == NULL || !rx->paused)
+                continue;
+
+            tox_file_send_control(m, i, 1, j, TOX_FILECONTROL_ACCEPT, 0, 0);
+            rx->paused = false;
+            --num_paused_receivers;
+        }
+    }
+}
+
 /* creates initial progress line that will be updated during file transfer.
    Assumes progline is of size MAX_STR_SIZE */
 void prep_prog_line(char *progline)
@@ -55,21 +301,9 @@ void prep_prog_line(char *progline)
     strcat(progline, "] 0%%");
 }
 
-/* prints a progress bar for file transfers. 
-   if friendnum is -1 we're sending the file, otherwise we're receiving.  */
-void print_progress_bar(ToxWindow *self, int idx, int friendnum, double pct_remain)
+/* puts bps formatted with a unit in buf */
+static void format_rate(char *buf, size_t size, double bps)
 {
-    double bps;
-    uint32_t line_id;
-
-    if (friendnum < 0) {
-        bps = file_senders[idx].bps;
-        line_id = file_senders[idx].line_id;
-    } else {
-        bps = friends[friendnum].file_receiver.bps[idx];
-        line_id = friends[friendnum].file_receiver.line_id[idx];
-    }
-
     const char *unit;
 
     if (bps < KiB) {
@@ -85,8 +319,25 @@ void print_progress_bar(ToxWindow *self, int idx, int friendnum, double pct_rema
         bps /= (double) GiB;
     }
 
-    char msg[MAX_STR_SIZE];
-    snprintf(msg, sizeof(msg), "%.1f %s [", bps, unit);
+    snprintf(buf, size, "%.1f %s", bps, unit);
+}
+
+/* returns the average rate of fs since its first piece was sent */
+static double file_sender_avg_bps(FileSender *fs)
+{
+    uint64_t elapsed = get_time_ms() - fs->start_time;
+
+    if (fs->start_time == 0 || elapsed == 0)
+        return 0;
+
+    return (fs->offset - fs->start_offset) * 1000.0 / elapsed;
+}
+
+/* appends a bar of NUM_PROG_MARKS marks and the percentage to msg, which is of size MAX_STR_SIZE */
+static void append_prog_bar(char *msg, double pct_remain)
+{
+    strcat(msg, " [");
+
     int n = pct_remain / (100 / NUM_PROG_MARKS);
     int i;
 
@@ -103,127 +354,787 @@ void print_progress_bar(ToxWindow *self, int idx, int friendnum, double pct_rema
     char pctstr[16];
     snprintf(pctstr, sizeof(pctstr), "%.2f%%", pct_remain);
     strcat(msg, pctstr);
+}
+
+/* prints a progress bar for friendnum's file transfer filenum. send is true for outgoing transfers */
+void print_progress_bar(ToxWindow *self, int32_t friendnum, uint8_t filenum, bool send, double pct_remain)
+{
+    FileSender *fs = send ? get_file_sender(friendnum, filenum) : NULL;
+    struct FileReceiver *rx = send ? NULL : get_file_receiver(friendnum, filenum);
+
+    if (fs == NULL && rx == NULL)
+        return;
+
+    double bps = fs ? fs->bps : rx->bps;
+    uint32_t line_id = fs ? fs->line_id : rx->line_id;
+    uint64_t limit = get_rate_limit(friendnum, send);
 
+    char msg[MAX_STR_SIZE];
+    char rate[32];
+    format_rate(rate, sizeof(rate), bps);
+    snprintf(msg, sizeof(msg), "%s", rate);
+
+    /* outgoing transfers also show the average rate, which doesn't jump around with the core's pacing */
+    if (fs) {
+        char avg[32];
+        format_rate(avg, sizeof(avg), file_sender_avg_bps(fs));
+        snprintf(msg + strlen(msg), sizeof(msg) - strlen(msg), " (avg %s)", avg);
+    }
+
+    if (limit) {
+        char lim[32];
+        format_rate(lim, sizeof(lim), limit);
+        snprintf(msg + strlen(msg), sizeof(msg) - strlen(msg), " (limit %s)", lim);
+    }
+
+    append_prog_bar(msg, pct_remain);
     line_info_set(self, line_id, msg);
 }
 
-static void set_max_file_senders_index(void)
+/* refreshes the progress line of the batch fs belongs to; the line is shared by all of the batch's
+   transfers. force refreshes it even if it was refreshed less than a second ago */
+static void print_batch_progress(ToxWindow *self, FileSender *fs, bool force)
 {
-    int j;
+    struct file_batch *batch = fs->batch;
+    uint64_t curtime = get_unix_time();
+
+    if (fs->tar)
+        batch->archive_sent = tar_files_sent(fs->tar, fs->offset);
+
+    if (self == NULL || !(force || timed_out(batch->last_progress, curtime, 1)))
+        return;
+
+    batch->last_progress = curtime;
+
+    int files_done = batch->files_sent + batch->archive_sent;
+    uint64_t elapsed = get_time_ms() - batch->start_time;
+    double files_per_sec = batch->start_time && elapsed ? files_done * 1000.0 / elapsed : 0;
+
+    char rate[32];
+    format_rate(rate, sizeof(rate), batch->bps);
+    batch->bps = 0;
+
+    char msg[MAX_STR_SIZE];
+    snprintf(msg, sizeof(msg), "%d/%d files, %.1f files/s, %s", files_done, batch->num_files, files_per_sec, rate);
+
+    uint64_t limit = get_rate_limit(fs->friendnum, true);
+
+    if (limit) {
+        char lim[32];
+        format_rate(lim, sizeof(lim), limit);
+        snprintf(msg + strlen(msg), sizeof(msg) - strlen(msg), " (limit %s)", lim);
+    }
+
+    append_prog_bar(msg, batch->size ? batch->bytes_sent * 100.0 / batch->size : 100);
+    line_info_set(self, batch->line_id, msg);
+}
+
+/* reads the next len bytes of a buffered file or archive into buf */
+static size_t file_sender_read(FileSender *fs, char *buf, size_t len)
+{
+    if (fs->tar)
+        return tar_read(fs->tar, buf, len);
+
+    return fread(buf, 1, len, fs->file);
+}
+
+/* A file truncated while it's mapped raises SIGBUS when its missing pages are read. Mapped data is
+   only read through file_sender_map_read(), which points map_fault_jmp at itself for the duration
+   so the handler can jump back and the read fails instead of crashing toxic */
+static __thread sigjmp_buf *volatile map_fault_jmp;
+
+static void catch_map_fault(int sig)
+{
+    if (map_fault_jmp != NULL)
+        siglongjmp(*map_fault_jmp, 1);
+
+    /* not ours; the faulting access is retried with the default action */
+    signal(sig, SIG_DFL);
+}
+
+static void init_map_fault_handler(void)
+{
+    static bool installed = false;
+
+    if (installed)
+        return;
+
+    /* SA_NODEFER as the handler is left with siglongjmp() and SIGBUS must not stay blocked */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = catch_map_fault;
+    sa.sa_flags = SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+    installed = true;
+}
+
+/* copies len bytes at offset of fs's mapping to dest, or adds them to fs's hash if dest is NULL.
+   Returns -1 if the file was truncated under the mapping */
+static int file_sender_map_read(FileSender *fs, char *dest, uint64_t offset, size_t len)
+{
+    sigjmp_buf env;
+
+    if (sigsetjmp(env, 0) != 0) {
+        map_fault_jmp = NULL;
+        return -1;
+    }
+
+    /* the fences keep the compiler from moving the reads outside the guarded region */
+    map_fault_jmp = &env;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    if (dest)
+        memcpy(dest, fs->map + offset, len);
+    else
+        crypto_generichash_update(fs->hash, (unsigned char *) fs->map + offset, len);
+
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    map_fault_jmp = NULL;
+    return 0;
+}
+
+/* points nextpiece at the next piece of at most piece_size bytes after offset. piecelen is 0 at the end of the
+   file, or while an archive's next piece hasn't been generated yet */
+static void file_sender_next_piece(FileSender *fs, uint16_t piece_size)
+{
+    if (fs->map) {
+        fs->nextpiece = fs->map + fs->offset;
+        fs->piecelen = MIN(fs->size - fs->offset, MIN(piece_size, FILE_PIECE_SIZE));
+
+        /* keep the kernel reading ahead of us so sending doesn't wait for the disk */
+        if (fs->map_advised < fs->size && fs->offset + FILE_MAP_WILLNEED / 2 >= fs->map_advised) {
+            uint64_t len = MIN(fs->size - fs->map_advised, FILE_MAP_WILLNEED);
+            madvise(fs->map + fs->map_advised, len, MADV_WILLNEED);
+            fs->map_advised += len;
+        }
+
+        return;
+    }
+
+    if (fs->buf_len - fs->buf_pos < piece_size) {
+        uint32_t left = fs->buf_len - fs->buf_pos;
+        memmove(fs->buf, fs->buf + fs->buf_pos, left);
+        size_t n = file_sender_read(fs, fs->buf + left, FILE_READ_AHEAD_SIZE - left);
+
+        if (!fs->hash_behind) {
+            crypto_generichash_update(fs->hash, (unsigned char *) fs->buf + left, n);
+            fs->hashed += n;
+        }
+
+        fs->buf_len = left + n;
+        fs->buf_pos = 0;
+    }
+
+    fs->nextpiece = fs->buf + fs->buf_pos;
+    fs->piecelen = MIN(fs->buf_len - fs->buf_pos, piece_size);
+
+    /* an archive is sent in full pieces even if its reader thread is behind */
+    if (fs->tar && fs->piecelen < piece_size && fs->offset + fs->piecelen < fs->size)
+        fs->piecelen = 0;
+}
+
+/* returns true if fs is an archive whose reader thread hasn't generated its next piece yet */
+static bool file_sender_waiting(const FileSender *fs)
+{
+    return fs->tar && fs->piecelen == 0 && fs->offset < fs->size;
+}
+
+/* sets up reading of fs->file or fs->tar, which must be at its start and fs->size bytes long, and
+   loads the first piece of at most piece_size bytes */
+static void file_sender_init_reader(FileSender *fs, uint16_t piece_size)
+{
+    int fd = fs->file ? fileno(fs->file) : -1;
+
+    if (posix_memalign((void **) &fs->hash, 64, crypto_generichash_statebytes()) != 0)
+        exit_toxic_err("failed in file_sender_init_reader", FATALERR_MEMORY);
+
+    crypto_generichash_init(fs->hash, NULL, 0, FILE_HASH_SIZE);
+
+    if (fd != -1 && fs->size > 0 && fs->size <= SIZE_MAX) {
+        init_map_fault_handler();
+        void *map = mmap(NULL, fs->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED) {
+            fs->map = map;
+            madvise(fs->map, fs->size, MADV_SEQUENTIAL);
+        }
+    }
+
+    if (fs->map == NULL) {
+        if (fd != -1)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-    for (j = max_file_senders_index; j > 0; --j) {
-        if (file_senders[j - 1].active)
-            break;
+        fs->buf = malloc(FILE_READ_AHEAD_SIZE);
+
+        if (fs->buf == NULL)
+            exit_toxic_err("failed in file_sender_init_reader", FATALERR_MEMORY);
+    }
+
+    file_sender_next_piece(fs, piece_size);
+}
+
+/* moves the read position of fs forward to offset. The skipped data is hashed later by
+   file_sender_hash(), so a buffered file is also hashed behind the send position from then on.
+   Returns -1 if the file can't be seeked */
+static int file_sender_seek(FileSender *fs, uint64_t offset, uint16_t piece_size)
+{
+    if (fs->map) {
+        fs->map_advised = offset;
+    } else {
+        if (fs->file == NULL || fseeko(fs->file, offset, SEEK_SET) != 0)
+            return -1;
+
+        /* the read-ahead that was hashed on loading is dropped */
+        crypto_generichash_init(fs->hash, NULL, 0, FILE_HASH_SIZE);
+        fs->hashed = 0;
+        fs->hash_behind = true;
+        fs->buf_len = 0;
+        fs->buf_pos = 0;
+    }
+
+    fs->offset = offset;
+    file_sender_next_piece(fs, piece_size);
+    return 0;
+}
+
+/* adds len bytes of the file at offset, at most FILE_HASH_CHUNK, to fs's hash. Returns -1 if they
+   can't be read, e.g. because the file was truncated */
+static int file_sender_hash_range(FileSender *fs, uint64_t offset, size_t len)
+{
+    static char chunk[FILE_HASH_CHUNK];
+
+    if (fs->map)
+        return file_sender_map_read(fs, NULL, offset, len);
+
+    if (pread(fileno(fs->file), chunk, len, offset) != (ssize_t) len)
+        return -1;
+
+    crypto_generichash_update(fs->hash, (unsigned char *) chunk, len);
+    return 0;
+}
+
+/* hashes the part of a mapped or resumed file before the send position in FILE_HASH_CHUNK byte chunks, at
+   most FILE_HASH_CATCHUP bytes per call. If final is true everything before the send position is hashed.
+   Returns -1 if the file was truncated while it was being sent */
+static int file_sender_hash(FileSender *fs, bool final)
+{
+    if (fs->map == NULL && !fs->hash_behind)
+        return 0;
+
+    uint64_t limit = final ? fs->offset : MIN(fs->offset, fs->hashed + FILE_HASH_CATCHUP);
+
+    while (limit - fs->hashed >= FILE_HASH_CHUNK || (final && fs->hashed < limit)) {
+        uint64_t len = MIN(limit - fs->hashed, FILE_HASH_CHUNK);
+
+        if (file_sender_hash_range(fs, fs->hashed, len) == -1)
+            return -1;
+
+        fs->hashed += len;
+    }
+
+    return 0;
+}
+
+/* puts the hash of the file sent by fs in hash. Returns -1 if not all of the file was hashed */
+static int file_sender_hash_final(FileSender *fs, uint8_t *hash)
+{
+    if (file_sender_hash(fs, true) == -1 || fs->hashed != fs->size)
+        return -1;
+
+    crypto_generichash_final(fs->hash, hash, FILE_HASH_SIZE);
+    return 0;
+}
+
+static void file_sender_close_reader(FileSender *fs)
+{
+    if (fs->map)
+        munmap(fs->map, fs->size);
+
+    free(fs->buf);
+    free(fs->hash);
+
+    if (fs->tar)
+        tar_close(fs->tar);
+    else
+        fclose(fs->file);
+}
+
+int new_file_sender(Tox *m, int32_t friendnum, const char *path, struct tar_stream *tar, struct file_batch *batch,
+                    const char **errmsg)
+{
+    FILE *file = NULL;
+    uint64_t filesize;
+
+    if (tar) {
+        filesize = tar_size(tar);
+    } else {
+        file = fopen(path, "r");
+
+        if (file == NULL) {
+            *errmsg = "File not found.";
+            return -1;
+        }
+
+        fseek(file, 0, SEEK_END);
+        filesize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+    }
+
+    char filename[MAX_STR_SIZE] = {0};
+    get_file_name(filename, sizeof(filename), path);
+
+    /* fails once the friend has MAX_FILES outgoing transfers */
+    int filenum = tox_new_file_sender(m, friendnum, filesize, (const uint8_t *) filename, strlen(filename));
+
+    if (filenum == -1) {
+        if (file)
+            fclose(file);
+
+        *errmsg = "Error sending file.";
+        return -1;
+    }
+
+    FileSender *fs = calloc(1, sizeof(FileSender));
+
+    if (fs == NULL)
+        exit_toxic_err("failed in new_file_sender", FATALERR_MEMORY);
+
+    /* a receiver can only resume an interrupted transfer of the file if it hasn't changed since.
+       Archives are generated afresh each time so they can't be resumed */
+    if (file) {
+        struct stat st;
+        uint64_t id = file_identity(filename, filesize);
+        struct checkpoint *cp = checkpoint_find(CHECKPOINT_SEND, get_friend(friendnum)->pub_key, id);
+        bool have_st = fstat(fileno(file), &st) == 0;
+
+        fs->resumable = cp && have_st && cp->mtime == st.st_mtime;
+
+        if ((fs->cp = checkpoint_new(CHECKPOINT_SEND, get_friend(friendnum)->pub_key, id, filesize, path)) && have_st)
+            fs->cp->mtime = st.st_mtime;
     }
 
-    max_file_senders_index = j;
+    snprintf(fs->pathname, sizeof(fs->pathname), "%s", path);
+    fs->active = true;
+    fs->file = file;
+    fs->tar = tar;
+    fs->batch = batch;
+    fs->filenum = filenum;
+    fs->friendnum = friendnum;
+    fs->timestamp = get_unix_time();
+    fs->size = filesize;
+    file_sender_init_reader(fs, tox_file_data_size(m, friendnum));
+    add_file_sender(fs);
+
+    return 0;
 }
 
-static void close_file_sender(ToxWindow *self, Tox *m, int i, const char *msg, int CTRL, int filenum, int32_t friendnum)
+/* puts the number of files of fs's batch that arrived in sent and those that didn't in failed.
+   If finished is false the transfer was cut short */
+static void batch_files_done(FileSender *fs, bool finished, int *sent, int *failed)
 {
-    if (self->chatwin != NULL) 
+    int files = fs->tar ? tar_num_files(fs->tar) : 1;
+
+    if (fs->tar)
+        *sent = (finished ? files : tar_files_sent(fs->tar, fs->offset)) - tar_num_unreadable(fs->tar);
+    else
+        *sent = finished;
+
+    *sent = MAX(*sent, 0);
+    *failed = files - *sent;
+}
+
+/* self and msg may be NULL. CTRL is sent to the receiver if send_control is true; it's false when the
+   receiver ended the transfer itself. fs stays allocated until the next call to do_file_senders() */
+static void end_file_sender(ToxWindow *self, Tox *m, FileSender *fs, const char *msg, int CTRL, bool send_control)
+{
+    if (self != NULL && msg != NULL)
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", msg);
-    
 
-    tox_file_send_control(m, friendnum, 0, filenum, CTRL, 0, 0);
-    fclose(file_senders[i].file);
-    memset(&file_senders[i], 0, sizeof(FileSender));
-    set_max_file_senders_index();
+    struct file_batch *batch = fs->batch;
+    int files_sent = 0, files_failed = 0;
+
+    if (batch) {
+        batch_files_done(fs, CTRL == TOX_FILECONTROL_FINISHED, &files_sent, &files_failed);
+
+        if (fs->tar)
+            batch->archive_sent = 0;
+    }
+
+    /* the receiver checks the file against its hash */
+    uint8_t hash[FILE_HASH_SIZE];
+
+    if (send_control) {
+        if (CTRL == TOX_FILECONTROL_FINISHED && file_sender_hash_final(fs, hash) == 0)
+            tox_file_send_control(m, fs->friendnum, 0, fs->filenum, CTRL, hash, FILE_HASH_SIZE);
+        else
+            tox_file_send_control(m, fs->friendnum, 0, fs->filenum, CTRL, 0, 0);
+    }
+
+    file_sender_close_reader(fs);
+
+    if (fs->cp) {
+        checkpoint_update(fs->cp, fs->offset);
+        checkpoint_release(fs->cp, CTRL == TOX_FILECONTROL_FINISHED || fs->offset == 0);
+    }
+
+    fs->active = false;
+    get_friend(fs->friendnum)->file_transfers->senders[fs->filenum] = NULL;
+    --get_friend(fs->friendnum)->num_file_senders;
     --num_active_file_senders;
+
+    /* done after the file number is freed as the batch may start its next file */
+    if (batch)
+        file_batch_sender_closed(self, m, batch, files_sent, files_failed);
+}
+
+/* self and msg may be NULL. fs stays allocated until the next call to do_file_senders() */
+static void close_file_sender(ToxWindow *self, Tox *m, FileSender *fs, const char *msg, int CTRL)
+{
+    end_file_sender(self, m, fs, msg, CTRL, true);
+}
+
+void file_sender_killed(ToxWindow *self, Tox *m, FileSender *fs)
+{
+    end_file_sender(self, m, fs, NULL, TOX_FILECONTROL_KILL, false);
+}
+
+void close_file_senders(Tox *m, int32_t friendnum)
+{
+    int i;
+
+    for (i = 0; i < sender_list_len; ++i) {
+        if (sender_list[i]->active && sender_list[i]->friendnum == friendnum) {
+            if (sender_list[i]->batch)
+                sender_list[i]->batch->stopped = true;
+
+            close_file_sender(NULL, m, sender_list[i], NULL, TOX_FILECONTROL_KILL);
+        }
+    }
 }
 
 void close_all_file_senders(Tox *m)
 {
     int i;
 
-    for (i = 0; i < max_file_senders_index; ++i) {
-        if (file_senders[i].active) {
-            fclose(file_senders[i].file);
-            tox_file_send_control(m, file_senders[i].friendnum, 0, file_senders[i].filenum,
-                                  TOX_FILECONTROL_KILL, 0, 0);
-            memset(&file_senders[i], 0, sizeof(FileSender));
+    for (i = 0; i < sender_list_len; ++i) {
+        if (sender_list[i]->active) {
+            if (sender_list[i]->batch)
+                sender_list[i]->batch->stopped = true;
+
+            close_file_sender(NULL, m, sender_list[i], NULL, TOX_FILECONTROL_KILL);
         }
+    }
+
+    compact_file_senders();
+    free(sender_list);
+    sender_list = NULL;
+    sender_list_size = 0;
+}
+
+/* kills fs because its file shrank under the mapping while it was being sent */
+static void file_sender_truncated(ToxWindow *self, Tox *m, FileSender *fs)
+{
+    char msg[MAX_STR_SIZE];
+    snprintf(msg, sizeof(msg), "File transfer for '%s' failed: the file was truncated.", fs->pathname);
+    close_file_sender(self, m, fs, msg, TOX_FILECONTROL_KILL);
+
+    if (self != NULL)
+        sound_notify(self, error, NT_NOFOCUS | NT_WNDALERT_2, NULL);
+}
+
+/* closes fs with FINISHED once all of it is sent. The receiver checks the file against the hash sent
+   along, so a file whose start is still being hashed behind the send position waits for
+   file_sender_hash() to catch up rather than hashing the rest on the spot */
+static void file_sender_finish(ToxWindow *self, Tox *m, FileSender *fs)
+{
+    if ((fs->map || fs->hash_behind) && fs->offset - fs->hashed >= FILE_HASH_CHUNK) {
+        fs->timestamp = get_unix_time();
+        return;
+    }
 
-        set_max_file_senders_index();
+    if (fs->batch) {
+        close_file_sender(self, m, fs, NULL, TOX_FILECONTROL_FINISHED);
+        return;
     }
+
+    char avg[32];
+    format_rate(avg, sizeof(avg), file_sender_avg_bps(fs));
+
+    char msg[MAX_STR_SIZE];
+    snprintf(msg, sizeof(msg), "File '%s' successfuly sent (%s average).", fs->pathname, avg);
+    close_file_sender(self, m, fs, msg, TOX_FILECONTROL_FINISHED);
+
+    if (self == NULL)
+        return;
+
+    if (self->active_box != -1)
+        box_notify2(self, transfer_completed, NT_NOFOCUS | NT_WNDALERT_2, 
+                    self->active_box, "File '%s' successfuly sent!", fs->pathname );
+    else
+        box_notify(self, transfer_completed, NT_NOFOCUS | NT_WNDALERT_2, &self->active_box, 
+                    self->name, "File '%s' successfuly sent!", fs->pathname );
 }
 
-static void send_file_data(ToxWindow *self, Tox *m, int i, int32_t friendnum, int filenum, const char *pathname)
+/* sends pieces of fs while they fit in its deficit and in budget, taking what is sent from both.
+   Returns -1 if the core refused a piece or an archive's next piece isn't generated yet, 0 otherwise */
+static int send_file_data(ToxWindow *self, Tox *m, FileSender *fs, int *budget)
 {
-    FILE *fp = file_senders[i].file;
+    int32_t friendnum = fs->friendnum;
+    uint8_t filenum = fs->filenum;
 
-    while (true) {
-        if (tox_file_send_data(m, friendnum, filenum, (uint8_t *) file_senders[i].nextpiece,
-                               file_senders[i].piecelen) == -1)
-            return;
+    if (file_sender_hash(fs, false) == -1) {
+        file_sender_truncated(self, m, fs);
+        return 0;
+    }
+
+    if (file_sender_waiting(fs)) {
+        file_sender_next_piece(fs, tox_file_data_size(m, friendnum));
+
+        if (file_sender_waiting(fs))
+            return -1;
+    }
+
+    /* everything was sent but the hash hasn't caught up yet */
+    if (fs->piecelen == 0) {
+        file_sender_finish(self, m, fs);
+        return 0;
+    }
+
+    while (fs->piecelen <= fs->deficit && fs->piecelen <= *budget) {
+        if (!upload_allowed(fs))
+            return -1;
+
+        /* a mapped piece is copied out first so a truncated file faults here rather than in the core */
+        const char *piece = fs->nextpiece;
+        char mapped[FILE_PIECE_SIZE];
+
+        if (fs->map) {
+            if (file_sender_map_read(fs, mapped, fs->offset, fs->piecelen) == -1) {
+                file_sender_truncated(self, m, fs);
+                return 0;
+            }
+
+            piece = mapped;
+        }
+
+        if (tox_file_send_data(m, friendnum, filenum, (uint8_t *) piece, fs->piecelen) == -1)
+            return -1;
+
+        upload_charge(fs);
+
+        fs->deficit -= fs->piecelen;
+        *budget -= fs->piecelen;
+
+        if (fs->start_time == 0)
+            fs->start_time = get_time_ms();
 
         uint64_t curtime = get_unix_time();
-        file_senders[i].timestamp = curtime;
-        file_senders[i].bps += file_senders[i].piecelen;            
-        file_senders[i].piecelen = fread(file_senders[i].nextpiece, 1,
-                                         tox_file_data_size(m, friendnum), fp);
+        fs->timestamp = curtime;
+        fs->bps += fs->piecelen;
+        fs->offset += fs->piecelen;
+        fs->buf_pos += fs->piecelen;
+
+        if (fs->batch) {
+            if (fs->batch->start_time == 0)
+                fs->batch->start_time = fs->start_time;
+
+            fs->batch->bps += fs->piecelen;
+            fs->batch->bytes_sent += fs->piecelen;
+        }
+
+        file_sender_next_piece(fs, tox_file_data_size(m, friendnum));
+
+        if (file_sender_waiting(fs))
+            return -1;
+
+        double remain = (double) (fs->size - fs->offset);
+
+        /* a batch's transfers share one progress line */
+        if (fs->batch) {
+            print_batch_progress(self, fs, !remain);
 
-        double remain = (double) tox_file_data_remaining(m, friendnum, filenum, 0);
+            if (fs->piecelen == 0) {
+                file_sender_finish(self, m, fs);
+                return 0;
+            }
+
+            continue;
+        }
 
         /* refresh line with percentage complete and transfer speed (must be called once per second) */
-        if ((self->chatwin != NULL && timed_out(file_senders[i].last_progress, curtime, 1)) || !remain) {
-            file_senders[i].last_progress = curtime;
-            double pct_remain = remain > 0 ? (1 - (remain / file_senders[i].size)) * 100 : 100;
-            print_progress_bar(self, i, -1, pct_remain);
-            file_senders[i].bps = 0;
+        if (timed_out(fs->last_progress, curtime, 1) || !remain) {
+            fs->last_progress = curtime;
+            double pct_remain = remain > 0 ? (1 - (remain / fs->size)) * 100 : 100;
+
+            if (self != NULL)
+                print_progress_bar(self, friendnum, filenum, true, pct_remain);
+
+            fs->bps = 0;
         }
 
-        if (file_senders[i].piecelen == 0) {
-            char msg[MAX_STR_SIZE];
-            snprintf(msg, sizeof(msg), "File '%s' successfuly sent.", pathname);
-            close_file_sender(self, m, i, msg, TOX_FILECONTROL_FINISHED, filenum, friendnum);
-            
-            if (self->active_box != -1)
-                box_notify2(self, transfer_completed, NT_NOFOCUS | NT_WNDALERT_2, 
-                            self->active_box, "File '%s' successfuly sent!", pathname );
-            else
-                box_notify(self, transfer_completed, NT_NOFOCUS | NT_WNDALERT_2, &self->active_box, 
-                            self->name, "File '%s' successfuly sent!", pathname );
-            return;
+        if (fs->piecelen == 0) {
+            file_sender_finish(self, m, fs);
+            return 0;
         }
     }
+
+    return 0;
+}
+
+int file_sender_resume(ToxWindow *self, Tox *m, FileSender *fs, const char *data, uint16_t length)
+{
+    uint8_t confirm[sizeof(uint64_t)];
+    uint64_t offset;
+
+    if (length != sizeof(uint64_t))
+        return -1;
+
+    memcpy(confirm, data, sizeof(uint64_t));
+    memcpy(&offset, data, sizeof(uint64_t));
+    net_to_host((uint8_t *) &offset, sizeof(uint64_t));
+
+    /* only a transfer that hasn't started yet can be moved */
+    if (fs->accepted || !fs->resumable || offset >= fs->size || fs->offset != 0)
+        return -1;
+
+    if (file_sender_seek(fs, offset, tox_file_data_size(m, fs->friendnum)) == -1)
+        return -1;
+
+    fs->start_offset = offset;
+    fs->timestamp = get_unix_time();
+
+    /* sent before any data so the receiver knows where the data starts */
+    tox_file_send_control(m, fs->friendnum, 0, fs->filenum, TOX_FILECONTROL_ACCEPT, confirm, sizeof(confirm));
+
+    if (fs->batch) {
+        fs->batch->bytes_sent += offset;
+        return 0;
+    }
+
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Resuming file '%s' at %.2f%%.", fs->pathname,
+                  offset * 100.0 / fs->size);
+
+    /* prep progress bar line */
+    char progline[MAX_STR_SIZE];
+    prep_prog_line(progline);
+    fs->line_id = line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", progline);
+    fs->accepted = true;
+    return 0;
 }
 
+/* returns the bytes fs may send per round: its friend's share of FILE_SEND_QUANTUM split
+   between the friend's transfers, boosted for transfers that are nearly done */
+static int file_sender_quantum(FileSender *fs)
+{
+    ToxicFriend *f = get_friend(fs->friendnum);
+
+    int weight = f->file_weight ? f->file_weight : 1;
+    int quantum = FILE_SEND_QUANTUM * weight / MAX(f->num_file_senders, 1);
+
+    if (fs->size - fs->offset <= FILE_SMALL_SIZE)
+        quantum *= FILE_SMALL_BOOST;
+
+    return MAX(quantum, FILE_PIECE_SIZE);
+}
+
+/* returns the chat window of fs's friend, or NULL if it's closed. The window can be closed while
+   the transfer runs, so it's looked up each time rather than kept in the sender */
+static ToxWindow *file_sender_window(const FileSender *fs)
+{
+    return get_window_ptr(get_friend(fs->friendnum)->chatwin);
+}
+
+/* kills fs if it hasn't sent anything in TIMEOUT_FILESENDER seconds */
+static void check_file_sender_timeout(Tox *m, FileSender *fs)
+{
+    ToxWindow *self = file_sender_window(fs);
+    char *pathname = fs->pathname;
+
+    if (!timed_out(fs->timestamp, get_unix_time(), TIMEOUT_FILESENDER))
+        return;
+
+    char msg[MAX_STR_SIZE];
+    snprintf(msg, sizeof(msg), "File transfer for '%s' timed out.", pathname);
+    close_file_sender(self, m, fs, msg, TOX_FILECONTROL_KILL);
+
+    if (self == NULL)
+        return;
+
+    sound_notify(self, error, NT_NOFOCUS | NT_WNDALERT_2, NULL);
+    
+    if (self->active_box != -1)
+        box_notify2(self, error, NT_NOFOCUS | NT_WNDALERT_2, 
+                    self->active_box, "File transfer for '%s' failed!", pathname );
+    else
+        box_notify(self, error, NT_NOFOCUS | NT_WNDALERT_2, &self->active_box,
+                   self->name, "File transfer for '%s' failed!", pathname );
+}
+
+/* Outgoing transfers are scheduled deficit round robin: on its turn each sender is credited its quantum
+   and sends while its deficit covers the next piece and the upload limits allow it. Rounds continue
+   while anyone can send and send_bucket has tokens, so tox_do() keeps its cadence. When the tokens run
+   out the next call resumes at the sender whose turn was cut short, without crediting it again */
 void do_file_senders(Tox *m)
 {
-    int i;
+    bool progress = true;
+    int i, n;
 
-    for (i = 0; i < max_file_senders_index; ++i) {
-        if (!file_senders[i].active)
-            continue;
+    if (num_active_file_senders < sender_list_len)
+        compact_file_senders();
 
-        if (file_senders[i].queue_pos > 0) {
-            --file_senders[i].queue_pos;
-            continue;
-        }
+    for (i = 0; i < sender_list_len; ++i) {
+        if (sender_list[i]->active)
+            check_file_sender_timeout(m, sender_list[i]);
+    }
 
-        ToxWindow *self = file_senders[i].toxwin;
-        char *pathname = file_senders[i].pathname;
-        int filenum = file_senders[i].filenum;
-        int32_t friendnum = file_senders[i].friendnum;
-
-        /* If file transfer has timed out kill transfer and send kill control */
-        if (timed_out(file_senders[i].timestamp, get_unix_time(), TIMEOUT_FILESENDER)) {
-            char msg[MAX_STR_SIZE];
-            snprintf(msg, sizeof(msg), "File transfer for '%s' timed out.", pathname);
-            close_file_sender(self, m, i, msg, TOX_FILECONTROL_KILL, filenum, friendnum);
-            sound_notify(self, error, NT_NOFOCUS | NT_WNDALERT_2, NULL);
-            
-            if (self->active_box != -1)
-                box_notify2(self, error, NT_NOFOCUS | NT_WNDALERT_2, 
-                            self->active_box, "File transfer for '%s' failed!", pathname );
-            else
-                box_notify(self, error, NT_NOFOCUS | NT_WNDALERT_2, &self->active_box,
-                           self->name, "File transfer for '%s' failed!", pathname );
-            continue;
-        }
+    if (num_active_file_senders == 0)
+        return;
+
+    uint64_t now = get_time_ms();
+    upload_rate = global_rate(true);
+    bucket_refill(&upload_bucket, upload_rate, now);
+    bucket_refill(&send_bucket, FILE_SEND_BUDGET * 1000 / FILE_SEND_INTERVAL, now);
 
-        file_senders[i].queue_pos = num_active_file_senders - 1;
-        send_file_data(self, m, i, friendnum, filenum, pathname);
+    int budget = send_bucket.tokens;
+
+    while (progress && budget >= FILE_PIECE_SIZE) {
+        /* senders a batch starts during the round get their first turn in the next one */
+        int count = sender_list_len;
+        progress = false;
+
+        for (n = 0; n < count; ++n) {
+            i = (next_turn + n) % count;
+            FileSender *fs = sender_list[i];
+
+            if (!fs->active)
+                continue;
+
+            int quantum = file_sender_quantum(fs);
+            int prev_budget = budget;
+
+            if (fs != credited_turn)
+                fs->deficit += quantum;
+
+            credited_turn = NULL;
+
+            /* the core's send window is full, the upload limit is reached or an archive's reader thread is
+               behind; don't let credit pile up into a burst */
+            if (send_file_data(file_sender_window(fs), m, fs, &budget) == -1)
+                fs->deficit = MIN(fs->deficit, quantum);
+
+            if (budget < prev_budget)
+                progress = true;
+
+            if (budget < FILE_PIECE_SIZE) {
+                next_turn = i;
+                credited_turn = fs->active ? fs : NULL;
+                send_bucket.tokens = budget;
+                return;
+            }
+        }
     }
+
+    next_turn = sender_list_len ? (next_turn + 1) % sender_list_len : 0;
+    send_bucket.tokens = budget;
 }
@@ -23,40 +23,116 @@
 #ifndef _filesenders_h
 #define _filesenders_h
 
+#include <sodium.h>
+
 #include "toxic.h"
 #include "windows.h"
+#include "file_batch.h"
 
 #define FILE_PIECE_SIZE 2048    /* must be >= (MAX_CRYPTO_DATA_SIZE - 2) in toxcore/net_crypto.h */
-#define MAX_FILES 255
+#define MAX_FILES 256    /* file numbers the core allows per friend in each direction */
 #define TIMEOUT_FILESENDER 120
 #define NUM_PROG_MARKS 50    /* number of "#"'s in file transfer progress bar. Keep well below MAX_STR_SIZE */
+#define FILE_READ_AHEAD_SIZE (1024 * 1024)    /* bytes read at a time from files that can't be mapped */
+#define FILE_MAP_WILLNEED (4 * 1024 * 1024)    /* bytes of a mapped file the kernel is asked to read ahead */
+#define FILE_SEND_BUDGET (256 * 1024)    /* bytes handed to the core per FILE_SEND_INTERVAL ms. Caps all uploads at 6.25 MiB/s */
+#define FILE_SEND_INTERVAL 40    /* ms; one main loop at REC_TOX_DO_LOOPS_PER_SEC */
+#define FILE_SEND_QUANTUM (16 * 1024)    /* bytes per round a friend of weight 1 may send */
+#define FILE_SMALL_SIZE (1024 * 1024)    /* transfers with less than this left get FILE_SMALL_BOOST times their share */
+#define FILE_SMALL_BOOST 4
+#define MAX_FILE_WEIGHT 8
+#define RATE_LIMIT_BURST 250    /* ms worth of tokens a rate limit lets build up */
+#define FILE_HASH_SIZE crypto_generichash_BYTES    /* BLAKE2b hash of a file, sent with TOX_FILECONTROL_FINISHED */
+#define FILE_HASH_CHUNK (64 * 1024)    /* files are hashed this many bytes at a time behind the send position */
+#define FILE_HASH_CATCHUP (1024 * 1024)    /* max bytes hashed per call while a resumed file's start is caught up */
+
+/* token bucket limiting a transfer rate. The rate itself lives in the settings or the friend */
+struct token_bucket {
+    int64_t tokens;    /* bytes; negative while received data is being paid off */
+    uint64_t last_refill;    /* ms */
+};
 
+/* Files are mapped into memory and pieces are sent straight from the mapping, with the kernel
+   reading ahead of the send position. Files that can't be mapped (pipes, files too large for the
+   address space) are read FILE_READ_AHEAD_SIZE bytes at a time into buf and sliced from there.
+   The file is hashed as it's sent: a mapped file trails the send position, a buffered one is hashed as
+   it's read, so buf holds the hashed bytes [hashed - buf_len, hashed), unless it was resumed mid-way and
+   trails the send position with pread like a mapped file. A batch's archive is generated
+   by tar and always buffered */
 typedef struct {
-    FILE *file;
-    ToxWindow *toxwin;
+    FILE *file;    /* NULL when sending an archive */
+    struct tar_stream *tar;
+    struct file_batch *batch;    /* NULL for a file sent on its own */
+    char *map;    /* NULL if the file isn't mapped */
+    char *buf;
+    uint32_t buf_len;
+    uint32_t buf_pos;
+    uint64_t map_advised;    /* end of the part of the mapping that has been advised WILLNEED */
     int32_t friendnum;
-    bool active;
-    int filenum;
-    char nextpiece[FILE_PIECE_SIZE];
+    bool active;    /* false once closed; the sender is freed by the next call to do_file_senders() */
+    uint8_t filenum;
+    const char *nextpiece;    /* points into map or buf */
     uint16_t piecelen;
     char pathname[MAX_STR_SIZE];
     uint64_t timestamp;
     uint64_t last_progress;
     double bps;
     uint64_t size;
+    uint64_t offset;    /* bytes handed to the core */
+    uint64_t start_offset;    /* offset the transfer started or resumed at */
+    uint64_t start_time;    /* ms when the first piece was handed to the core */
     uint32_t line_id;
-    uint8_t queue_pos;
+    bool accepted;    /* the receiver accepted the transfer; later ACCEPTs resume it after a pause */
+    int deficit;    /* bytes the scheduler still owes this sender */
+    struct checkpoint *cp;    /* NULL if the transfer can't be resumed later */
+    bool resumable;    /* the file is unchanged since an interrupted transfer of it to the same friend */
+    crypto_generichash_state *hash;
+    uint64_t hashed;    /* bytes of the file hashed so far */
+    bool hash_behind;    /* a buffered file resumed mid-way, hashed behind the send position */
 } FileSender;
 
+/* starts sending the file at path to friendnum, or the archive tar if it isn't NULL. path is then
+   only the name shown for the transfer. batch is the batch the file belongs to, if any.
+   Returns 0 on success or -1 with errmsg set */
+int new_file_sender(Tox *m, int32_t friendnum, const char *path, struct tar_stream *tar, struct file_batch *batch,
+                    const char **errmsg);
+
+/* returns friendnum's outgoing transfer filenum, or NULL if there is none */
+FileSender *get_file_sender(int32_t friendnum, uint8_t filenum);
+
+/* continues file sender fs at the offset in data, the control data of the receiver's TOX_FILECONTROL_ACCEPT,
+   and confirms the offset to the receiver. Returns -1 if it can't be resumed, e.g. because the file changed
+   since it was interrupted or the transfer was already accepted; the file is then sent from the start */
+int file_sender_resume(ToxWindow *self, Tox *m, FileSender *fs, const char *data, uint16_t length);
+
 /* creates initial progress line that will be updated during file transfer.
    Assumes progline is of size MAX_STR_SIZE */
 void prep_prog_line(char *progline);
 
-/* prints a progress bar for file transfers. 
-   if friendnum is -1 we're sending the file, otherwise we're receiving.  */
-void print_progress_bar(ToxWindow *self, int idx, int friendnum, double pct_remain);
+/* prints a progress bar for friendnum's file transfer filenum. send is true for outgoing transfers */
+void print_progress_bar(ToxWindow *self, int32_t friendnum, uint8_t filenum, bool send, double pct_remain);
+
+/* closes fs after the receiver killed it, without sending it anything */
+void file_sender_killed(ToxWindow *self, Tox *m, FileSender *fs);
 
 void close_all_file_senders(Tox *m);
+
+/* kills friendnum's outgoing transfers. Batches they belong to don't start any more files */
+void close_file_senders(Tox *m, int32_t friendnum);
 void do_file_senders(Tox *m);
 
+/* charges length bytes of data received for friendnum's file filenum to the download limits,
+   pausing the transfer if they're exceeded or the writer thread is backlogged */
+void rate_limit_received(Tox *m, int32_t friendnum, uint8_t filenum, uint16_t length);
+
+/* resumes paused incoming transfers once the download limits and the writer thread allow it */
+void do_file_receivers(Tox *m);
+
+/* marks friendnum's file filenum as no longer paused by the download limits. Call when it's closed */
+void rate_limit_forget(int32_t friendnum, uint8_t filenum);
+
+/* returns the rate limit in bytes per second currently applied to friendnum's outgoing
+   (send is true) or incoming transfers, or 0 if there is none */
+uint64_t get_rate_limit(int32_t friendnum, bool send);
+
 #endif  /* #define _filesenders_h */
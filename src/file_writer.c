@@ -0,0 +1,534 @@
+/*  file_writer.c
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE    /* needed for fallocate() */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "toxic.h"
+#include "windows.h"
+#include "friendlist.h"
+#include "file_senders.h"
+#include "file_writer.h"
+#include "line_info.h"
+#include "misc_tools.h"
+#include "checkpoint.h"
+
+extern ToxWindow *prompt;
+
+#define WRITE_BUF_ALIGN 4096
+
+struct write_buf {
+    char *data;
+    uint32_t len;
+    uint64_t offset;
+    struct file_writer *fw;
+    struct write_buf *next;
+};
+
+static struct _Writer {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* signalled when a block is queued */
+    bool running;
+    bool stop;
+
+    struct write_buf *queue;    /* blocks waiting to be written, oldest first */
+    struct write_buf *queue_end;
+    int num_queued;
+
+    struct write_buf *free_bufs;
+    int num_bufs;    /* blocks allocated; up to FILE_WRITE_NUM_BUFS are kept for reuse */
+
+    struct file_writer *events;    /* writers with a failed write or a closed file */
+} Writer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+};
+
+/* The functions below marked "locked" must be called with Writer.lock held */
+
+/* locked */
+static void writer_queue_event(struct file_writer *fw)
+{
+    if (fw->queued)
+        return;
+
+    fw->queued = true;
+    fw->next_event = Writer.events;
+    Writer.events = fw;
+}
+
+/* closes the file of a closing writer whose blocks have all been written. locked */
+static void writer_finish(struct file_writer *fw)
+{
+    if (fw->complete && fw->has_expected && fw->error == 0 && fw->hashed == fw->size) {
+        uint8_t hash[FILE_HASH_SIZE];
+        crypto_generichash_final(fw->hash, hash, FILE_HASH_SIZE);
+        fw->verified = sodium_memcmp(hash, fw->expected, FILE_HASH_SIZE) == 0 ? 1 : -1;
+    }
+
+    close(fw->fd);
+    fw->fd = -1;
+    writer_queue_event(fw);
+}
+
+/* returns a free block. The core thread never waits for the writer thread: once FILE_WRITE_NUM_BUFS
+   blocks are in use spare blocks are allocated, and freed again when released. Receivers are paused
+   while the writer thread is backlogged, so only data already in flight ends up in spares. locked */
+static struct write_buf *writer_get_buf(void)
+{
+    struct write_buf *buf = Writer.free_bufs;
+
+    if (buf) {
+        Writer.free_bufs = buf->next;
+        return buf;
+    }
+
+    buf = malloc(sizeof(struct write_buf));
+
+    if (buf == NULL || posix_memalign((void **) &buf->data, WRITE_BUF_ALIGN, FILE_WRITE_BUF_SIZE) != 0)
+        exit_toxic_err("failed in writer_get_buf", FATALERR_MEMORY);
+
+    ++Writer.num_bufs;
+    return buf;
+}
+
+/* locked */
+static void writer_release_buf(struct write_buf *buf)
+{
+    if (Writer.num_bufs > FILE_WRITE_NUM_BUFS) {
+        free(buf->data);
+        free(buf);
+        --Writer.num_bufs;
+        return;
+    }
+
+    buf->next = Writer.free_bufs;
+    Writer.free_bufs = buf;
+}
+
+/* hands fw's current block to the writer thread. locked */
+static void writer_queue_buf(struct file_writer *fw)
+{
+    struct write_buf *buf = fw->cur;
+    fw->cur = NULL;
+    buf->next = NULL;
+
+    if (Writer.queue_end)
+        Writer.queue_end->next = buf;
+    else
+        Writer.queue = buf;
+
+    Writer.queue_end = buf;
+    ++Writer.num_queued;
+    ++fw->pending;
+    pthread_cond_signal(&Writer.work);
+}
+
+/* hashes the data of a resumed transfer that was written before it was interrupted, reading it back
+   from the file. Hashing stops for good if it can't be read */
+static void writer_hash_start(struct file_writer *fw, uint64_t end)
+{
+    char *tmp = malloc(FILE_WRITE_BUF_SIZE);
+
+    if (tmp == NULL)
+        exit_toxic_err("failed in writer_hash_start", FATALERR_MEMORY);
+
+    while (fw->hashed < end) {
+        ssize_t n = pread(fw->fd, tmp, MIN(end - fw->hashed, FILE_WRITE_BUF_SIZE), fw->hashed);
+
+        if (n <= 0)
+            break;
+
+        crypto_generichash_update(fw->hash, (unsigned char *) tmp, n);
+        fw->hashed += n;
+    }
+
+    free(tmp);
+}
+
+/* returns 0 on success or the errno of the failed write */
+static int writer_write_buf(struct write_buf *buf)
+{
+    struct file_writer *fw = buf->fw;
+
+    if (!fw->preallocated) {
+        fw->preallocated = true;
+
+#ifdef __linux__
+        /* reserve the whole file up front so it isn't fragmented; the size is kept so an interrupted
+           transfer doesn't leave a tail of zeros. Failure only means the file isn't preallocated */
+        if (fw->size > 0)
+            fallocate(fw->fd, FALLOC_FL_KEEP_SIZE, 0, fw->size);
+#endif /* __linux__ */
+    }
+
+    uint32_t done = 0;
+
+    while (done < buf->len) {
+        ssize_t n = pwrite(fw->fd, buf->data + done, buf->len - done, buf->offset + done);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return n == 0 ? EIO : errno;
+
+        done += n;
+    }
+
+    if (fw->hashed < buf->offset)
+        writer_hash_start(fw, buf->offset);
+
+    if (fw->hashed == buf->offset) {
+        crypto_generichash_update(fw->hash, (unsigned char *) buf->data, buf->len);
+        fw->hashed += buf->len;
+    }
+
+    return 0;
+}
+
+static void *writer_thread(void *data)
+{
+    pthread_mutex_lock(&Writer.lock);
+
+    while (true) {
+        while (Writer.queue == NULL && !Writer.stop)
+            pthread_cond_wait(&Writer.work, &Writer.lock);
+
+        struct write_buf *buf = Writer.queue;
+
+        if (buf == NULL)
+            break;
+
+        if ((Writer.queue = buf->next) == NULL)
+            Writer.queue_end = NULL;
+
+        --Writer.num_queued;
+
+        struct file_writer *fw = buf->fw;
+        bool failed = fw->error != 0;    /* drop the rest of a transfer that can't be written */
+        pthread_mutex_unlock(&Writer.lock);
+
+        int err = failed ? 0 : writer_write_buf(buf);
+
+        pthread_mutex_lock(&Writer.lock);
+
+        if (err && fw->error == 0) {
+            fw->error = err;
+            writer_queue_event(fw);
+        } else if (!failed) {
+            fw->written = buf->offset + buf->len;
+        }
+
+        writer_release_buf(buf);
+
+        if (--fw->pending == 0 && fw->closing)
+            writer_finish(fw);
+    }
+
+    pthread_mutex_unlock(&Writer.lock);
+    return NULL;
+}
+
+struct file_writer *file_writer_open(const char *filename, uint64_t size, uint64_t offset, int32_t friendnum,
+                                     uint8_t filenum)
+{
+    if (!Writer.running) {
+        if (pthread_create(&Writer.tid, NULL, writer_thread, NULL) != 0) {
+            errno = EAGAIN;
+            return NULL;
+        }
+
+        Writer.running = true;
+    }
+
+    /* resumed files are read back to be hashed */
+    int fd = open(filename, O_RDWR | O_CREAT | (offset ? 0 : O_TRUNC), 0666);
+
+    if (fd == -1)
+        return NULL;
+
+    /* drop anything past the data we know was written */
+    if (offset && ftruncate(fd, offset) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    struct file_writer *fw = calloc(1, sizeof(struct file_writer));
+
+    if (fw == NULL)
+        exit_toxic_err("failed in file_writer_open", FATALERR_MEMORY);
+
+    if (posix_memalign((void **) &fw->hash, 64, crypto_generichash_statebytes()) != 0)
+        exit_toxic_err("failed in file_writer_open", FATALERR_MEMORY);
+
+    crypto_generichash_init(fw->hash, NULL, 0, FILE_HASH_SIZE);
+
+    fw->fd = fd;
+    fw->size = size;
+    fw->start = offset;
+    fw->offset = offset;
+    fw->written = offset;
+    fw->friendnum = friendnum;
+    fw->filenum = filenum;
+    snprintf(fw->filename, sizeof(fw->filename), "%s", filename);
+
+    return fw;
+}
+
+int file_writer_write(struct file_writer *fw, const char *data, uint16_t length)
+{
+    while (length > 0) {
+        if (fw->cur == NULL) {
+            pthread_mutex_lock(&Writer.lock);
+            int err = fw->error;
+
+            uint64_t written = fw->written;
+
+            if (err == 0) {
+                fw->cur = writer_get_buf();
+                fw->cur->fw = fw;
+                fw->cur->offset = fw->offset;
+                fw->cur->len = 0;
+            }
+
+            pthread_mutex_unlock(&Writer.lock);
+
+            if (err)
+                return -1;
+
+            if (fw->cp)
+                checkpoint_update(fw->cp, written);
+        }
+
+        /* a resumed transfer's first block is cut short so the following ones are aligned */
+        struct write_buf *buf = fw->cur;
+        uint32_t cap = FILE_WRITE_BUF_SIZE - buf->offset % FILE_WRITE_BUF_SIZE;
+        uint32_t n = MIN(length, cap - buf->len);
+
+        memcpy(buf->data + buf->len, data, n);
+        buf->len += n;
+        fw->offset += n;
+        data += n;
+        length -= n;
+
+        if (buf->len == cap) {
+            pthread_mutex_lock(&Writer.lock);
+            writer_queue_buf(fw);
+            pthread_mutex_unlock(&Writer.lock);
+        }
+    }
+
+    return 0;
+}
+
+void file_writer_expect_hash(struct file_writer *fw, const uint8_t *hash)
+{
+    memcpy(fw->expected, hash, FILE_HASH_SIZE);
+    fw->has_expected = true;
+}
+
+void file_writer_close(struct file_writer *fw, bool complete)
+{
+    fw->complete = complete;
+    pthread_mutex_lock(&Writer.lock);
+
+    if (fw->cur) {
+        if (fw->cur->len > 0 && fw->error == 0) {
+            writer_queue_buf(fw);
+        } else {
+            writer_release_buf(fw->cur);
+            fw->cur = NULL;
+        }
+    }
+
+    fw->closing = true;
+
+    if (fw->pending == 0)
+        writer_finish(fw);
+
+    pthread_mutex_unlock(&Writer.lock);
+}
+
+bool file_writer_backlogged(void)
+{
+    pthread_mutex_lock(&Writer.lock);
+    bool backlogged = Writer.num_queued >= FILE_WRITE_BACKLOG;
+    pthread_mutex_unlock(&Writer.lock);
+
+    return backlogged;
+}
+
+void close_file_receiver(int32_t num, uint8_t filenum, bool complete)
+{
+    struct FileReceiver *rx = get_file_receiver(num, filenum);
+
+    if (rx == NULL)
+        return;
+
+    if (rx->writer)
+        file_writer_close(rx->writer, complete);
+
+    rate_limit_forget(num, filenum);
+    get_friend(num)->file_transfers->receivers[filenum] = NULL;
+    free(rx);
+}
+
+int file_receiver_start(ToxWindow *self, Tox *m, int32_t num, uint8_t filenum, uint64_t offset)
+{
+    struct FileReceiver *rx = get_file_receiver(num, filenum);
+
+    if (rx == NULL)
+        return -1;
+
+    struct file_writer *fw = file_writer_open(rx->filename, rx->size, offset, num, filenum);
+
+    if (fw == NULL) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, RED, "* Error writing to file: %s", strerror(errno));
+        tox_file_send_control(m, num, 1, filenum, TOX_FILECONTROL_KILL, 0, 0);
+        close_file_receiver(num, filenum, false);
+        return -1;
+    }
+
+    fw->cp = checkpoint_new(CHECKPOINT_RECV, get_friend(num)->pub_key, rx->file_id, rx->size, rx->filename);
+
+    if (fw->cp)
+        checkpoint_update(fw->cp, offset);
+
+    rx->writer = fw;
+
+    /* prep progress bar line */
+    char progline[MAX_STR_SIZE];
+    prep_prog_line(progline);
+    rx->line_id = line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", progline);
+    return 0;
+}
+
+/* returns the chat window of fw's friend, or the prompt if it has none */
+static ToxWindow *writer_window(struct file_writer *fw)
+{
+    ToxWindow *self = NULL;
+
+    if (get_friend(fw->friendnum)->active && get_friend(fw->friendnum)->chatwin != -1)
+        self = get_window_ptr(get_friend(fw->friendnum)->chatwin);
+
+    return self ? self : prompt;
+}
+
+/* tells the user that fw's file couldn't be written and kills the transfer if it's still going */
+static void writer_report_error(Tox *m, struct file_writer *fw, int err, bool closing)
+{
+    line_info_add(writer_window(fw), NULL, NULL, NULL, SYS_MSG, 0, RED, " * Error writing to file '%s': %s",
+                  fw->filename, strerror(err));
+
+    if (!closing) {
+        tox_file_send_control(m, fw->friendnum, 1, fw->filenum, TOX_FILECONTROL_KILL, 0, 0);
+        close_file_receiver(fw->friendnum, fw->filenum, false);
+    }
+}
+
+void do_file_writers(Tox *m)
+{
+    pthread_mutex_lock(&Writer.lock);
+    struct file_writer *fw = Writer.events;
+    Writer.events = NULL;
+    pthread_mutex_unlock(&Writer.lock);
+
+    while (fw) {
+        pthread_mutex_lock(&Writer.lock);
+        struct file_writer *next = fw->next_event;
+        int err = fw->error;
+        bool closing = fw->closing;
+        fw->queued = false;
+        pthread_mutex_unlock(&Writer.lock);
+
+        if (err && !fw->error_reported) {
+            fw->error_reported = true;
+            writer_report_error(m, fw, err, closing);
+        }
+
+        /* the writer thread may have queued it again in the meantime; it's freed on that turn */
+        pthread_mutex_lock(&Writer.lock);
+        bool done = fw->closing && fw->fd == -1 && !fw->queued;
+        uint64_t written = fw->written;
+        int verified = fw->verified;
+        pthread_mutex_unlock(&Writer.lock);
+
+        if (done && verified == 1)
+            line_info_add(writer_window(fw), NULL, NULL, NULL, SYS_MSG, 0, 0, "File '%s' verified.", fw->filename);
+        else if (done && verified == -1)
+            line_info_add(writer_window(fw), NULL, NULL, NULL, SYS_MSG, 0, RED,
+                          " * File '%s' is corrupt: it doesn't match the sender's hash.", fw->filename);
+
+        /* a transfer that ended before any data arrived isn't worth resuming; if it was a resume the
+           sender may have refused it, so the next try starts over */
+        if (done && fw->cp) {
+            checkpoint_update(fw->cp, written);
+            checkpoint_release(fw->cp, (fw->complete && !err) || written == fw->start);
+        }
+
+        if (done) {
+            free(fw->hash);
+            free(fw);
+        }
+
+        fw = next;
+    }
+}
+
+void close_all_file_receivers(void)
+{
+    int i, j;
+
+    for (i = 0; i < get_max_friends_index(); ++i) {
+        if (get_friend(i)->file_transfers == NULL)
+            continue;
+
+        for (j = 0; j < MAX_FILES; ++j)
+            close_file_receiver(i, j, false);
+    }
+
+    if (!Writer.running)
+        return;
+
+    pthread_mutex_lock(&Writer.lock);
+    Writer.stop = true;
+    pthread_cond_signal(&Writer.work);
+    pthread_mutex_unlock(&Writer.lock);
+
+    pthread_join(Writer.tid, NULL);
+    Writer.running = false;
+
+    do_file_writers(NULL);    /* every writer is closing so m isn't used */
+}
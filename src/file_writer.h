@@ -0,0 +1,106 @@
+/*  file_writer.h
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef _file_writer_h
+#define _file_writer_h
+
+#include <sodium.h>
+
+#include "toxic.h"
+#include "file_senders.h"
+
+#define FILE_WRITE_BUF_SIZE (256 * 1024)    /* received data is written to disk in blocks of this size */
+#define FILE_WRITE_NUM_BUFS 32    /* blocks kept for reuse by all incoming transfers */
+#define FILE_WRITE_BACKLOG (FILE_WRITE_NUM_BUFS / 2)    /* receivers are paused while this many blocks are queued */
+
+struct write_buf;
+
+/* Write-behind state of an incoming transfer. Received data is copied into pooled blocks that the
+   writer thread writes with pwrite() at their offset, so the core thread never waits on the disk.
+   The core thread owns the struct and frees it in do_file_writers() once the writer thread is done.
+   The writer thread also hashes the file as it's written and checks it against the sender's hash. */
+struct file_writer {
+    int fd;
+    uint64_t size;    /* announced size; the file is preallocated to it before the first write */
+    uint64_t start;    /* offset the transfer started or resumed at */
+    uint64_t offset;    /* file offset of the next received byte */
+    struct write_buf *cur;    /* block being filled by the core thread */
+    int32_t friendnum;
+    uint8_t filenum;
+    char filename[MAX_STR_SIZE];
+    struct checkpoint *cp;    /* NULL if the transfer can't be resumed */
+    bool complete;
+    bool has_expected;
+    uint8_t expected[FILE_HASH_SIZE];    /* hash sent by the sender */
+
+    /* protected by the writer lock */
+    int pending;    /* blocks queued or being written */
+    int error;    /* errno of the first failed write */
+    uint64_t written;    /* end of the data written so far */
+    bool closing;
+    bool queued;    /* on the list handled by do_file_writers() */
+    struct file_writer *next_event;
+    int verified;    /* set when the file is closed: 1 if it matches the expected hash, -1 if not, 0 if unchecked */
+
+    bool error_reported;    /* core thread only */
+
+    /* writer thread only */
+    bool preallocated;
+    crypto_generichash_state *hash;
+    uint64_t hashed;    /* bytes of the file hashed so far */
+};
+
+/* Returns a writer for friend's incoming transfer filenum of size bytes, starting at offset. If offset is 0
+   filename is created or truncated, otherwise it's cut to offset bytes and the data is appended.
+   Returns NULL and sets errno on failure. */
+struct file_writer *file_writer_open(const char *filename, uint64_t size, uint64_t offset, int32_t friendnum,
+                                     uint8_t filenum);
+
+/* queues length bytes of data to be written. Returns -1 if an earlier write failed */
+int file_writer_write(struct file_writer *fw, const char *data, uint16_t length);
+
+/* sets the hash the sender sent for the file. It's checked when fw is closed after the whole file was received */
+void file_writer_expect_hash(struct file_writer *fw, const uint8_t *hash);
+
+/* queues the data not yet written and detaches fw from its transfer. The file is closed by the writer thread.
+   complete is true if all of the file was received */
+void file_writer_close(struct file_writer *fw, bool complete);
+
+/* returns true if incoming transfers should be paused until the writer thread catches up */
+bool file_writer_backlogged(void);
+
+/* closes friend num's incoming transfer filenum, flushing the data received so far, and frees its
+   FileReceiver. complete is true if all of the file was received */
+void close_file_receiver(int32_t num, uint8_t filenum, bool complete);
+
+/* starts writing friend num's accepted incoming transfer filenum to its file at offset and adds its
+   progress line. On failure the error is shown, the transfer is killed and -1 is returned */
+int file_receiver_start(ToxWindow *self, Tox *m, int32_t num, uint8_t filenum, uint64_t offset);
+
+/* kills transfers whose writes failed and frees closed writers. Call once per main loop iteration */
+void do_file_writers(Tox *m);
+
+/* closes all incoming transfers and waits for their data to be written */
+void close_all_file_receivers(void);
+
+#endif /* #define _file_writer_h */
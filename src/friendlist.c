@@ -23,6 +23,8 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
 #include <time.h>
 #include <arpa/inet.h>
 
@@ -37,6 +39,9 @@
 #include "settings.h"
 #include "notify.h"
 #include "help.h"
+#include "key_index.h"
+#include "message_queue.h"
+#include "checkpoint.h"
 
 #ifdef _AUDIO
 #include "audio_call.h"
@@ -54,24 +59,120 @@ static uint8_t blocklist_view = 0;   /* 0 if we're in friendlist view, 1 if we'r
 static int num_selected = 0;
 static int max_friends_index = 0;    /* 1 + the index of the last friend in friends array */
 static int num_friends = 0;
+static int num_online = 0;
+static int friends_size = 0;    /* number of allocated entries in friend_chunks and friendlist_index */
+static int num_indexed = 0;     /* number of friends currently in friendlist_index */
 
-ToxicFriend friends[MAX_FRIENDS_NUM];
-static int friendlist_index[MAX_FRIENDS_NUM] = {0};
+ToxicFriend *friend_chunks[MAX_FRIEND_CHUNKS];
+
+/* A friend's published presence. These are allocated with the friend chunks but kept apart from
+   ToxicFriend, so clearing a deleted friend never resets a sequence that a reader is checking */
+struct presence_slot {
+    struct FriendPresence buf[2];    /* double buffer; buf[seq & 1] is current */
+    uint32_t seq;
+};
+
+static struct presence_slot *presence_chunks[MAX_FRIEND_CHUNKS];
+static int *friendlist_index = NULL;
+
+static struct key_index friend_keys;     /* public key -> friend number */
+static struct key_index friend_nicks;    /* case insensitive nick -> friend number */
 
 static struct _Blocked_Contacts {
     int num_selected;
     int max_index;
     int num_blocked;
-    BlockedFriend list[MAX_FRIENDS_NUM];
-    int index[MAX_FRIENDS_NUM];
+    int size;    /* number of allocated entries in list and index */
+    BlockedFriend *list;
+    int *index;
+    struct key_index keys;    /* public key -> blocklist number */
 } Blocked_Contacts;
 
+/* friendlist search filter */
+static struct _Friend_Filter {
+    bool typing;    /* true while keypresses go to the search string */
+    char text[TOXIC_MAX_NAME_LENGTH];    /* lowercase search string */
+    int len;
+    int *index;     /* friend numbers matching text, in friendlist_index order */
+    int num;
+    int size;
+    bool stale;     /* true if index must be rebuilt from friendlist_index */
+} Filter;
+
 static struct _pendingDel {
     int num;
     bool active;
     WINDOW *popup;
 } pendingdelete;
 
+#define MIN_LIST_SIZE 16
+
+/* returns the new size of a list that must hold at least n entries */
+static int list_grow_size(int size, int n)
+{
+    int new_size = MAX(size, MIN_LIST_SIZE);
+
+    while (new_size < n)
+        new_size *= 2;
+
+    return new_size;
+}
+
+/* makes sure friends and friendlist_index can hold at least n entries. Returns -1 if n is more
+   than the friend chunks can hold */
+static int realloc_friends(int n)
+{
+    if (n <= friends_size)
+        return 0;
+
+    if (n > MAX_FRIEND_CHUNKS * FRIEND_CHUNK_SIZE)
+        return -1;
+
+    int new_size = friends_size;
+
+    while (new_size < n) {
+        ToxicFriend *chunk = calloc(FRIEND_CHUNK_SIZE, sizeof(ToxicFriend));
+        struct presence_slot *slots = calloc(FRIEND_CHUNK_SIZE, sizeof(struct presence_slot));
+
+        if (chunk == NULL || slots == NULL)
+            exit_toxic_err("failed in realloc_friends", FATALERR_MEMORY);
+
+        friend_chunks[new_size / FRIEND_CHUNK_SIZE] = chunk;
+        presence_chunks[new_size / FRIEND_CHUNK_SIZE] = slots;
+        new_size += FRIEND_CHUNK_SIZE;
+    }
+
+    /* friendlist_index is only read with Winthread.lock held so it may move */
+    int *tmp_index = realloc(friendlist_index, new_size * sizeof(int));
+
+    if (tmp_index == NULL)
+        exit_toxic_err("failed in realloc_friends", FATALERR_MEMORY);
+
+    friendlist_index = tmp_index;
+    friends_size = new_size;
+    return 0;
+}
+
+/* makes sure the blocklist can hold at least n entries */
+static void realloc_blocklist(int n)
+{
+    if (n <= Blocked_Contacts.size)
+        return;
+
+    int new_size = list_grow_size(Blocked_Contacts.size, n);
+    BlockedFriend *tmp_list = realloc(Blocked_Contacts.list, new_size * sizeof(BlockedFriend));
+    int *tmp_index = realloc(Blocked_Contacts.index, new_size * sizeof(int));
+
+    if (tmp_list == NULL || tmp_index == NULL)
+        exit_toxic_err("failed in realloc_blocklist", FATALERR_MEMORY);
+
+    memset(&tmp_list[Blocked_Contacts.size], 0, (new_size - Blocked_Contacts.size) * sizeof(BlockedFriend));
+
+    Blocked_Contacts.list = tmp_list;
+    Blocked_Contacts.index = tmp_index;
+    Blocked_Contacts.size = new_size;
+}
+
 static int save_blocklist(char *path)
 {
     if (arg_opts.ignore_data_file)
@@ -163,11 +264,20 @@ int load_blocklist(char *path)
     }
 
     int num = len / sizeof(BlockedFriend);
-    int i;
+    int i = 0;
+    int j;
 
-    for (i = 0; i < num; ++i) {
+    realloc_blocklist(num + 1);
+
+    for (j = 0; j < num; ++j) {
         BlockedFriend tmp;
-        memcpy(&tmp, data + i * sizeof(BlockedFriend), sizeof(BlockedFriend));
+        memcpy(&tmp, data + j * sizeof(BlockedFriend), sizeof(BlockedFriend));
+
+        /* skip duplicate entries */
+        if (key_index_get(&Blocked_Contacts.keys, tmp.pub_key) != -1)
+            continue;
+
+        key_index_add(&Blocked_Contacts.keys, tmp.pub_key, i);
         Blocked_Contacts.list[i].active = true;
         Blocked_Contacts.list[i].num = i;
         Blocked_Contacts.list[i].namelength = ntohs(tmp.namelength);
@@ -180,6 +290,7 @@ int load_blocklist(char *path)
         memcpy(&Blocked_Contacts.list[i].last_on, lastonline, sizeof(uint64_t));
 
         ++Blocked_Contacts.num_blocked;
+        ++i;
     }
 
     Blocked_Contacts.max_index = i + 1;
@@ -191,16 +302,24 @@ int load_blocklist(char *path)
     return 0;
 }
 
-#define S_WEIGHT 100000
-static int index_name_cmp(const void *n1, const void *n2)
+/* orders friends by connection status, then by name, then by friend number so that every
+   friend has exactly one position in friendlist_index */
+static int friend_order_cmp(int f1, int f2)
 {
-    int res = qsort_strcasecmp_hlpr(friends[*(int *) n1].name, friends[*(int *) n2].name);
+    if (get_friend(f1)->online != get_friend(f2)->online)
+        return get_friend(f1)->online ? -1 : 1;
 
-    /* Use weight to make qsort always put online friends before offline */
-    res = friends[*(int *) n1].online ? (res - S_WEIGHT) : (res + S_WEIGHT);
-    res = friends[*(int *) n2].online ? (res + S_WEIGHT) : (res - S_WEIGHT);
+    int res = strcmp(get_friend(f1)->namekey, get_friend(f2)->namekey);
 
-    return res;
+    if (res != 0)
+        return res;
+
+    return f1 - f2;
+}
+
+static int index_name_cmp(const void *n1, const void *n2)
+{
+    return friend_order_cmp(*(int *) n1, *(int *) n2);
 }
 
 /* sorts friendlist_index first by connection status then alphabetically */
@@ -210,11 +329,293 @@ void sort_friendlist_index(void)
     int n = 0;
 
     for (i = 0; i < max_friends_index; ++i) {
-        if (friends[i].active)
-            friendlist_index[n++] = friends[i].num;
+        if (get_friend(i)->active)
+            friendlist_index[n++] = get_friend(i)->num;
+    }
+
+    num_indexed = n;
+    qsort(friendlist_index, num_indexed, sizeof(int), index_name_cmp);
+    Filter.stale = true;
+}
+
+/* returns the position in friendlist_index where friend f is or would be inserted */
+static int friendlist_index_bsearch(int f)
+{
+    int lo = 0;
+    int hi = num_indexed;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (friend_order_cmp(friendlist_index[mid], f) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* removes friend f from friendlist_index. Must be called before f's online status or name changes */
+static void friendlist_index_remove(int f)
+{
+    int pos = friendlist_index_bsearch(f);
+
+    if (pos >= num_indexed || friendlist_index[pos] != f)
+        return;
+
+    memmove(&friendlist_index[pos], &friendlist_index[pos + 1], (num_indexed - pos - 1) * sizeof(int));
+    --num_indexed;
+    Filter.stale = true;
+}
+
+/* inserts friend f into friendlist_index at its ordered position */
+static void friendlist_index_insert(int f)
+{
+    int pos = friendlist_index_bsearch(f);
+
+    if (pos < num_indexed && friendlist_index[pos] == f)
+        return;
+
+    memmove(&friendlist_index[pos + 1], &friendlist_index[pos], (num_indexed - pos) * sizeof(int));
+    friendlist_index[pos] = f;
+    ++num_indexed;
+    Filter.stale = true;
+}
+
+/* returns true if str contains needle, ignoring case. needle must be lowercase */
+static bool str_contains_lower(const char *str, const char *needle)
+{
+    if (needle[0] == '\0')
+        return true;
+
+    for (; *str; ++str) {
+        int i;
+
+        for (i = 0; needle[i] && tolower((unsigned char) str[i]) == needle[i]; ++i)
+            ;
+
+        if (needle[i] == '\0')
+            return true;
+    }
+
+    return false;
+}
+
+static bool friend_matches_filter(int f)
+{
+    return strstr(get_friend(f)->namekey, Filter.text) || str_contains_lower(get_friend(f)->statusmsg, Filter.text);
+}
+
+/* rebuilds the list of friends matching the search string. If narrow is true the search string
+   was only extended since the last update, so only the previous matches need to be checked */
+static void friendlist_filter_update(bool narrow)
+{
+    if (Filter.size < friends_size) {
+        int *tmp = realloc(Filter.index, friends_size * sizeof(int));
+
+        if (tmp == NULL)
+            exit_toxic_err("failed in friendlist_filter_update", FATALERR_MEMORY);
+
+        Filter.index = tmp;
+        Filter.size = friends_size;
     }
 
-    qsort(friendlist_index, num_friends, sizeof(int), index_name_cmp);
+    int n = 0;
+    int i;
+
+    if (narrow && !Filter.stale) {
+        for (i = 0; i < Filter.num; ++i) {
+            if (friend_matches_filter(Filter.index[i]))
+                Filter.index[n++] = Filter.index[i];
+        }
+    } else {
+        for (i = 0; i < num_indexed; ++i) {
+            if (friend_matches_filter(friendlist_index[i]))
+                Filter.index[n++] = friendlist_index[i];
+        }
+    }
+
+    Filter.num = n;
+    Filter.stale = false;
+    num_selected = 0;
+}
+
+/* rebuilds the search results if the friend list changed since they were built. Called from the
+   core loop and before keys are handled, with Winthread.lock held, so that friendlist_onDraw()
+   only ever reads them */
+void friendlist_refresh_filter(void)
+{
+    if (Filter.len == 0 || !Filter.stale)
+        return;
+
+    int selected = num_selected;
+    friendlist_filter_update(false);
+    num_selected = MIN(selected, MAX(Filter.num - 1, 0));
+}
+
+/* returns the friend numbers shown in the friendlist, in display order, and puts their count in num */
+static int *friendlist_view(int *num)
+{
+    if (Filter.len == 0) {
+        *num = num_indexed;
+        return friendlist_index;
+    }
+
+    *num = Filter.num;
+    return Filter.index;
+}
+
+static void friendlist_filter_clear(void)
+{
+    Filter.typing = false;
+    Filter.len = 0;
+    Filter.text[0] = '\0';
+    num_selected = 0;
+}
+
+/* handles keys typed into the search string. Returns true if key was consumed */
+static bool friendlist_filter_onKey(wint_t key, bool ltr)
+{
+    if (ltr) {
+        char mb[MB_LEN_MAX];
+        int n = wctomb(mb, (wchar_t) key);
+
+        if (n <= 0 || Filter.len + n >= sizeof(Filter.text))
+            return true;
+
+        int i;
+
+        for (i = 0; i < n; ++i)
+            Filter.text[Filter.len++] = tolower((unsigned char) mb[i]);
+
+        Filter.text[Filter.len] = '\0';
+        friendlist_filter_update(true);
+        return true;
+    }
+
+    switch (key) {
+        case 0x7f:
+        case KEY_BACKSPACE:
+        case T_KEY_C_H:
+            if (Filter.len == 0)
+                return true;
+
+            /* remove the last multibyte character */
+            do {
+                --Filter.len;
+            } while (Filter.len > 0 && (Filter.text[Filter.len] & 0xC0) == 0x80);
+
+            Filter.text[Filter.len] = '\0';
+            friendlist_filter_update(false);
+            return true;
+
+        case T_KEY_ESC:
+            friendlist_filter_clear();
+            return true;
+
+        case '\n':
+            Filter.typing = false;
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+/* sets friend's name, the key used to order the friendlist and the nick index entry */
+static void set_friend_name(int32_t num, const char *name, int len)
+{
+    char nickkey[KEY_INDEX_KEY_SIZE];
+    key_index_nick_key(nickkey, get_friend(num)->name);
+    key_index_del(&friend_nicks, nickkey, num);
+
+    len = MIN(len, TOXIC_MAX_NAME_LENGTH - 1);
+    memcpy(get_friend(num)->name, name, len);
+    get_friend(num)->name[len] = '\0';
+    get_friend(num)->namelength = len;
+
+    memcpy(get_friend(num)->namekey, get_friend(num)->name, len + 1);
+    str_to_lower(get_friend(num)->namekey);
+
+    key_index_nick_key(nickkey, get_friend(num)->name);
+    key_index_add(&friend_nicks, nickkey, num);
+}
+
+static struct presence_slot *get_presence_slot(int32_t num)
+{
+    return &presence_chunks[num / FRIEND_CHUNK_SIZE][num % FRIEND_CHUNK_SIZE];
+}
+
+/* Writers are serialized by Winthread.lock and fill the buffer that is not current before
+   advancing seq. A reader retries if seq moved while it was copying, as the next writer may
+   have started on the buffer it was reading */
+void publish_friend_presence(int32_t num)
+{
+    ToxicFriend *f = get_friend(num);
+    struct presence_slot *slot = get_presence_slot(num);
+    uint32_t seq = slot->seq + 1;
+    struct FriendPresence *p = &slot->buf[seq & 1];
+
+    p->online = f->online;
+    p->status = f->status;
+    p->is_typing = f->is_typing;
+    p->namelength = f->namelength;
+    p->statusmsg_len = f->statusmsg_len;
+    memcpy(p->name, f->name, f->namelength + 1);
+    memcpy(p->statusmsg, f->statusmsg, f->statusmsg_len + 1);
+
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+}
+
+void get_friend_presence(int32_t num, struct FriendPresence *p)
+{
+    struct presence_slot *slot = get_presence_slot(num);
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        memcpy(p, &slot->buf[seq & 1], sizeof(struct FriendPresence));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq);
+
+    /* a torn copy is discarded above, but make sure the strings are terminated regardless */
+    p->name[TOXIC_MAX_NAME_LENGTH - 1] = '\0';
+    p->statusmsg[TOX_MAX_STATUSMESSAGE_LENGTH - 1] = '\0';
+}
+
+/* returns the friend number of the friend with nick name (case insensitive), or -1 if there is none */
+int get_friendnum(uint8_t *name)
+{
+    char nickkey[KEY_INDEX_KEY_SIZE];
+    key_index_nick_key(nickkey, (const char *) name);
+    return key_index_get(&friend_nicks, nickkey);
+}
+
+/* returns the friend number of the friend with public key pub_key, or -1 if there is none */
+int32_t get_friendnum_by_key(const char *pub_key)
+{
+    return key_index_get(&friend_keys, pub_key);
+}
+
+/* returns true if pub_key is in the blocklist */
+bool friend_is_blocked(const char *pub_key)
+{
+    return key_index_get(&Blocked_Contacts.keys, pub_key) != -1;
+}
+
+int get_max_friends_index(void)
+{
+    return max_friends_index;
+}
+
+/* returns true if friend num is shown as online */
+bool friend_is_online(int32_t num)
+{
+    if (num < 0 || num >= max_friends_index || !get_friend(num)->active)
+        return false;
+
+    return get_friend(num)->online;
 }
 
 static int index_name_cmp_block(const void *n1, const void *n2)
@@ -237,13 +638,13 @@ static void sort_blocklist_index(void)
 
 static void update_friend_last_online(int32_t num, uint64_t timestamp)
 {
-    friends[num].last_online.last_on = timestamp;
-    friends[num].last_online.tm = *localtime((const time_t*)&timestamp);
+    get_friend(num)->last_online.last_on = timestamp;
+    get_friend(num)->last_online.tm = *localtime((const time_t*)&timestamp);
 
     /* if the format changes make sure TIME_STR_SIZE is the correct size */
     const char *t = user_settings_->time == TIME_12 ? "%I:%M %p" : "%H:%M";
-    strftime(friends[num].last_online.hour_min_str, TIME_STR_SIZE, t,
-             &friends[num].last_online.tm);
+    strftime(get_friend(num)->last_online.hour_min_str, TIME_STR_SIZE, t,
+             &get_friend(num)->last_online.tm);
 }
 
 static void friendlist_onMessage(ToxWindow *self, Tox *m, int32_t num, const char *str, uint16_t len)
@@ -251,9 +652,9 @@ static void friendlist_onMessage(ToxWindow *self, Tox *m, int32_t num, const cha
     if (num >= max_friends_index)
         return;
 
-    if (friends[num].chatwin == -1) {
+    if (get_friend(num)->chatwin == -1) {
         if (get_num_active_windows() < MAX_WINDOWS_NUM) {
-            friends[num].chatwin = add_window(m, new_chat(m, friends[num].num));            
+            get_friend(num)->chatwin = add_window(m, new_chat(m, get_friend(num)->num));            
         } else {
             char nick[TOX_MAX_NAME_LENGTH];
             get_nick_truncate(m, nick, num);
@@ -275,10 +676,23 @@ static void friendlist_onConnectionChange(ToxWindow *self, Tox *m, int32_t num,
     if (num >= max_friends_index)
         return;
 
-    friends[num].online = status;
+    if (get_friend(num)->online != (status == 1)) {
+        num_online += status == 1 ? 1 : -1;
+
+        int unfinished = status == 1 ? checkpoint_count(CHECKPOINT_SEND, get_friend(num)->pub_key) : 0;
+
+        if (unfinished > 0)
+            line_info_add(prompt, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s is online. %d interrupted file transfer%s "
+                          "to them can be resumed by sending the file%s again.", get_friend(num)->name, unfinished,
+                          unfinished > 1 ? "s" : "", unfinished > 1 ? "s" : "");
+    }
+
+    friendlist_index_remove(num);
+    get_friend(num)->online = status == 1;
+    friendlist_index_insert(num);
+    publish_friend_presence(num);
+
     update_friend_last_online(num, get_unix_time());
-    store_data(m, DATA_FILE);
-    sort_friendlist_index();
 }
 
 static void friendlist_onNickChange(ToxWindow *self, Tox *m, int32_t num, const char *nick, uint16_t len)
@@ -286,13 +700,10 @@ static void friendlist_onNickChange(ToxWindow *self, Tox *m, int32_t num, const
     if (len > TOX_MAX_NAME_LENGTH || num >= max_friends_index)
         return;
 
-    char tempname[TOX_MAX_NAME_LENGTH];
-    strcpy(tempname, nick);
-    len = MIN(len, TOXIC_MAX_NAME_LENGTH - 1);
-    tempname[len] = '\0';
-    snprintf(friends[num].name, sizeof(friends[num].name), "%s", tempname);
-    friends[num].namelength = len;
-    sort_friendlist_index();
+    friendlist_index_remove(num);
+    set_friend_name(num, nick, len);
+    friendlist_index_insert(num);
+    publish_friend_presence(num);
 }
 
 static void friendlist_onStatusChange(ToxWindow *self, Tox *m, int32_t num, uint8_t status)
@@ -300,7 +711,8 @@ static void friendlist_onStatusChange(ToxWindow *self, Tox *m, int32_t num, uint
     if (num >= max_friends_index)
         return;
 
-    friends[num].status = status;
+    get_friend(num)->status = status;
+    publish_friend_presence(num);
 }
 
 static void friendlist_onStatusMessageChange(ToxWindow *self, int32_t num, const char *status, uint16_t len)
@@ -308,46 +720,52 @@ static void friendlist_onStatusMessageChange(ToxWindow *self, int32_t num, const
     if (len > TOX_MAX_STATUSMESSAGE_LENGTH || num >= max_friends_index)
         return;
 
-    snprintf(friends[num].statusmsg, sizeof(friends[num].statusmsg), "%s", status);
-    friends[num].statusmsg_len = strlen(friends[num].statusmsg);
+    snprintf(get_friend(num)->statusmsg, sizeof(get_friend(num)->statusmsg), "%s", status);
+    get_friend(num)->statusmsg_len = strlen(get_friend(num)->statusmsg);
+    Filter.stale = true;
+    publish_friend_presence(num);
 }
 
 void friendlist_onFriendAdded(ToxWindow *self, Tox *m, int32_t num, bool sort)
 {
-    if (max_friends_index < 0 || max_friends_index >= MAX_FRIENDS_NUM)
+    if (max_friends_index < 0 || realloc_friends(max_friends_index + 1) == -1)
         return;
 
     int i;
 
     for (i = 0; i <= max_friends_index; ++i) {
-        if (!friends[i].active) {
-            friends[i].num = num;
-            friends[i].active = true;
-            friends[i].chatwin = -1;
-            friends[i].online = false;
-            friends[i].status = TOX_USERSTATUS_NONE;
-            friends[i].logging_on = (bool) user_settings_->autolog == AUTOLOG_ON;
-            tox_get_client_id(m, num, (uint8_t *) friends[i].pub_key);
+        if (!get_friend(i)->active) {
+            get_friend(i)->num = num;
+            get_friend(i)->active = true;
+            get_friend(i)->chatwin = -1;
+            get_friend(i)->online = false;
+            get_friend(i)->status = TOX_USERSTATUS_NONE;
+            get_friend(i)->logging_on = (bool) user_settings_->autolog == AUTOLOG_ON;
+            tox_get_client_id(m, num, (uint8_t *) get_friend(i)->pub_key);
+            key_index_add(&friend_keys, get_friend(i)->pub_key, i);
             update_friend_last_online(i, tox_get_last_online(m, i));
 
             char tempname[TOX_MAX_NAME_LENGTH] = {0};
             int len = get_nick_truncate(m, tempname, num);
 
-            if (len == -1 || tempname[0] == '\0') {
-                strcpy(friends[i].name, UNKNOWN_NAME);
-                friends[i].namelength = strlen(UNKNOWN_NAME);
-            } else {    /* Enforce toxic's maximum name length */
-                friends[i].namelength = len;
-                snprintf(friends[i].name, sizeof(friends[i].name), "%s", tempname);
-            }
+            if (len == -1 || tempname[0] == '\0')
+                set_friend_name(i, UNKNOWN_NAME, strlen(UNKNOWN_NAME));
+            else    /* Enforce toxic's maximum name length */
+                set_friend_name(i, tempname, len);
+
+            int s_len = tox_get_status_message(m, num, (uint8_t *) get_friend(i)->statusmsg, TOX_MAX_STATUSMESSAGE_LENGTH - 1);
+            get_friend(i)->statusmsg[MAX(s_len, 0)] = '\0';
+            get_friend(i)->statusmsg_len = strlen(get_friend(i)->statusmsg);
 
+            publish_friend_presence(i);
             num_friends = tox_count_friendlist(m);
 
             if (i == max_friends_index)
                 ++max_friends_index;
 
+            /* when loading the whole list the caller sorts the index once at the end */
             if (sort)
-                sort_friendlist_index();
+                friendlist_index_insert(i);
 
             return;
         }
@@ -357,32 +775,33 @@ void friendlist_onFriendAdded(ToxWindow *self, Tox *m, int32_t num, bool sort)
 /* puts blocked friend back in friendlist. fnum is new friend number, bnum is blocked number */
 static void friendlist_add_blocked(Tox *m, int32_t fnum, int32_t bnum)
 {
-    if (max_friends_index >= MAX_FRIENDS_NUM)
+    if (realloc_friends(max_friends_index + 1) == -1)
         return;
 
     int i;
 
     for (i = 0; i <= max_friends_index; ++i) {
-        if (friends[i].active)
+        if (get_friend(i)->active)
             continue;
 
-        friends[i].num = fnum;
-        friends[i].active = true;
-        friends[i].chatwin = -1;
-        friends[i].status = TOX_USERSTATUS_NONE;
-        friends[i].logging_on = (bool) user_settings_->autolog == AUTOLOG_ON;
-        friends[i].namelength = Blocked_Contacts.list[bnum].namelength;
+        get_friend(i)->num = fnum;
+        get_friend(i)->active = true;
+        get_friend(i)->chatwin = -1;
+        get_friend(i)->status = TOX_USERSTATUS_NONE;
+        get_friend(i)->logging_on = (bool) user_settings_->autolog == AUTOLOG_ON;
         update_friend_last_online(i, Blocked_Contacts.list[bnum].last_on);
-        memcpy(friends[i].name, Blocked_Contacts.list[bnum].name, friends[i].namelength + 1);
-        memcpy(friends[i].pub_key, Blocked_Contacts.list[bnum].pub_key, TOX_CLIENT_ID_SIZE);
+        set_friend_name(i, Blocked_Contacts.list[bnum].name, Blocked_Contacts.list[bnum].namelength);
+        memcpy(get_friend(i)->pub_key, Blocked_Contacts.list[bnum].pub_key, TOX_CLIENT_ID_SIZE);
+        key_index_add(&friend_keys, get_friend(i)->pub_key, i);
+        publish_friend_presence(i);
 
         num_friends = tox_count_friendlist(m);
 
         if (i == max_friends_index)
             ++max_friends_index;
 
+        friendlist_index_insert(i);
         sort_blocklist_index();
-        sort_friendlist_index();
         return;
     }
 }
@@ -393,9 +812,9 @@ static void friendlist_onFileSendRequest(ToxWindow *self, Tox *m, int32_t num, u
     if (num >= max_friends_index)
         return;
 
-    if (friends[num].chatwin == -1) {
+    if (get_friend(num)->chatwin == -1) {
         if (get_num_active_windows() < MAX_WINDOWS_NUM) {
-            friends[num].chatwin = add_window(m, new_chat(m, friends[num].num));
+            get_friend(num)->chatwin = add_window(m, new_chat(m, get_friend(num)->num));
             
             if (self->active_box != -1)
                 box_notify2(self, transfer_pending, NT_NOFOCUS, self->active_box, 
@@ -423,9 +842,9 @@ static void friendlist_onGroupInvite(ToxWindow *self, Tox *m, int32_t num, const
     if (num >= max_friends_index)
         return;
 
-    if (friends[num].chatwin == -1) {
+    if (get_friend(num)->chatwin == -1) {
         if (get_num_active_windows() < MAX_WINDOWS_NUM) {
-            friends[num].chatwin = add_window(m, new_chat(m, friends[num].num));
+            get_friend(num)->chatwin = add_window(m, new_chat(m, get_friend(num)->num));
             
             if (self->active_box != -1)
                 box_notify2(self, generic_message, NT_WNDALERT_0 | NT_NOFOCUS, self->active_box, 
@@ -445,23 +864,110 @@ static void friendlist_onGroupInvite(ToxWindow *self, Tox *m, int32_t num, const
 }
 
 /* move friendlist/blocklist cursor up and down */
+#define FLIST_OFST 6    /* Accounts for space at top and bottom */
+
+/* returns the number of list rows that fit in the friendlist window */
+static int friendlist_rows(ToxWindow *self)
+{
+    int x2, y2;
+    getmaxyx(self->window, y2, x2);
+    (void) x2;
+
+    /* the search line takes up one row */
+    if (!blocklist_view && (Filter.typing || Filter.len))
+        --y2;
+
+    return y2 - FLIST_OFST;
+}
+
 static void select_friend(ToxWindow *self, wint_t key, int *selected, int num)
 {
     if (num <= 0)
         return;
 
+    int rows = MAX(friendlist_rows(self), 1);
+
     if (key == KEY_UP) {
         if (--(*selected) < 0)
             *selected = num - 1;
     } else if (key == KEY_DOWN) {
         *selected = (*selected + 1) % num;
+    } else if (key == KEY_PPAGE) {
+        *selected = MAX(*selected - rows, 0);
+    } else if (key == KEY_NPAGE) {
+        *selected = MIN(*selected + rows, num - 1);
+    } else if (key == KEY_HOME) {
+        *selected = 0;
+    } else if (key == KEY_END) {
+        *selected = num - 1;
     }
 }
 
+struct FileTransfers *get_file_transfers(int32_t num)
+{
+    if (get_friend(num)->file_transfers == NULL) {
+        get_friend(num)->file_transfers = calloc(1, sizeof(struct FileTransfers));
+
+        if (get_friend(num)->file_transfers == NULL)
+            exit_toxic_err("failed in get_file_transfers", FATALERR_MEMORY);
+    }
+
+    return get_friend(num)->file_transfers;
+}
+
+struct FileReceiver *get_file_receiver(int32_t num, uint8_t filenum)
+{
+    struct FileTransfers *ft = get_friend(num)->file_transfers;
+    return ft ? ft->receivers[filenum] : NULL;
+}
+
+struct FileReceiver *new_file_receiver(int32_t num, uint8_t filenum)
+{
+    close_file_receiver(num, filenum, false);
+
+    struct FileReceiver *rx = calloc(1, sizeof(struct FileReceiver));
+
+    if (rx == NULL)
+        exit_toxic_err("failed in new_file_receiver", FATALERR_MEMORY);
+
+    get_file_transfers(num)->receivers[filenum] = rx;
+    return rx;
+}
+
+struct latency_hist *get_friend_latency(int32_t num)
+{
+    if (get_friend(num)->latency == NULL) {
+        get_friend(num)->latency = calloc(1, sizeof(struct latency_hist));
+
+        if (get_friend(num)->latency == NULL)
+            exit_toxic_err("failed in get_friend_latency", FATALERR_MEMORY);
+    }
+
+    return get_friend(num)->latency;
+}
+
+static void free_file_transfers(Tox *m, int32_t num)
+{
+    struct FileTransfers *ft = get_friend(num)->file_transfers;
+
+    if (ft == NULL)
+        return;
+
+    close_file_senders(m, num);
+
+    int i;
+
+    for (i = 0; i < MAX_FILES; ++i)
+        close_file_receiver(num, i, false);
+
+    free(ft);
+    get_friend(num)->file_transfers = NULL;
+}
+
 static void delete_friend(Tox *m, int32_t f_num)
 {
-    if (friends[f_num].chatwin >= 0) {
-        ToxWindow *toxwin = get_window_ptr(friends[f_num].chatwin);
+    if (get_friend(f_num)->chatwin >= 0) {
+        ToxWindow *toxwin = get_window_ptr(get_friend(f_num)->chatwin);
 
         if (toxwin != NULL) {
             kill_chat_window(toxwin);
@@ -469,22 +975,39 @@ static void delete_friend(Tox *m, int32_t f_num)
         }
     }
 
+    char nickkey[KEY_INDEX_KEY_SIZE];
+    key_index_nick_key(nickkey, get_friend(f_num)->name);
+    key_index_del(&friend_nicks, nickkey, f_num);
+    key_index_del(&friend_keys, get_friend(f_num)->pub_key, f_num);
+
+    if (get_friend(f_num)->online)
+        --num_online;
+
+    friendlist_index_remove(f_num);
+    free_file_transfers(m, f_num);
+    free(get_friend(f_num)->latency);
+    del_friend_events(f_num);
     tox_del_friend(m, f_num);
-    memset(&friends[f_num], 0, sizeof(ToxicFriend));
+    memset(get_friend(f_num), 0, sizeof(ToxicFriend));
 
     int i;
 
     for (i = max_friends_index; i > 0; --i) {
-        if (friends[i - 1].active)
+        if (get_friend(i - 1)->active)
             break;
     }
 
     max_friends_index = i;
     num_friends = tox_count_friendlist(m);
 
-    /* make sure num_selected stays within num_friends range */
-    if (num_friends && num_selected == num_friends)
-        --num_selected;
+    /* make sure num_selected stays within range of the list */
+    friendlist_refresh_filter();
+
+    int num_shown;
+    friendlist_view(&num_shown);
+
+    if (num_shown && num_selected >= num_shown)
+        num_selected = num_shown - 1;
 
     store_data(m, DATA_FILE);
 }
@@ -505,7 +1028,6 @@ static void del_friend_deactivate(ToxWindow *self, Tox *m, wint_t key)
     if (key == 'y') {
         if (blocklist_view == 0) {
             delete_friend(m, pendingdelete.num);
-            sort_friendlist_index();
         } else {
             delete_blocked_friend(pendingdelete.num);
             sort_blocklist_index();
@@ -527,14 +1049,21 @@ static void draw_del_popup(void)
     box(pendingdelete.popup, ACS_VLINE, ACS_HLINE);
     wattroff(pendingdelete.popup, A_BOLD);
 
-    wmove(pendingdelete.popup, 1, 1);
-    wprintw(pendingdelete.popup, "Delete contact ");
-    wattron(pendingdelete.popup, A_BOLD);
+    /* copied under the lock as the core thread reallocates the blocklist */
+    char name[TOXIC_MAX_NAME_LENGTH];
+    pthread_mutex_lock(&Winthread.lock);
 
     if (blocklist_view == 0)
-        wprintw(pendingdelete.popup, "%s", friends[pendingdelete.num].name);
+        snprintf(name, sizeof(name), "%s", get_friend(pendingdelete.num)->name);
     else
-        wprintw(pendingdelete.popup, "%s", Blocked_Contacts.list[pendingdelete.num].name);
+        snprintf(name, sizeof(name), "%s", Blocked_Contacts.list[pendingdelete.num].name);
+
+    pthread_mutex_unlock(&Winthread.lock);
+
+    wmove(pendingdelete.popup, 1, 1);
+    wprintw(pendingdelete.popup, "Delete contact ");
+    wattron(pendingdelete.popup, A_BOLD);
+    wprintw(pendingdelete.popup, "%s", name);
 
     wattroff(pendingdelete.popup, A_BOLD);
     wprintw(pendingdelete.popup, "? y/n");
@@ -545,6 +1074,7 @@ static void draw_del_popup(void)
 /* deletes contact from blocked list */
 static void delete_blocked_friend(int32_t bnum)
 {
+    key_index_del(&Blocked_Contacts.keys, Blocked_Contacts.list[bnum].pub_key, bnum);
     memset(&Blocked_Contacts.list[bnum], 0, sizeof(BlockedFriend));
 
     int i;
@@ -565,8 +1095,16 @@ static void delete_blocked_friend(int32_t bnum)
 /* deletes contact from friendlist and puts in blocklist */
 void block_friend(Tox *m, int32_t fnum)
 {
-    if (Blocked_Contacts.max_index >= MAX_FRIENDS_NUM || num_friends <= 0)
+    if (num_friends <= 0)
+        return;
+
+    /* the contact may already be in the blocklist if it was re-added after being blocked */
+    if (friend_is_blocked(get_friend(fnum)->pub_key)) {
+        delete_friend(m, fnum);
         return;
+    }
+
+    realloc_blocklist(Blocked_Contacts.max_index + 1);
 
     int i;
 
@@ -576,10 +1114,11 @@ void block_friend(Tox *m, int32_t fnum)
 
         Blocked_Contacts.list[i].active = true;
         Blocked_Contacts.list[i].num = i;
-        Blocked_Contacts.list[i].namelength = friends[fnum].namelength;
-        Blocked_Contacts.list[i].last_on = friends[fnum].last_online.last_on;
-        memcpy(Blocked_Contacts.list[i].pub_key, friends[fnum].pub_key, TOX_CLIENT_ID_SIZE);
-        memcpy(Blocked_Contacts.list[i].name, friends[fnum].name, friends[fnum].namelength  + 1);
+        Blocked_Contacts.list[i].namelength = get_friend(fnum)->namelength;
+        Blocked_Contacts.list[i].last_on = get_friend(fnum)->last_online.last_on;
+        memcpy(Blocked_Contacts.list[i].pub_key, get_friend(fnum)->pub_key, TOX_CLIENT_ID_SIZE);
+        memcpy(Blocked_Contacts.list[i].name, get_friend(fnum)->name, get_friend(fnum)->namelength  + 1);
+        key_index_add(&Blocked_Contacts.keys, Blocked_Contacts.list[i].pub_key, i);
 
         ++Blocked_Contacts.num_blocked;
 
@@ -589,7 +1128,6 @@ void block_friend(Tox *m, int32_t fnum)
         delete_friend(m, fnum);
         save_blocklist(BLOCK_FILE);
         sort_blocklist_index();
-        sort_friendlist_index();
 
         return;
     }
@@ -611,7 +1149,6 @@ static void unblock_friend(Tox *m, int32_t bnum)
     friendlist_add_blocked(m, friendnum, bnum);
     delete_blocked_friend(bnum);
     sort_blocklist_index();
-    sort_friendlist_index();
 }
 
 static void friendlist_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
@@ -622,19 +1159,43 @@ static void friendlist_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
         return;
     }
 
+    if (!blocklist_view && !pendingdelete.active) {
+        if (Filter.typing && friendlist_filter_onKey(key, ltr))
+            return;
+
+        if (key == '/') {
+            Filter.typing = true;
+            return;
+        }
+
+        if (key == T_KEY_ESC && Filter.len) {
+            friendlist_filter_clear();
+            return;
+        }
+    }
+
     if (key == 'h') {
         help_init_menu(self);
         return;
     }
 
-    if (!blocklist_view && !num_friends && (key != KEY_RIGHT && key != KEY_LEFT))
+    friendlist_refresh_filter();
+
+    int num_shown;
+    int *view = friendlist_view(&num_shown);
+
+    if (!blocklist_view && !num_shown && (key != KEY_RIGHT && key != KEY_LEFT))
         return;
 
     if (blocklist_view && !Blocked_Contacts.num_blocked && (key != KEY_RIGHT && key != KEY_LEFT))
         return;
 
-    int f = blocklist_view == 1 ? Blocked_Contacts.index[Blocked_Contacts.num_selected]
-                                : friendlist_index[num_selected];
+    int f = 0;
+
+    if (blocklist_view == 1 && Blocked_Contacts.num_blocked)
+        f = Blocked_Contacts.index[Blocked_Contacts.num_selected];
+    else if (blocklist_view == 0 && num_shown)
+        f = view[num_selected];
 
     /* lock screen and force decision on deletion popup */
     if (pendingdelete.active) {
@@ -653,11 +1214,11 @@ static void friendlist_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
                 break;
 
             /* Jump to chat window if already open */
-            if (friends[f].chatwin != -1) {
-                set_active_window(friends[f].chatwin);
+            if (get_friend(f)->chatwin != -1) {
+                set_active_window(get_friend(f)->chatwin);
             } else if (get_num_active_windows() < MAX_WINDOWS_NUM) {
-                friends[f].chatwin = add_window(m, new_chat(m, friends[f].num));
-                set_active_window(friends[f].chatwin);
+                get_friend(f)->chatwin = add_window(m, new_chat(m, get_friend(f)->num));
+                set_active_window(get_friend(f)->chatwin);
             } else {
                 const char *msg = "* Warning: Too many windows are open.";
                 line_info_add(prompt, NULL, NULL, NULL, SYS_MSG, 0, RED, msg);
@@ -684,43 +1245,58 @@ static void friendlist_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
 
         default:
             if (blocklist_view == 0)
-                select_friend(self, key, &num_selected, num_friends);
+                select_friend(self, key, &num_selected, num_shown);
             else
                 select_friend(self, key, &Blocked_Contacts.num_selected, Blocked_Contacts.num_blocked);
             break;
     }
 }
 
-#define FLIST_OFST 6    /* Accounts for space at top and bottom */
-
 static void blocklist_onDraw(ToxWindow *self, Tox *m, int y2, int x2)
 {
-    wattron(self->window, A_BOLD);
-    wprintw(self->window, " Blocked: ");
-    wattroff(self->window, A_BOLD);
-    wprintw(self->window, "%d\n\n", Blocked_Contacts.num_blocked);
+    int rows = y2 - FLIST_OFST;
 
-    if ((y2 - FLIST_OFST) <= 0)
-        return;
+    /* the shown page is copied under the lock as the core thread reallocates the blocklist */
+    pthread_mutex_lock(&Winthread.lock);
 
-    int selected_num = 0;
+    int num_blocked = Blocked_Contacts.num_blocked;
+    int selected = Blocked_Contacts.num_selected;
 
     /* Determine which portion of friendlist to draw based on current position */
-    int page = Blocked_Contacts.num_selected / (y2 - FLIST_OFST);
-    int start = (y2 - FLIST_OFST) * page;
-    int end = y2 - FLIST_OFST + start;
-
+    int start = rows > 0 ? rows * (selected / rows) : 0;
+    int num_page = rows > 0 ? MIN(rows, MAX(num_blocked - start, 0)) : 0;
+    char page_names[MAX(num_page, 1)][TOXIC_MAX_NAME_LENGTH];
+    char selected_key[TOX_CLIENT_ID_SIZE];
     int i;
 
-    for (i = start; i < Blocked_Contacts.num_blocked && i < end; ++i) {
-        int f = Blocked_Contacts.index[i];
+    for (i = 0; i < num_page; ++i) {
+        int f = Blocked_Contacts.index[start + i];
+        memcpy(page_names[i], Blocked_Contacts.list[f].name, TOXIC_MAX_NAME_LENGTH);
+        page_names[i][TOXIC_MAX_NAME_LENGTH - 1] = '\0';
+    }
+
+    if (num_blocked) {
+        int f = selected < num_blocked ? Blocked_Contacts.index[selected] : 0;
+        memcpy(selected_key, Blocked_Contacts.list[f].pub_key, TOX_CLIENT_ID_SIZE);
+    }
+
+    pthread_mutex_unlock(&Winthread.lock);
+
+    wattron(self->window, A_BOLD);
+    wprintw(self->window, " Blocked: ");
+    wattroff(self->window, A_BOLD);
+    wprintw(self->window, "%d\n\n", num_blocked);
+
+    if (rows <= 0)
+        return;
+
+    for (i = start; i < start + num_page; ++i) {
         bool f_selected = false;
 
-        if (i == Blocked_Contacts.num_selected) {
+        if (i == selected) {
             wattron(self->window, A_BOLD);
             wprintw(self->window, " > ");
             wattroff(self->window, A_BOLD);
-            selected_num = f;
             f_selected = true;
         } else {
             wprintw(self->window, "   ");
@@ -734,7 +1310,7 @@ static void blocklist_onDraw(ToxWindow *self, Tox *m, int y2, int x2)
             wattron(self->window, COLOR_PAIR(BLUE));
 
         wattron(self->window, A_BOLD);
-        wprintw(self->window, " %s\n", Blocked_Contacts.list[f].name);
+        wprintw(self->window, " %s\n", page_names[i - start]);
         wattroff(self->window, A_BOLD);
 
         if (f_selected)
@@ -744,17 +1320,15 @@ static void blocklist_onDraw(ToxWindow *self, Tox *m, int y2, int x2)
     wprintw(self->window, "\n");
     self->x = x2;
 
-    if (Blocked_Contacts.num_blocked) {
+    if (num_blocked) {
         wmove(self->window, y2 - 1, 1);
 
         wattron(self->window, A_BOLD);
         wprintw(self->window, "ID: ");
         wattroff(self->window, A_BOLD);
 
-        int i;
-
         for (i = 0; i < TOX_CLIENT_ID_SIZE; ++i)
-            wprintw(self->window, "%02X", Blocked_Contacts.list[selected_num].pub_key[i] & 0xff);
+            wprintw(self->window, "%02X", selected_key[i] & 0xff);
     }
 
     wrefresh(self->window);
@@ -771,8 +1345,6 @@ static void friendlist_onDraw(ToxWindow *self, Tox *m)
     int x2, y2;
     getmaxyx(self->window, y2, x2);
 
-    bool fix_statuses = x2 != self->x;    /* true if window max x value has changed */
-
     wattron(self->window, COLOR_PAIR(CYAN));
     wprintw(self->window, " Press the");
     wattron(self->window, A_BOLD);
@@ -789,33 +1361,61 @@ static void friendlist_onDraw(ToxWindow *self, Tox *m)
     uint64_t cur_time = get_unix_time();
     struct tm cur_loc_tm = *localtime((const time_t *) &cur_time);
 
+    /* the shown page of the list is copied under the lock as the core thread reorders and
+       reallocates friendlist_index */
     pthread_mutex_lock(&Winthread.lock);
-    int nf = tox_get_num_online_friends(m);
+
+    int num_shown;
+    int *view = friendlist_view(&num_shown);
+    int rows = friendlist_rows(self);
+    int selected = num_selected;
+    bool searching = Filter.typing || Filter.len;
+    bool typing = Filter.typing;
+    char search[sizeof(Filter.text)];
+    memcpy(search, Filter.text, sizeof(search));
+
+    /* Only the page containing the selection is drawn */
+    int start = rows > 0 ? rows * (selected / rows) : 0;
+    int num_page = rows > 0 ? MIN(rows, MAX(num_shown - start, 0)) : 0;
+    int page_friends[MAX(num_page, 1)];
+    memcpy(page_friends, view + start, num_page * sizeof(int));
+
     pthread_mutex_unlock(&Winthread.lock);
 
     wattron(self->window, A_BOLD);
     wprintw(self->window, " Online: ");
     wattroff(self->window, A_BOLD);
-    wprintw(self->window, "%d/%d \n\n", nf, num_friends);
+    wprintw(self->window, "%d/%d \n", num_online, num_friends);
 
-    if ((y2 - FLIST_OFST) <= 0)
-        return;
+    if (searching) {
+        wattron(self->window, A_BOLD);
+        wprintw(self->window, " Search: ");
+        wattroff(self->window, A_BOLD);
+        wprintw(self->window, "%s", search);
 
-    int selected_num = 0;
+        if (typing)
+            wprintw(self->window, "_");
 
-    /* Determine which portion of friendlist to draw based on current position */
-    int page = num_selected / (y2 - FLIST_OFST);
-    int start = (y2 - FLIST_OFST) * page;
-    int end = y2 - FLIST_OFST + start;
+        wprintw(self->window, " (%d match%s)\n", num_shown, num_shown == 1 ? "" : "es");
+    }
+
+    wprintw(self->window, "\n");
 
+    if (rows <= 0)
+        return;
+
+    int selected_num = -1;
     int i;
 
-    for (i = start; i < num_friends && i < end; ++i) {
-        int f = friendlist_index[i];
+    for (i = start; i < start + num_page; ++i) {
+        int f = page_friends[i - start];
         bool f_selected = false;
 
-        if (friends[f].active) {
-            if (i == num_selected) {
+        if (get_friend(f)->active) {
+            struct FriendPresence presence;
+            get_friend_presence(f, &presence);
+
+            if (i == selected) {
                 wattron(self->window, A_BOLD);
                 wprintw(self->window, " > ");
                 wattroff(self->window, A_BOLD);
@@ -825,8 +1425,8 @@ static void friendlist_onDraw(ToxWindow *self, Tox *m)
                 wprintw(self->window, "   ");
             }
 
-            if (friends[f].online) {
-                uint8_t status = friends[f].status;
+            if (presence.online) {
+                uint8_t status = presence.status;
                 int colour = WHITE;
 
                 switch (status) {
@@ -855,37 +1455,22 @@ static void friendlist_onDraw(ToxWindow *self, Tox *m)
                     wattron(self->window, COLOR_PAIR(BLUE));
 
                 wattron(self->window, A_BOLD);
-                wprintw(self->window, "%s", friends[f].name);
+                wprintw(self->window, "%s", presence.name);
                 wattroff(self->window, A_BOLD);
 
                 if (f_selected)
                     wattroff(self->window, COLOR_PAIR(BLUE));
 
-                /* Reset friends[f].statusmsg on window resize */
-                if (fix_statuses) {
-                    char statusmsg[TOX_MAX_STATUSMESSAGE_LENGTH];
-
-                    pthread_mutex_lock(&Winthread.lock);
-                    tox_get_status_message(m, friends[f].num, (uint8_t *) statusmsg, TOX_MAX_STATUSMESSAGE_LENGTH);
-                    pthread_mutex_unlock(&Winthread.lock);
-
-                    snprintf(friends[f].statusmsg, sizeof(friends[f].statusmsg), "%s", statusmsg);
-                    friends[f].statusmsg_len = strlen(friends[f].statusmsg);
-                }
-
                 /* Truncate note if it doesn't fit on one line */
-                uint16_t maxlen = x2 - getcurx(self->window) - 2;
+                int maxlen = x2 - getcurx(self->window) - 2;
 
-                if (friends[f].statusmsg_len > maxlen) {
-                    friends[f].statusmsg[maxlen - 3] = '\0';
-                    strcat(friends[f].statusmsg, "...");
-                    friends[f].statusmsg[maxlen] = '\0';
-                    friends[f].statusmsg_len = maxlen;
+                if (presence.statusmsg[0] && maxlen > 3) {
+                    if (presence.statusmsg_len > maxlen)
+                        wprintw(self->window, " %.*s...", maxlen - 3, presence.statusmsg);
+                    else
+                        wprintw(self->window, " %s", presence.statusmsg);
                 }
 
-                if (friends[f].statusmsg[0])
-                    wprintw(self->window, " %s", friends[f].statusmsg);
-
                 wprintw(self->window, "\n");
             } else {
                 wprintw(self->window, "%s ", OFFLINE_CHAR);
@@ -894,17 +1479,17 @@ static void friendlist_onDraw(ToxWindow *self, Tox *m)
                     wattron(self->window, COLOR_PAIR(BLUE));
 
                 wattron(self->window, A_BOLD);
-                wprintw(self->window, "%s", friends[f].name);
+                wprintw(self->window, "%s", presence.name);
                 wattroff(self->window, A_BOLD);
 
                 if (f_selected)
                     wattroff(self->window, COLOR_PAIR(BLUE));
 
-                uint64_t last_seen = friends[f].last_online.last_on;
+                uint64_t last_seen = get_friend(f)->last_online.last_on;
 
                 if (last_seen != 0) {
-                    int day_dist = (cur_loc_tm.tm_yday - friends[f].last_online.tm.tm_yday) % 365;
-                    const char *hourmin = friends[f].last_online.hour_min_str;
+                    int day_dist = (cur_loc_tm.tm_yday - get_friend(f)->last_online.tm.tm_yday) % 365;
+                    const char *hourmin = get_friend(f)->last_online.hour_min_str;
 
                     switch (day_dist) {
                         case 0:
@@ -928,7 +1513,7 @@ static void friendlist_onDraw(ToxWindow *self, Tox *m)
 
     self->x = x2;
 
-    if (num_friends) {
+    if (selected_num != -1) {
         wmove(self->window, y2 - 1, 1);
 
         wattron(self->window, A_BOLD);
@@ -938,7 +1523,7 @@ static void friendlist_onDraw(ToxWindow *self, Tox *m)
         int i;
 
         for (i = 0; i < TOX_CLIENT_ID_SIZE; ++i)
-            wprintw(self->window, "%02X", friends[selected_num].pub_key[i] & 0xff);
+            wprintw(self->window, "%02X", get_friend(selected_num)->pub_key[i] & 0xff);
     }
 
     wrefresh(self->window);
@@ -950,7 +1535,7 @@ static void friendlist_onDraw(ToxWindow *self, Tox *m)
 
 void disable_chatwin(int32_t f_num)
 {
-    friends[f_num].chatwin = -1;
+    get_friend(f_num)->chatwin = -1;
 }
 
 #ifdef _AUDIO
@@ -964,14 +1549,14 @@ static void friendlist_onAv(ToxWindow *self, ToxAv *av, int call_index)
 
     Tox *m = toxav_get_tox(av);
 
-    if (friends[id].chatwin == -1) {
+    if (get_friend(id)->chatwin == -1) {
         if (get_num_active_windows() < MAX_WINDOWS_NUM) {
             if (toxav_get_call_state(av, call_index) == av_CallStarting) { /* Only open windows when call is incoming */
-                friends[id].chatwin = add_window(m, new_chat(m, friends[id].num));
+                get_friend(id)->chatwin = add_window(m, new_chat(m, get_friend(id)->num));
             }            
         } else {
             char nick[TOX_MAX_NAME_LENGTH];
-            get_nick_truncate(m, nick, friends[id].num);
+            get_nick_truncate(m, nick, get_friend(id)->num);
             line_info_add(prompt, NULL, NULL, NULL, SYS_MSG, 0, 0, "Audio action from: %s!", nick);
 
             const char *errmsg = "* Warning: Too many windows are open.";
@@ -28,15 +28,26 @@
 #include "toxic.h"
 #include "windows.h"
 #include "file_senders.h"
+#include "file_writer.h"
 
+/* an incoming file transfer, from the request until it's closed */
 struct FileReceiver {
-    char filenames[MAX_FILES][MAX_STR_SIZE];
-    FILE *files[MAX_FILES];
-    bool pending[MAX_FILES];
-    uint64_t size[MAX_FILES];
-    double bps[MAX_FILES];
-    uint64_t last_progress[MAX_FILES];
-    uint32_t line_id[MAX_FILES];
+    char filename[MAX_STR_SIZE];
+    struct file_writer *writer;    /* NULL until the transfer is accepted */
+    bool pending;
+    uint64_t size;
+    double bps;
+    uint64_t last_progress;
+    uint32_t line_id;
+    uint64_t file_id;    /* file_identity() of the file */
+    uint64_t resume;    /* offset an interrupted transfer of the file can be resumed at; 0 if none */
+    bool paused;    /* paused by the download limits */
+};
+
+/* a friend's file transfers in each direction, indexed by the core's file number */
+struct FileTransfers {
+    FileSender *senders[MAX_FILES];
+    struct FileReceiver *receivers[MAX_FILES];
 };
 
 struct LastOnline {
@@ -45,25 +56,56 @@ struct LastOnline {
     char hour_min_str[TIME_STR_SIZE];    /* holds 12/24-hour time string e.g. "10:43 PM" */
 };
 
+/* Copy of a friend's presence as published to the drawing code. The core thread
+   writes the fields in ToxicFriend and publishes them with publish_friend_presence() */
+struct FriendPresence {
+    bool online;
+    uint8_t status;
+    uint8_t is_typing;
+    uint16_t namelength;
+    uint16_t statusmsg_len;
+    char name[TOXIC_MAX_NAME_LENGTH];
+    char statusmsg[TOX_MAX_STATUSMESSAGE_LENGTH];
+};
+
 typedef struct {
+    /* fields read on every friendlist redraw are kept together at the start */
     char name[TOXIC_MAX_NAME_LENGTH];
+    char namekey[TOXIC_MAX_NAME_LENGTH];    /* lowercase name used to order friendlist_index */
     int namelength;
-    char statusmsg[TOX_MAX_STATUSMESSAGE_LENGTH];
-    uint16_t statusmsg_len;
-    char groupchat_key[TOX_CLIENT_ID_SIZE];
-    bool groupchat_pending;
-    char pub_key[TOX_CLIENT_ID_SIZE];
     int32_t num;
     int chatwin;
     bool active;
     bool online;
+    uint8_t status;
     uint8_t is_typing;
+    uint16_t statusmsg_len;
     bool logging_on;    /* saves preference for friend irrespective of chat windows */
-    uint8_t status;
+    bool groupchat_pending;
+    char statusmsg[TOX_MAX_STATUSMESSAGE_LENGTH];
+    char groupchat_key[TOX_CLIENT_ID_SIZE];
+    char pub_key[TOX_CLIENT_ID_SIZE];
     struct LastOnline last_online;
-    struct FileReceiver file_receiver;
+    struct FileTransfers *file_transfers;    /* NULL until the first file transfer with the friend */
+    struct latency_hist *latency;    /* NULL until the first read receipt arrives */
+    uint8_t file_weight;    /* share of outgoing file bandwidth, 1 to MAX_FILE_WEIGHT; 0 means 1 */
+    uint16_t num_file_senders;
+    int upload_limit;    /* KiB/s; 0 for no limit */
+    int download_limit;    /* KiB/s; 0 for no limit */
+    struct token_bucket upload_bucket;
+    struct token_bucket download_bucket;
 } ToxicFriend;
 
+#define FRIEND_CHUNK_SIZE 256
+#define MAX_FRIEND_CHUNKS 1024    /* limits the friend list to 262144 friends */
+
+/* Friends are allocated in chunks that are never moved or freed, so the draw thread can read a
+   friend without the lock while the core thread adds others */
+extern ToxicFriend *friend_chunks[MAX_FRIEND_CHUNKS];
+
+/* returns a pointer to the friend at index num of the friend list */
+#define get_friend(num) (&friend_chunks[(num) / FRIEND_CHUNK_SIZE][(num) % FRIEND_CHUNK_SIZE])
+
 typedef struct {
     char name[TOXIC_MAX_NAME_LENGTH];
     int namelength;
@@ -75,12 +117,49 @@ typedef struct {
 
 ToxWindow new_friendlist(void);
 void disable_chatwin(int32_t f_num);
+
+/* returns the friend number of the friend with nick name (case insensitive), or -1 if there is none */
 int get_friendnum(uint8_t *name);
+
+/* returns the friend number of the friend with public key pub_key, or -1 if there is none */
+int32_t get_friendnum_by_key(const char *pub_key);
+
+/* returns true if pub_key is in the blocklist */
+bool friend_is_blocked(const char *pub_key);
+
+/* returns 1 + the index of the last friend in the friends array */
+int get_max_friends_index(void);
+
+/* returns true if friend num is shown as online */
+bool friend_is_online(int32_t num);
+
 int load_blocklist(char *data);
 
+/* publishes friend's current presence fields to the drawing code. Must be called with Winthread.lock held
+   whenever the online, status, is_typing, name or statusmsg fields change */
+void publish_friend_presence(int32_t num);
+
+/* copies the presence most recently published for friend into p. Does not need Winthread.lock */
+void get_friend_presence(int32_t num, struct FriendPresence *p);
+
+/* returns friend's file transfer table, allocating it if necessary */
+struct FileTransfers *get_file_transfers(int32_t num);
+
+/* returns friend's incoming transfer filenum, or NULL if there is none */
+struct FileReceiver *get_file_receiver(int32_t num, uint8_t filenum);
+
+/* returns a new incoming transfer filenum for friend, replacing any previous one with the same number */
+struct FileReceiver *new_file_receiver(int32_t num, uint8_t filenum);
+
+/* returns friend's message delivery latency histogram, allocating it if necessary */
+struct latency_hist *get_friend_latency(int32_t num);
+
 void friendlist_onFriendAdded(ToxWindow *self, Tox *m, int32_t num, bool sort);
 
 /* sorts friendlist_index first by connection status then alphabetically */
 void sort_friendlist_index(void);
 
+/* rebuilds the friendlist search results if the list changed. Must be called with Winthread.lock held */
+void friendlist_refresh_filter(void);
+
 #endif /* end of include guard: FRIENDLIST_H_53I41IM */
@@ -31,17 +31,39 @@
 #include "log.h"
 #include "line_info.h"
 #include "dns.h"
+#include "import.h"
 #include "groupchat.h"
 #include "prompt.h"
 #include "help.h"
+#include "message_queue.h"
+#include "settings.h"
 
 extern char *DATA_FILE;
 extern ToxWindow *prompt;
 
-extern ToxicFriend friends[MAX_FRIENDS_NUM];
+extern struct user_settings *user_settings_;
 
-extern char pending_frnd_requests[MAX_FRIENDS_NUM][TOX_CLIENT_ID_SIZE];
-extern uint8_t num_frnd_requests;
+extern struct _FriendRequests FrndRequests;
+
+/* returns the slot of the pending request with the number in str, or -1 if there is none.
+   Request numbers are never reused, so a number can't refer to a newer request */
+static int get_request_num(const char *str)
+{
+    char *end;
+    unsigned long seq = strtoul(str, &end, 10);
+
+    if (end == str || *end != '\0' || str[0] == '-' || seq > UINT32_MAX)
+        return -1;
+
+    int i;
+
+    for (i = 0; i < FrndRequests.max_index; ++i) {
+        if (FrndRequests.request[i].active && FrndRequests.request[i].seq == seq)
+            return i;
+    }
+
+    return -1;
+}
 
 /* command functions */
 void cmd_accept(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
@@ -54,80 +76,334 @@ void cmd_accept(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[
         return;
     }
 
-    int req = atoi(argv[1]);
+    if (!strcmp(argv[1], "all")) {
+        int accepted = 0, failed = 0;
+        int i;
+
+        for (i = 0; i < FrndRequests.max_index; ++i) {
+            if (!FrndRequests.request[i].active)
+                continue;
+
+            int32_t friendnum = tox_add_friend_norequest(m, (uint8_t *) FrndRequests.request[i].key);
+
+            if (friendnum == -1) {
+                ++failed;
+            } else {
+                on_friendadded(m, friendnum, true, false);
+                ++accepted;
+            }
+
+            del_friend_request(i);
+        }
+
+        if (accepted)
+            store_data(m, DATA_FILE);
+
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%d friend request%s accepted.", accepted,
+                      accepted == 1 ? "" : "s");
+
+        if (failed)
+            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, RED, "Failed to add %d friend%s.", failed,
+                          failed == 1 ? "" : "s");
 
-    if ((req == 0 && strcmp(argv[1], "0")) || req >= MAX_FRIENDS_NUM) {
-        msg = "No pending friend request with that number.";
-        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, msg);
         return;
     }
 
-    if (!strlen(pending_frnd_requests[req])) {
+    int req = get_request_num(argv[1]);
+
+    if (req == -1) {
         msg = "No pending friend request with that number.";
         line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, msg);
         return;
     }
 
-    int32_t friendnum = tox_add_friend_norequest(m, (uint8_t *) pending_frnd_requests[req]);
+    int32_t friendnum = tox_add_friend_norequest(m, (uint8_t *) FrndRequests.request[req].key);
 
     if (friendnum == -1)
         msg = "Failed to add friend.";
     else {
         msg = "Friend request accepted.";
-        on_friendadded(m, friendnum, true);
+        on_friendadded(m, friendnum, true, true);
+    }
+
+    del_friend_request(req);
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", msg);
+}
+
+void cmd_decline(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
+{
+    char *msg;
+
+    if (argc < 1) {
+        msg = "Invalid syntax.";
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, msg);
+        return;
+    }
+
+    uint64_t cutoff = 0;    /* requests received at or before cutoff are declined */
+
+    if (!strcmp(argv[1], "all")) {
+        cutoff = get_unix_time();
+    } else if (!strcmp(argv[1], "older-than")) {
+        int minutes = argc == 2 ? atoi(argv[2]) : 0;
+
+        if (minutes <= 0) {
+            msg = "Usage: /decline older-than <minutes>";
+            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, msg);
+            return;
+        }
+
+        cutoff = get_unix_time() - MIN((uint64_t) minutes * 60, get_unix_time());
+    } else {
+        int req = get_request_num(argv[1]);
+
+        if (req == -1) {
+            msg = "No pending friend request with that number.";
+            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, msg);
+            return;
+        }
+
+        del_friend_request(req);
+        msg = "Friend request declined.";
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, msg);
+        return;
+    }
+
+    int declined = 0;
+    int i;
+
+    for (i = 0; i < FrndRequests.max_index; ++i) {
+        if (FrndRequests.request[i].active && FrndRequests.request[i].timestamp <= cutoff) {
+            del_friend_request(i);
+            ++declined;
+        }
+    }
+
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%d friend request%s declined.", declined,
+                  declined == 1 ? "" : "s");
+}
+
+void cmd_requests(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
+{
+    FrndRequests.suppressed = 0;
+
+    if (FrndRequests.num_requests == 0) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "No pending friend requests.");
+        return;
     }
 
-    memset(&pending_frnd_requests[req], 0, TOX_CLIENT_ID_SIZE);
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 1, 0, "%d pending friend request%s:", FrndRequests.num_requests,
+                  FrndRequests.num_requests == 1 ? "" : "s");
 
+    uint64_t cur_time = get_unix_time();
     int i;
 
-    for (i = num_frnd_requests; i > 0; --i) {
-        if (!strlen(pending_frnd_requests[i - 1]))
-            break;
+    for (i = 0; i < FrndRequests.max_index; ++i) {
+        struct friend_request *fr = &FrndRequests.request[i];
+
+        if (!fr->active)
+            continue;
+
+        char id[KEY_IDENT_DIGITS * 2 + 1];
+        int j;
+
+        for (j = 0; j < KEY_IDENT_DIGITS; ++j)
+            snprintf(&id[j * 2], sizeof(id) - j * 2, "%02X", fr->key[j] & 0xff);
+
+        uint64_t age = cur_time - MIN(fr->timestamp, cur_time);
+        char agestr[TIME_STR_SIZE];
+
+        if (age < 60)
+            snprintf(agestr, sizeof(agestr), "%ds", (int) age);
+        else if (age < 3600)
+            snprintf(agestr, sizeof(agestr), "%dm", (int) (age / 60));
+        else if (age < 86400)
+            snprintf(agestr, sizeof(agestr), "%dh", (int) (age / 3600));
+        else
+            snprintf(agestr, sizeof(agestr), "%dd", (int) (age / 86400));
+
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%3u: {%s} %4s ago: %.48s", fr->seq, id, agestr, fr->msg);
     }
 
-    num_frnd_requests = i;
-    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s", msg);
+    if (FrndRequests.evicted)
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%u older request%s dropped because the queue was full.",
+                      FrndRequests.evicted, FrndRequests.evicted == 1 ? " was" : "s were");
 }
 
-void cmd_add_helper(ToxWindow *self, Tox *m, char *id_bin, char *msg)
+/* prints the message delivery latencies of friend num and the state of its chat window's queue */
+static void print_netstats(ToxWindow *self, int32_t num)
 {
-    const char *errmsg;
-    int32_t f_num = tox_add_friend(m, (uint8_t *) id_bin, (uint8_t *) msg, (uint16_t) strlen(msg));
+    struct latency_hist *h = get_friend(num)->latency;
+
+    if (h && h->count) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0,
+                      "%s: %u delivered, p50 %llu ms, p95 %llu ms, p99 %llu ms, max %llu ms", get_friend(num)->name,
+                      h->count, (unsigned long long) latency_hist_percentile(h, 50),
+                      (unsigned long long) latency_hist_percentile(h, 95),
+                      (unsigned long long) latency_hist_percentile(h, 99), (unsigned long long) h->max);
+    } else {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s: no read receipts yet", get_friend(num)->name);
+    }
 
+    ToxWindow *chat = get_friend(num)->chatwin != -1 ? get_window_ptr(get_friend(num)->chatwin) : NULL;
+
+    if (chat == NULL)
+        return;
+
+    ChatContext *ctx = chat->chatwin;
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0,
+                  "  %d queued, %d awaiting receipt; typing notifications: %u sent, %u suppressed",
+                  ctx->cqueue->num_msgs, ctx->cqueue->num_unread, ctx->typing_sent, ctx->typing_suppressed);
+}
+
+void cmd_netstats(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
+{
+    if (self->is_chat) {
+        print_netstats(self, self->num);
+        return;
+    }
+
+    int shown = 0;
+    int i;
+
+    for (i = 0; i < get_max_friends_index(); ++i) {
+        if (!get_friend(i)->active)
+            continue;
+
+        if ((get_friend(i)->latency == NULL || get_friend(i)->latency->count == 0) && get_friend(i)->chatwin == -1)
+            continue;
+
+        print_netstats(self, i);
+        ++shown;
+    }
+
+    if (shown == 0)
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "No messages have been sent.");
+}
+
+#define MAX_RATE_LIMIT 1048576    /* KiB/s */
+
+static void print_rate_limit(ToxWindow *self, const char *name, int limit)
+{
+    if (limit > 0)
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s: %d KiB/s", name, limit);
+    else
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s: none", name);
+}
+
+void cmd_ratelimit(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
+{
+    if (argc == 0) {
+        print_rate_limit(self, "Upload limit", user_settings_->upload_limit);
+        print_rate_limit(self, "Download limit", user_settings_->download_limit);
+        print_rate_limit(self, "Limit during calls", user_settings_->call_rate_limit);
+
+        if (self->is_chat) {
+            print_rate_limit(self, "Friend upload limit", get_friend(self->num)->upload_limit);
+            print_rate_limit(self, "Friend download limit", get_friend(self->num)->download_limit);
+        }
+
+        return;
+    }
+
+    const char *type = argv[1];
+    const char *val = argv[2];
+    int *limit = NULL;
+    bool friend = strcmp(argv[1], "friend") == 0;
+
+    if (friend) {
+        if (!self->is_chat) {
+            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Friend limits can only be set in a chat window.");
+            return;
+        }
+
+        if (argc < 3) {
+            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Usage: /ratelimit friend <up|down> <KiB/s>");
+            return;
+        }
+
+        type = argv[2];
+        val = argv[3];
+
+        if (strcmp(type, "up") == 0)
+            limit = &get_friend(self->num)->upload_limit;
+        else if (strcmp(type, "down") == 0)
+            limit = &get_friend(self->num)->download_limit;
+    } else {
+        if (argc < 2) {
+            line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Usage: /ratelimit <up|down|call> <KiB/s>");
+            return;
+        }
+
+        if (strcmp(type, "up") == 0)
+            limit = &user_settings_->upload_limit;
+        else if (strcmp(type, "down") == 0)
+            limit = &user_settings_->download_limit;
+        else if (strcmp(type, "call") == 0)
+            limit = &user_settings_->call_rate_limit;
+    }
+
+    if (limit == NULL) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Invalid limit type '%s'.", type);
+        return;
+    }
+
+    char *end;
+    long kib = strtol(val, &end, 10);
+
+    if (end == val || *end != '\0' || kib < 0 || kib > MAX_RATE_LIMIT) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Rate must be between 0 and %d KiB/s (0 for no limit).",
+                      MAX_RATE_LIMIT);
+        return;
+    }
+
+    *limit = kib;
+
+    if (kib == 0)
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s%s limit removed.", friend ? "Friend " : "", type);
+    else
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%s%s limit set to %ld KiB/s.", friend ? "Friend " : "",
+                      type, kib);
+}
+
+/* returns a description of the error returned by tox_add_friend(), or NULL if f_num is a friend number */
+const char *get_add_friend_errmsg(int32_t f_num)
+{
     switch (f_num) {
         case TOX_FAERR_TOOLONG:
-            errmsg = "Message is too long.";
-            break;
+            return "Message is too long.";
 
         case TOX_FAERR_NOMESSAGE:
-            errmsg = "Please add a message to your request.";
-            break;
+            return "Please add a message to your request.";
 
         case TOX_FAERR_OWNKEY:
-            errmsg = "That appears to be your own ID.";
-            break;
+            return "That appears to be your own ID.";
 
         case TOX_FAERR_ALREADYSENT:
-            errmsg = "Friend request has already been sent.";
-            break;
+            return "Friend request has already been sent.";
 
         case TOX_FAERR_UNKNOWN:
-            errmsg = "Undefined error when adding friend.";
-            break;
+            return "Undefined error when adding friend.";
 
         case TOX_FAERR_BADCHECKSUM:
-            errmsg = "Bad checksum in address.";
-            break;
+            return "Bad checksum in address.";
 
         case TOX_FAERR_SETNEWNOSPAM:
-            errmsg = "Nospam was different.";
-            break;
+            return "Nospam was different.";
 
         default:
-            errmsg = "Friend request sent.";
-            on_friendadded(m, f_num, true);
-            break;
+            return f_num < 0 ? "Undefined error when adding friend." : NULL;
+    }
+}
+
+void cmd_add_helper(ToxWindow *self, Tox *m, char *id_bin, char *msg)
+{
+    int32_t f_num = tox_add_friend(m, (uint8_t *) id_bin, (uint8_t *) msg, (uint16_t) strlen(msg));
+    const char *errmsg = get_add_friend_errmsg(f_num);
+
+    if (errmsg == NULL) {
+        errmsg = "Friend request sent.";
+        on_friendadded(m, f_num, true, true);
     }
 
     line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
@@ -195,9 +471,39 @@ void cmd_add(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX
     }
 }
 
+void cmd_import(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
+{
+    const char *errmsg;
+
+    if (argc < 1) {
+        errmsg = "Invalid syntax.";
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
+        return;
+    }
+
+    if (argv[1][0] != '\"') {
+        errmsg = "File path must be enclosed in quotes.";
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
+        return;
+    }
+
+    /* remove opening and closing quotes */
+    char path[MAX_STR_SIZE];
+    snprintf(path, sizeof(path), "%s", &argv[1][1]);
+    int path_len = strlen(path) - 1;
+    path[path_len] = '\0';
+
+    import_start(self, m, path);
+}
+
 void cmd_clear(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX_STR_SIZE])
 {
     line_info_clear(self->chatwin->hst);
+
+    /* a window without curses windows is repainted from its cleared history when focused */
+    if (window == NULL)
+        return;
+
     wclear(window);
     endwin();
     refresh();
@@ -277,8 +583,8 @@ void cmd_log(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX
     if (!strcmp(swch, "1") || !strcmp(swch, "on")) {
 
         if (self->is_chat) {
-            friends[self->num].logging_on = true;
-            log_enable(self->name, friends[self->num].pub_key, log);
+            get_friend(self->num)->logging_on = true;
+            log_enable(self->name, get_friend(self->num)->pub_key, log);
         } else if (self->is_prompt) {
             char myid[TOX_FRIEND_ADDRESS_SIZE];
             tox_get_address(m, (uint8_t *) myid);
@@ -292,7 +598,7 @@ void cmd_log(WINDOW *window, ToxWindow *self, Tox *m, int argc, char (*argv)[MAX
         return;
     } else if (!strcmp(swch, "0") || !strcmp(swch, "off")) {
         if (self->is_chat)
-            friends[self->num].logging_on = false;
+            get_friend(self->num)->logging_on = false;
 
         log_disable(log);
 
@@ -57,7 +57,7 @@ extern const char glob_cmd_list[AC_NUM_GLOB_COMMANDS][MAX_CMDNAME_SIZE];
 
 int init_groupchat_win(ToxWindow *prompt, Tox *m, int groupnum)
 {
-    if (groupnum > MAX_GROUPCHAT_NUM)
+    if (groupnum >= MAX_GROUPCHAT_NUM)
         return -1;
 
     int i;
@@ -487,15 +487,9 @@ static void groupchat_onDraw(ToxWindow *self, Tox *m)
 
 static void groupchat_onInit(ToxWindow *self, Tox *m)
 {
-    int x2, y2;
-    getmaxyx(self->window, y2, x2);
-
+    /* the curses sub-windows are created when the window is first focused */
     ChatContext *ctx = self->chatwin;
 
-    ctx->history = subwin(self->window, y2 - CHATBOX_HEIGHT + 1, x2 - SIDEBAR_WIDTH - 1, 0, 0);
-    ctx->linewin = subwin(self->window, CHATBOX_HEIGHT, x2, y2 - CHATBOX_HEIGHT, 0);
-    ctx->sidebar = subwin(self->window, y2 - CHATBOX_HEIGHT + 1, SIDEBAR_WIDTH, 0, x2 - SIDEBAR_WIDTH);
-
     ctx->hst = calloc(1, sizeof(struct history));
     ctx->log = calloc(1, sizeof(struct chatlog));
 
@@ -508,9 +502,6 @@ static void groupchat_onInit(ToxWindow *self, Tox *m)
         log_enable(self->name, NULL, ctx->log);
 
     execute(ctx->history, self, m, "/log", GLOBAL_COMMAND_MODE);
-
-    scrollok(ctx->history, 0);
-    wmove(self->window, y2 - CURS_Y_OFFSET, 0);
 }
 
 ToxWindow new_group_chat(Tox *m, int groupnum)
@@ -137,7 +137,11 @@ static void help_draw_global(ToxWindow *self)
     wattroff(win, A_BOLD | COLOR_PAIR(RED));
 
     wprintw(win, "  /add <id> <msg>            : Add contact with optional message\n");
-    wprintw(win, "  /accept <n>                : Accept friend request\n");
+    wprintw(win, "  /accept <n> or all         : Accept friend request\n");
+    wprintw(win, "  /decline <n> or all        : Decline friend request\n");
+    wprintw(win, "  /decline older-than <min>  : Decline requests older than min minutes\n");
+    wprintw(win, "  /requests                  : List pending friend requests\n");
+    wprintw(win, "  /import <path>             : Add the contacts listed in a file\n");
     wprintw(win, "  /connect <ip> <port> <key> : Manually connect to a DHT node\n");
     wprintw(win, "  /status <type> <msg>       : Set status with optional note\n");
     wprintw(win, "  /note <msg>                : Set a personal note\n");
@@ -145,6 +149,8 @@ static void help_draw_global(ToxWindow *self)
     wprintw(win, "  /log <on> or <off>         : Enable/disable logging\n");
     wprintw(win, "  /groupchat                 : Create a group chat\n");
     wprintw(win, "  /myid                      : Print your ID\n");
+    wprintw(win, "  /netstats                  : Show message delivery latencies\n");
+    wprintw(win, "  /ratelimit <type> <KiB/s>  : Limit file transfer rate (up|down|call)\n");
     wprintw(win, "  /clear                     : Clear window history\n");
     wprintw(win, "  /close                     : Close the current chat window\n");
     wprintw(win, "  /quit or /exit             : Exit Toxic\n");
@@ -177,7 +183,10 @@ static void help_draw_chat(ToxWindow *self)
     wprintw(win, "  /invite <n>                : Invite contact to a group chat\n");
     wprintw(win, "  /join                      : Join a pending group chat\n");
     wprintw(win, "  /sendfile <path>           : Send a file\n");
+    wprintw(win, "  /sendfile -r <path>        : Send a directory's files\n");
     wprintw(win, "  /savefile <n>              : Receive a file\n");
+    wprintw(win, "  /weight <n>                : Set contact's share of file bandwidth (1-8)\n");
+    wprintw(win, "  /ratelimit friend <d> <n>  : Limit contact's file rate to n KiB/s (up|down)\n");
 
 #ifdef _AUDIO
     wattron(win, A_BOLD);
@@ -234,10 +243,12 @@ static void help_draw_contacts(ToxWindow *self)
     wattroff(win, A_BOLD | COLOR_PAIR(RED));
 
     wprintw(win, "  Up and Down arrows            : Scroll through list\n");
+    wprintw(win, "  Page Up/Down, Home and End    : Jump through list\n");
     wprintw(win, "  Right and Left arrows         : Switch between friendlist and blocked list\n");
     wprintw(win, "  Enter                         : Open a chat window with selected contact\n");
     wprintw(win, "  Delete                        : Permanently delete a contact\n");
     wprintw(win, "  B                             : Block or unblock a contact\n");
+    wprintw(win, "  /                             : Search by name or note (Esc clears)\n");
 
     help_draw_bottom_menu(win);
 
@@ -255,24 +266,24 @@ void help_onKey(ToxWindow *self, wint_t key)
 
         case 'c':
 #ifdef _AUDIO
-            help_init_window(self, 19, 80);
+            help_init_window(self, 22, 80);
 #else
-            help_init_window(self, 9, 80);
+            help_init_window(self, 12, 80);
 #endif
             self->help->type = HELP_CHAT;
             break;
 
         case 'g':
 #ifdef _AUDIO
-            help_init_window(self, 21, 80);
+            help_init_window(self, 27, 80);
 #else
-            help_init_window(self, 17, 80);
+            help_init_window(self, 23, 80);
 #endif
             self->help->type = HELP_GLOBAL;
             break;
 
         case 'f':
-            help_init_window(self, 10, 80);
+            help_init_window(self, 12, 80);
             self->help->type = HELP_CONTACTS;
             break;
 
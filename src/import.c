@@ -0,0 +1,454 @@
+/*  import.c
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "toxic.h"
+#include "windows.h"
+#include "import.h"
+#include "dns.h"
+#include "friendlist.h"
+#include "global_commands.h"
+#include "line_info.h"
+#include "misc_tools.h"
+
+#define IMPORT_ADDR_SIZE 256    /* max length of a username@domain address */
+#define IMPORT_LINE_SIZE (MAX_STR_SIZE + IMPORT_ADDR_SIZE)
+#define MIN_IMPORT_SIZE 64
+
+extern char *DATA_FILE;
+
+enum {
+    IMPORT_LOOKUP,    /* waiting for a DNS lookup */
+    IMPORT_READY,     /* id_bin is valid and the request is queued */
+    IMPORT_DONE,
+    IMPORT_FAILED,
+} IMPORT_STATE;
+
+struct import_entry {
+    int line;
+    uint8_t state;
+    const char *errmsg;    /* static string describing why the entry failed */
+    char addr[IMPORT_ADDR_SIZE];
+    char *msg;             /* request message, or NULL to use the default message */
+    char id_bin[TOX_FRIEND_ADDRESS_SIZE];
+};
+
+/* The lookup threads and the main loop share the entries, the ready queue and the counters
+   through Import.lock. The entries array is never reallocated while an import is running */
+static struct _Import {
+    bool active;
+    ToxWindow *self;
+    struct import_entry *entries;
+    int num_entries;
+    int *ready;           /* entries waiting to be sent, in the order they became ready */
+    int ready_head;
+    int ready_tail;
+    int next_lookup;      /* index from which lookup threads search for IMPORT_LOOKUP entries */
+    int num_finished;     /* number of entries that are done or failed */
+    int added;
+    int existing;
+    int failed;
+    uint64_t start_time;
+    uint64_t rate_sec;
+    int rate_count;       /* requests sent during rate_sec */
+    char default_msg[MAX_STR_SIZE];
+    pthread_t threads[IMPORT_DNS_THREADS];
+    int num_threads;
+    pthread_mutex_t lock;
+} Import;
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+
+    c |= 0x20;
+
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+/* Converts the hex Tox ID in hex to binary and checks the address checksum.
+   Returns 0 on success, -1 with errmsg set on failure. */
+static int import_parse_id(const char *hex, char *id_bin, const char **errmsg)
+{
+    int i;
+
+    for (i = 0; i < TOX_FRIEND_ADDRESS_SIZE; ++i) {
+        int hi = hex_nibble(hex[2 * i]);
+        int lo = hex_nibble(hex[2 * i + 1]);
+
+        if (hi == -1 || lo == -1) {
+            *errmsg = "Invalid ID.";
+            return -1;
+        }
+
+        id_bin[i] = (hi << 4) | lo;
+    }
+
+    /* the last two bytes are the xor of the even and odd bytes of the key and nospam */
+    char checksum[2] = {0};
+
+    for (i = 0; i < TOX_FRIEND_ADDRESS_SIZE - 2; ++i)
+        checksum[i % 2] ^= id_bin[i];
+
+    if (memcmp(checksum, &id_bin[TOX_FRIEND_ADDRESS_SIZE - 2], 2) != 0) {
+        *errmsg = "Bad checksum in address.";
+        return -1;
+    }
+
+    return 0;
+}
+
+static void import_fail(struct import_entry *e, const char *errmsg)
+{
+    e->state = IMPORT_FAILED;
+    e->errmsg = errmsg;
+    ++Import.failed;
+    ++Import.num_finished;
+}
+
+/* Parses line number line_num into a new entry. Returns 0 if the line holds no entry,
+   1 if an entry was added, -1 on memory allocation failure. */
+static int import_parse_line(char *line, int line_num, int *size)
+{
+    line[strcspn(line, "\r\n")] = '\0';
+
+    while (isspace((unsigned char) *line))
+        ++line;
+
+    if (line[0] == '\0' || line[0] == '#')
+        return 0;
+
+    if (Import.num_entries == *size) {
+        int n = *size * 2;
+        struct import_entry *tmp = realloc(Import.entries, n * sizeof(struct import_entry));
+
+        if (tmp == NULL)
+            return -1;
+
+        Import.entries = tmp;
+        *size = n;
+    }
+
+    struct import_entry *e = &Import.entries[Import.num_entries++];
+    memset(e, 0, sizeof(struct import_entry));
+    e->line = line_num;
+
+    int addr_len = strcspn(line, " \t");
+    char *msg = line + addr_len;
+
+    while (isspace((unsigned char) *msg))
+        ++msg;
+
+    int msg_len = strlen(msg);
+
+    /* remove surrounding quotes from the message */
+    if (msg_len >= 2 && msg[0] == '\"' && msg[msg_len - 1] == '\"') {
+        msg[msg_len - 1] = '\0';
+        ++msg;
+        msg_len -= 2;
+    }
+
+    if (msg_len > 0) {
+        e->msg = strdup(msg);
+
+        if (e->msg == NULL)
+            return -1;
+    }
+
+    if (addr_len >= IMPORT_ADDR_SIZE) {
+        snprintf(e->addr, sizeof(e->addr), "%.*s", 16, line);
+        import_fail(e, "Address is too long.");
+        return 1;
+    }
+
+    memcpy(e->addr, line, addr_len);
+    e->addr[addr_len] = '\0';
+
+    if (addr_len == 2 * TOX_FRIEND_ADDRESS_SIZE) {
+        const char *errmsg;
+
+        if (import_parse_id(e->addr, e->id_bin, &errmsg) == -1) {
+            import_fail(e, errmsg);
+        } else {
+            e->state = IMPORT_READY;
+        }
+    } else if (strchr(e->addr, '@') == NULL) {
+        import_fail(e, "Must be a Tox ID or an address in the form username@domain");
+    } else {
+        e->state = IMPORT_LOOKUP;
+    }
+
+    return 1;
+}
+
+/* resolves IMPORT_LOOKUP entries until there are none left */
+static void *import_lookup_thread(void *data)
+{
+    while (true) {
+        pthread_mutex_lock(&Import.lock);
+
+        while (Import.next_lookup < Import.num_entries && Import.entries[Import.next_lookup].state != IMPORT_LOOKUP)
+            ++Import.next_lookup;
+
+        if (Import.next_lookup == Import.num_entries) {
+            pthread_mutex_unlock(&Import.lock);
+            break;
+        }
+
+        int idx = Import.next_lookup++;
+        struct import_entry *e = &Import.entries[idx];
+        char addr[IMPORT_ADDR_SIZE];
+        memcpy(addr, e->addr, sizeof(addr));
+
+        pthread_mutex_unlock(&Import.lock);
+
+        char id_bin[TOX_FRIEND_ADDRESS_SIZE];
+        const char *errmsg = NULL;
+        int ret = dns3_resolve(addr, id_bin, &errmsg);
+
+        pthread_mutex_lock(&Import.lock);
+
+        if (ret == 0) {
+            memcpy(e->id_bin, id_bin, TOX_FRIEND_ADDRESS_SIZE);
+            e->state = IMPORT_READY;
+            Import.ready[Import.ready_tail++] = idx;
+        } else {
+            import_fail(e, errmsg);
+        }
+
+        pthread_mutex_unlock(&Import.lock);
+    }
+
+    return NULL;
+}
+
+static void import_cleanup(void)
+{
+    int i;
+
+    for (i = 0; i < Import.num_entries; ++i)
+        free(Import.entries[i].msg);
+
+    free(Import.entries);
+    free(Import.ready);
+    pthread_mutex_destroy(&Import.lock);
+    memset(&Import, 0, sizeof(Import));
+}
+
+/* reads path into Import.entries. Returns number of entries on success, -1 on failure */
+static int import_read_file(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL)
+        return -1;
+
+    int size = MIN_IMPORT_SIZE;
+    Import.entries = malloc(size * sizeof(struct import_entry));
+
+    if (Import.entries == NULL)
+        exit_toxic_err("failed in import_read_file", FATALERR_MEMORY);
+
+    char *line = malloc(IMPORT_LINE_SIZE);
+
+    if (line == NULL)
+        exit_toxic_err("failed in import_read_file", FATALERR_MEMORY);
+
+    int line_num = 0;
+
+    while (fgets(line, IMPORT_LINE_SIZE, fp)) {
+        if (import_parse_line(line, ++line_num, &size) == -1)
+            exit_toxic_err("failed in import_read_file", FATALERR_MEMORY);
+    }
+
+    free(line);
+    fclose(fp);
+
+    /* each entry is queued at most once so the ready queue needs one slot per entry */
+    Import.ready = malloc(MAX(Import.num_entries, 1) * sizeof(int));
+
+    if (Import.ready == NULL)
+        exit_toxic_err("failed in import_read_file", FATALERR_MEMORY);
+
+    int i;
+
+    for (i = 0; i < Import.num_entries; ++i) {
+        if (Import.entries[i].state == IMPORT_READY)
+            Import.ready[Import.ready_tail++] = i;
+    }
+
+    return Import.num_entries;
+}
+
+int import_start(ToxWindow *self, Tox *m, const char *path)
+{
+    if (Import.active) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "An import is already in progress.");
+        return -1;
+    }
+
+    memset(&Import, 0, sizeof(Import));
+
+    if (pthread_mutex_init(&Import.lock, NULL) != 0)
+        exit_toxic_err("failed in import_start", FATALERR_MUTEX_INIT);
+
+    if (import_read_file(path) == -1) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Failed to open import file.");
+        import_cleanup();
+        return -1;
+    }
+
+    if (Import.num_entries == 0) {
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Import file contains no entries.");
+        import_cleanup();
+        return -1;
+    }
+
+    char selfname[TOX_MAX_NAME_LENGTH];
+    uint16_t n_len = tox_get_self_name(m, (uint8_t *) selfname);
+    selfname[n_len] = '\0';
+    snprintf(Import.default_msg, sizeof(Import.default_msg), "Hello, my name is %s. Care to Tox?", selfname);
+
+    Import.active = true;
+    Import.self = self;
+    Import.start_time = get_unix_time();
+
+    int num_lookups = 0;
+    int i;
+
+    for (i = 0; i < Import.num_entries; ++i) {
+        if (Import.entries[i].state == IMPORT_LOOKUP)
+            ++num_lookups;
+    }
+
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Importing %d contacts (%d invalid, %d need a lookup)...",
+                  Import.num_entries, Import.failed, num_lookups);
+
+    int num_threads = MIN(num_lookups, IMPORT_DNS_THREADS);
+
+    for (i = 0; i < num_threads; ++i) {
+        if (pthread_create(&Import.threads[i], NULL, import_lookup_thread, NULL) != 0)
+            exit_toxic_err("failed in import_start", FATALERR_THREAD_CREATE);
+
+        ++Import.num_threads;
+    }
+
+    return 0;
+}
+
+/* sends the friend request for e. Returns true if a request was sent */
+static bool import_send(Tox *m, struct import_entry *e)
+{
+    if (get_friendnum_by_key(e->id_bin) != -1) {
+        e->state = IMPORT_DONE;
+        ++Import.existing;
+        ++Import.num_finished;
+        return false;
+    }
+
+    const char *msg = e->msg ? e->msg : Import.default_msg;
+    int32_t f_num = tox_add_friend(m, (uint8_t *) e->id_bin, (uint8_t *) msg, (uint16_t) strlen(msg));
+    const char *errmsg = get_add_friend_errmsg(f_num);
+
+    if (errmsg != NULL) {
+        import_fail(e, errmsg);
+        return true;
+    }
+
+    on_friendadded(m, f_num, true, false);
+    e->state = IMPORT_DONE;
+    ++Import.added;
+    ++Import.num_finished;
+    return true;
+}
+
+static void import_finish(Tox *m)
+{
+    int i;
+
+    for (i = 0; i < Import.num_threads; ++i)
+        pthread_join(Import.threads[i], NULL);
+
+    if (Import.added)
+        store_data(m, DATA_FILE);
+
+    ToxWindow *self = Import.self;
+    int elapsed = get_unix_time() - Import.start_time;
+
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Import finished in %ds: %d added, %d already in contacts, %d failed.",
+                  elapsed, Import.added, Import.existing, Import.failed);
+
+    int shown = 0;
+
+    for (i = 0; i < Import.num_entries && shown < IMPORT_MAX_ERRORS; ++i) {
+        struct import_entry *e = &Import.entries[i];
+
+        if (e->state != IMPORT_FAILED)
+            continue;
+
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, RED, "  line %d: %.20s%s: %s", e->line, e->addr,
+                      strlen(e->addr) > 20 ? "..." : "", e->errmsg);
+        ++shown;
+    }
+
+    if (Import.failed > shown)
+        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, RED, "  ...and %d more.", Import.failed - shown);
+
+    import_cleanup();
+}
+
+void do_import(Tox *m)
+{
+    if (!Import.active)
+        return;
+
+    uint64_t cur_time = get_unix_time();
+
+    if (cur_time != Import.rate_sec) {
+        Import.rate_sec = cur_time;
+        Import.rate_count = 0;
+    }
+
+    pthread_mutex_lock(&Import.lock);
+
+    while (Import.ready_head < Import.ready_tail && Import.rate_count < IMPORT_ADDS_PER_SEC) {
+        struct import_entry *e = &Import.entries[Import.ready[Import.ready_head++]];
+
+        if (import_send(m, e))
+            ++Import.rate_count;
+    }
+
+    bool finished = Import.num_finished == Import.num_entries;
+    pthread_mutex_unlock(&Import.lock);
+
+    if (finished)
+        import_finish(m);
+}
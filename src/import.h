@@ -0,0 +1,44 @@
+/*  import.h
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _import_h
+#define _import_h
+
+#include "toxic.h"
+#include "windows.h"
+
+#define IMPORT_DNS_THREADS 4      /* number of concurrent DNS lookups */
+#define IMPORT_ADDS_PER_SEC 10    /* max number of friend requests sent per second */
+#define IMPORT_MAX_ERRORS 20      /* max number of failed entries listed in the summary */
+
+/* Starts importing the friends listed in the file at path. Each non-empty line that doesn't begin with
+   '#' holds a Tox ID or a username@domain address, optionally followed by the request message.
+   Entries are validated immediately; addresses are resolved in the background and requests are
+   sent from the main loop by do_import(). Must be called with Winthread.lock held.
+   Returns 0 on success, -1 if the import could not be started. */
+int import_start(ToxWindow *self, Tox *m, const char *path);
+
+/* Sends queued friend requests and finishes the import when all entries are done.
+   Call once per main loop iteration with Winthread.lock held. */
+void do_import(Tox *m);
+
+#endif /* #define _import_h */
@@ -32,6 +32,9 @@
 #include "toxic_strings.h"
 #include "line_info.h"
 #include "notify.h"
+#include "settings.h"
+
+extern struct user_settings *user_settings_;
 
 /* add a char to input field and buffer */
 void input_new_char(ToxWindow *self, wint_t key, int x, int y, int mx_x, int mx_y)
@@ -57,6 +60,97 @@ void input_new_char(ToxWindow *self, wint_t key, int x, int y, int mx_x, int mx_
     }
 }
 
+/* Adds a segment of pasted text to the input line. If the line fills up it is sent and the rest of
+   the segment goes on a new line. Returns -1 if the paste can't continue */
+static int input_paste_segment(ToxWindow *self, Tox *m, const wchar_t *seg, int len, bool can_send)
+{
+    ChatContext *ctx = self->chatwin;
+    int n;
+
+    while ((n = add_str_to_buf(ctx, seg, len)) < len) {
+        /* never run a pasted command; leave it in the input line for the user */
+        if (!can_send || ctx->line[0] == '/')
+            return -1;
+
+        self->onKey(self, m, '\n', false);
+        seg += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Inserts a pasted block into the input line in one go. Newlines send the line when
+   user_settings_->paste_split_lines is set and become spaces otherwise; text that doesn't fit
+   is sent in chunks of a full input line. Only chat windows send, and a line that would run a
+   command ends the paste. Tabs become spaces and non-printable characters are dropped */
+void input_paste(ToxWindow *self, Tox *m, const wchar_t *buf, int len)
+{
+    ChatContext *ctx = self->chatwin;
+    bool can_send = self->is_chat || self->is_groupchat;
+
+    if (self->help->active)
+        return;
+
+    wchar_t seg[MAX_STR_SIZE];
+    int seg_len = 0;
+    bool stopped = false;
+    int i;
+
+    for (i = 0; i < len; ++i) {
+        wchar_t ch = buf[i];
+        bool newline = ch == L'\n' || ch == L'\r';
+
+        if (ch == L'\n' && i > 0 && buf[i - 1] == L'\r')
+            continue;
+
+        if (newline && user_settings_->paste_split_lines && can_send) {
+            if (input_paste_segment(self, m, seg, seg_len, can_send) == -1 || ctx->line[0] == '/') {
+                stopped = true;
+                break;
+            }
+
+            seg_len = 0;
+
+            if (ctx->len > 0)
+                self->onKey(self, m, '\n', false);
+
+            continue;
+        }
+
+        if (newline || ch == L'\t')
+            ch = L' ';
+        else if (wcwidth(ch) < 0)
+            continue;
+
+        seg[seg_len++] = ch;
+
+        if (seg_len == MAX_STR_SIZE) {
+            if (input_paste_segment(self, m, seg, seg_len, can_send) == -1) {
+                stopped = true;
+                break;
+            }
+
+            seg_len = 0;
+        }
+    }
+
+    if (!stopped && input_paste_segment(self, m, seg, seg_len, can_send) == -1)
+        stopped = true;
+
+    if (stopped)
+        sound_notify(self, error, 0, NULL);
+
+    /* scroll the input line so that the cursor is on screen */
+    int x2 = getmaxx(self->window);
+    int cols = 0;
+
+    for (i = ctx->pos; i > 0 && cols + wcwidth(ctx->line[i - 1]) < x2 - 1; --i)
+        cols += wcwidth(ctx->line[i - 1]);
+
+    ctx->start = MAX(ctx->start, i);
+}
+
 /* delete a char via backspace key from input field and buffer */
 static void input_backspace(ToxWindow *self, int x, int mx_x)
 {
@@ -26,6 +26,9 @@
 /* add a char to input field and buffer for given chatcontext */
 void input_new_char(ToxWindow *self, wint_t key, int x, int y, int mx_x, int mx_y);
 
+/* Inserts a bracketed paste of len chars from buf into the input line. Must be called with Winthread.lock held */
+void input_paste(ToxWindow *self, Tox *m, const wchar_t *buf, int len);
+
 /* Handles non-printable input keys that behave the same for all types of chat windows.
    return true if key matches a function, false otherwise */
 bool input_handle(ToxWindow *self, wint_t key, int x, int y, int mx_x, int mx_y);
@@ -0,0 +1,154 @@
+/*  key_index.c
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "toxic.h"
+#include "key_index.h"
+#include "misc_tools.h"
+
+#define KEY_INDEX_EMPTY   -1
+#define KEY_INDEX_DELETED -2
+#define KEY_INDEX_MIN_SIZE 64
+
+static uint32_t key_index_hash(const char *key)
+{
+    return (uint32_t) fnv1a_update(FNV1A_INIT, key, KEY_INDEX_KEY_SIZE);
+}
+
+static void key_index_insert(struct key_index *idx, uint32_t hash, const char *key, int32_t val)
+{
+    uint32_t mask = idx->size - 1;
+    uint32_t i = hash & mask;
+
+    while (idx->entries[i].val >= 0)
+        i = (i + 1) & mask;
+
+    if (idx->entries[i].val == KEY_INDEX_EMPTY)
+        ++idx->used;
+
+    idx->entries[i].hash = hash;
+    idx->entries[i].val = val;
+    memcpy(idx->entries[i].key, key, KEY_INDEX_KEY_SIZE);
+    ++idx->count;
+}
+
+/* reallocates the table with new_size slots and reinserts all live entries, dropping deleted ones */
+static void key_index_rehash(struct key_index *idx, uint32_t new_size)
+{
+    struct key_index_entry *old = idx->entries;
+    uint32_t old_size = idx->size;
+
+    idx->entries = malloc(new_size * sizeof(struct key_index_entry));
+
+    if (idx->entries == NULL)
+        exit_toxic_err("failed in key_index_rehash", FATALERR_MEMORY);
+
+    uint32_t i;
+
+    for (i = 0; i < new_size; ++i)
+        idx->entries[i].val = KEY_INDEX_EMPTY;
+
+    idx->size = new_size;
+    idx->count = 0;
+    idx->used = 0;
+
+    for (i = 0; i < old_size; ++i) {
+        if (old[i].val >= 0)
+            key_index_insert(idx, old[i].hash, old[i].key, old[i].val);
+    }
+
+    free(old);
+}
+
+void key_index_add(struct key_index *idx, const char *key, int32_t val)
+{
+    /* keep the load factor (including deleted slots) below 3/4 */
+    if ((idx->used + 1) * 4 > idx->size * 3) {
+        uint32_t new_size = idx->size ? idx->size : KEY_INDEX_MIN_SIZE;
+
+        while ((idx->count + 1) * 2 > new_size)
+            new_size *= 2;
+
+        key_index_rehash(idx, new_size);
+    }
+
+    key_index_insert(idx, key_index_hash(key), key, val);
+}
+
+/* returns the slot holding key -> val, or the first slot holding key if val is negative. -1 if not found */
+static int64_t key_index_find(const struct key_index *idx, const char *key, int32_t val)
+{
+    if (idx->size == 0)
+        return -1;
+
+    uint32_t hash = key_index_hash(key);
+    uint32_t mask = idx->size - 1;
+    uint32_t i = hash & mask;
+
+    while (idx->entries[i].val != KEY_INDEX_EMPTY) {
+        struct key_index_entry *e = &idx->entries[i];
+
+        if (e->val >= 0 && e->hash == hash && (val < 0 || e->val == val)
+                && memcmp(e->key, key, KEY_INDEX_KEY_SIZE) == 0)
+            return i;
+
+        i = (i + 1) & mask;
+    }
+
+    return -1;
+}
+
+void key_index_del(struct key_index *idx, const char *key, int32_t val)
+{
+    int64_t i = key_index_find(idx, key, val);
+
+    if (i == -1)
+        return;
+
+    idx->entries[i].val = KEY_INDEX_DELETED;
+    --idx->count;
+}
+
+int32_t key_index_get(const struct key_index *idx, const char *key)
+{
+    int64_t i = key_index_find(idx, key, -1);
+    return i == -1 ? -1 : idx->entries[i].val;
+}
+
+void key_index_clear(struct key_index *idx)
+{
+    free(idx->entries);
+    memset(idx, 0, sizeof(struct key_index));
+}
+
+void key_index_nick_key(char *buf, const char *nick)
+{
+    memset(buf, 0, KEY_INDEX_KEY_SIZE);
+
+    int i;
+
+    for (i = 0; i < KEY_INDEX_KEY_SIZE - 1 && nick[i]; ++i)
+        buf[i] = tolower((unsigned char) nick[i]);
+}
@@ -0,0 +1,61 @@
+/*  key_index.h
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _key_index_h
+#define _key_index_h
+
+#include <stdint.h>
+
+#define KEY_INDEX_KEY_SIZE 32    /* fits a public key or a null terminated toxic nick */
+
+struct key_index_entry {
+    uint32_t hash;
+    int32_t val;    /* KEY_INDEX_EMPTY or KEY_INDEX_DELETED if the slot is unused */
+    char key[KEY_INDEX_KEY_SIZE];
+};
+
+/* Open-addressing (linear probing) hash table mapping fixed size keys to integers.
+   Duplicate keys are allowed, in which case lookups return one of the values. */
+struct key_index {
+    struct key_index_entry *entries;
+    uint32_t size;     /* number of slots; always 0 or a power of 2 */
+    uint32_t count;    /* number of live entries */
+    uint32_t used;     /* number of live and deleted entries */
+};
+
+/* Adds key -> val to idx. key must be KEY_INDEX_KEY_SIZE bytes. val must be >= 0 */
+void key_index_add(struct key_index *idx, const char *key, int32_t val);
+
+/* Removes the entry key -> val from idx if it exists */
+void key_index_del(struct key_index *idx, const char *key, int32_t val);
+
+/* Returns the value associated with key, or -1 if key is not in idx */
+int32_t key_index_get(const struct key_index *idx, const char *key);
+
+/* Removes all entries and frees memory */
+void key_index_clear(struct key_index *idx);
+
+/* Puts a null padded KEY_INDEX_KEY_SIZE byte lookup key for nick in buf.
+   The key is case insensitive so that lookups by nick match regardless of case */
+void key_index_nick_key(char *buf, const char *nick);
+
+#endif /* #define _key_index_h */
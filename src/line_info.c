@@ -46,8 +46,26 @@ void line_info_init(struct history *hst)
     hst->queue_sz = 0;
 }
 
+/* gets the size of self's window. Windows that haven't been focused yet
+   have no curses window so the size they will have is used instead */
+static void line_info_get_dims(ToxWindow *self, int *y2, int *x2)
+{
+    if (self->window) {
+        getmaxyx(self->window, *y2, *x2);
+    } else {
+        getmaxyx(stdscr, *y2, *x2);
+        *y2 -= 2;
+    }
+}
+
+/* returns the number of rows line takes up in a history window width columns wide */
+static int line_info_rows(struct line_info *line, int width)
+{
+    return 1 + line->newlines + (line->len / width);
+}
+
 /* resets line_start (page end) */
-static void line_info_reset_start(ToxWindow *self, struct history *hst)
+void line_info_reset_start(ToxWindow *self, struct history *hst)
 {
     struct line_info *line = hst->line_end;
 
@@ -55,7 +73,7 @@ static void line_info_reset_start(ToxWindow *self, struct history *hst)
         return;
 
     int y2, x2;
-    getmaxyx(self->window, y2, x2);
+    line_info_get_dims(self, &y2, &x2);
 
     int side_offst = self->is_groupchat ? SIDEBAR_WIDTH : 0;
     int top_offst = self->is_chat || self->is_prompt ? 2 : 0;
@@ -89,6 +107,8 @@ void line_info_cleanup(struct history *hst)
         if (hst->queue[i])
             free(hst->queue[i]);
     }
+
+    memset(hst->index, 0, sizeof(hst->index));
 }
 
 /* moves root forward and frees previous root */
@@ -103,17 +123,26 @@ static void line_info_root_fwd(struct history *hst)
         ++hst->start_id;
     }
 
+    if (hst->index[hst->line_root->id % LINE_INDEX_SIZE] == hst->line_root)
+        hst->index[hst->line_root->id % LINE_INDEX_SIZE] = NULL;
+
     free(hst->line_root);
     hst->line_root = tmp;
 }
 
-/* adds a line_info line to queue */
-static void line_info_add_queue(struct history *hst, struct line_info *line)
+/* adds a line_info line to queue and gives it the id it will have once it's moved into the
+   history. Returns -1 and frees line if the queue is full */
+static int line_info_add_queue(struct history *hst, struct line_info *line)
 {
-    if (hst->queue_sz >= MAX_QUEUE)
-        return;
+    if (hst->queue_sz >= MAX_QUEUE) {
+        free(line);
+        return -1;
+    }
 
+    line->id = hst->line_end->id + hst->queue_sz + 1;
     hst->queue[hst->queue_sz++] = line;
+    hst->index[line->id % LINE_INDEX_SIZE] = line;
+    return line->id;
 }
 
 /* returns ptr to queue item 0 and removes it from queue */
@@ -134,23 +163,14 @@ static struct line_info *line_info_ret_queue(struct history *hst)
     return ret;
 }
 
-/* creates new line_info line and puts it in the queue. 
-   SYS_MSG lines may contain an arbitrary number of arguments for string formatting */
-void line_info_add(ToxWindow *self, char *tmstmp, char *name1, char *name2, uint8_t type, uint8_t bold, 
-                   uint8_t colour, const char *msg, ...)
+/* allocates a new line_info line and fills in its fields */
+static struct line_info *line_info_new(const char *tmstmp, const char *name1, const char *name2, uint8_t type,
+                                       uint8_t bold, uint8_t colour, const char *msg)
 {
-    struct history *hst = self->chatwin->hst;
     struct line_info *new_line = calloc(1, sizeof(struct line_info));
 
     if (new_line == NULL)
-        exit_toxic_err("failed in line_info_add", FATALERR_MEMORY);
-
-    char frmt_msg[MAX_STR_SIZE] = {0};
-
-    va_list args;
-    va_start(args, msg);
-    vsnprintf(frmt_msg, sizeof(frmt_msg), msg, args);
-    va_end(args);
+        exit_toxic_err("failed in line_info_new", FATALERR_MEMORY);
 
     int len = 1;     /* there will always be a newline */
 
@@ -173,14 +193,14 @@ void line_info_add(ToxWindow *self, char *tmstmp, char *name1, char *name2, uint
             break;
     }
 
-    if (frmt_msg[0]) {
-        snprintf(new_line->msg, sizeof(new_line->msg), "%s", frmt_msg);
+    if (msg[0]) {
+        snprintf(new_line->msg, sizeof(new_line->msg), "%s", msg);
         len += strlen(new_line->msg);
 
         int i;
 
-        for (i = 0; frmt_msg[i]; ++i) {
-            if (frmt_msg[i] == '\n')
+        for (i = 0; msg[i]; ++i) {
+            if (msg[i] == '\n')
                 ++new_line->newlines;
         }
     }
@@ -205,18 +225,29 @@ void line_info_add(ToxWindow *self, char *tmstmp, char *name1, char *name2, uint
     new_line->bold = bold;
     new_line->colour = colour;
 
-    line_info_add_queue(hst, new_line);
+    return new_line;
 }
 
-/* adds a single queue item to hst if possible. only called once per call to line_info_print() */
-static void line_info_check_queue(ToxWindow *self) 
+/* creates new line_info line and puts it in the queue. 
+   SYS_MSG lines may contain an arbitrary number of arguments for string formatting */
+int line_info_add(ToxWindow *self, char *tmstmp, char *name1, char *name2, uint8_t type, uint8_t bold, 
+                   uint8_t colour, const char *msg, ...)
 {
     struct history *hst = self->chatwin->hst;
-    struct line_info *line = line_info_ret_queue(hst);
+    char frmt_msg[MAX_STR_SIZE] = {0};
 
-    if (line == NULL)
-        return;
+    va_list args;
+    va_start(args, msg);
+    vsnprintf(frmt_msg, sizeof(frmt_msg), msg, args);
+    va_end(args);
 
+    struct line_info *new_line = line_info_new(tmstmp, name1, name2, type, bold, colour, frmt_msg);
+    return line_info_add_queue(hst, new_line);
+}
+
+/* appends a line to the end of hst directly, bypassing the queue */
+static void line_info_append(struct history *hst, struct line_info *line)
+{
     if (hst->start_id > user_settings_->history_size)
         line_info_root_fwd(hst);
 
@@ -224,6 +255,28 @@ static void line_info_check_queue(ToxWindow *self)
     line->prev = hst->line_end;
     hst->line_end->next = line;
     hst->line_end = line;
+}
+
+/* appends a previously saved line to hst without going through the queue. */
+void line_info_restore(struct history *hst, const char *tmstmp, const char *name1, const char *name2, uint8_t type,
+                       uint8_t bold, uint8_t colour, const char *msg)
+{
+    struct line_info *line = line_info_new(tmstmp, name1, name2, type, bold, colour, msg);
+
+    line_info_append(hst, line);
+    hst->index[line->id % LINE_INDEX_SIZE] = line;
+}
+
+/* adds a single queue item to hst if possible. only called once per call to line_info_print() */
+static void line_info_check_queue(ToxWindow *self) 
+{
+    struct history *hst = self->chatwin->hst;
+    struct line_info *line = line_info_ret_queue(hst);
+
+    if (line == NULL)
+        return;
+
+    line_info_append(hst, line);
 
     int y, y2, x, x2;
     getmaxyx(self->window, y2, x2);
@@ -247,6 +300,20 @@ static void line_info_check_queue(ToxWindow *self)
     }
 }
 
+/* marks outgoing messages that haven't been delivered yet: red while they're queued,
+   yellow while we wait for the read receipt */
+static void line_info_print_state(WINDOW *win, struct line_info *line)
+{
+    if (line->state == MSG_STATE_DONE)
+        return;
+
+    int colour = line->state == MSG_STATE_QUEUED ? RED : YELLOW;
+
+    wattron(win, COLOR_PAIR(colour));
+    wprintw(win, " x");
+    wattroff(win, COLOR_PAIR(colour));
+}
+
 void line_info_print(ToxWindow *self)
 {
     ChatContext *ctx = self->chatwin;
@@ -299,11 +366,13 @@ void line_info_print(ToxWindow *self)
                 if (line->msg[0] == '>')
                     wattron(win, COLOR_PAIR(GREEN));
 
-                wprintw(win, "%s\n", line->msg);
+                wprintw(win, "%s", line->msg);
 
                 if (line->msg[0] == '>')
                     wattroff(win, COLOR_PAIR(GREEN));
 
+                line_info_print_state(win, line);
+                wprintw(win, "\n");
                 break;
 
             case ACTION:
@@ -312,9 +381,11 @@ void line_info_print(ToxWindow *self)
                 wattroff(win, COLOR_PAIR(BLUE));
 
                 wattron(win, COLOR_PAIR(YELLOW));
-                wprintw(win, "* %s %s\n", line->name1, line->msg);
+                wprintw(win, "* %s %s", line->name1, line->msg);
                 wattroff(win, COLOR_PAIR(YELLOW));
 
+                line_info_print_state(win, line);
+                wprintw(win, "\n");
                 break;
 
             case SYS_MSG:
@@ -393,18 +464,77 @@ void line_info_print(ToxWindow *self)
         line_info_print(self);
 }
 
-void line_info_set(ToxWindow *self, uint32_t id, char *msg)
+/* Moves all queued lines into the history of a window that isn't being drawn and moves line_start
+   forward so the newest lines fit on the screen. Nothing is formatted or painted; only the rows of
+   the lines after line_start are counted, and at most a screen's worth of them */
+void line_info_flush(ToxWindow *self)
 {
-    struct line_info *line = self->chatwin->hst->line_end;
+    struct history *hst = self->chatwin->hst;
+
+    if (hst->queue_sz == 0)
+        return;
+
+    int y2, x2;
+    line_info_get_dims(self, &y2, &x2);
+
+    int width = x2 - (self->is_groupchat ? SIDEBAR_WIDTH : 0);
+    int max_y = y2 - CHATBOX_HEIGHT - (self->is_groupchat ? 0 : 2);
 
-    while (line) {
-        if (line->id == id) {
-            snprintf(line->msg, sizeof(line->msg), "%s", msg);
-            return;
+    if (width <= 0)
+        width = 1;
+
+    int rows = 0;
+    struct line_info *line;
+
+    for (line = hst->line_end; line != hst->line_start && rows <= max_y; line = line->prev)
+        rows += line_info_rows(line, width);
+
+    while ((line = line_info_ret_queue(hst)) != NULL) {
+        line_info_append(hst, line);
+        rows += line_info_rows(line, width);
+
+        while (rows > max_y && hst->line_start->next != hst->line_end) {
+            hst->line_start = hst->line_start->next;
+            rows -= line_info_rows(hst->line_start, width);
+            ++hst->start_id;
         }
+    }
+}
+
+/* returns the line with id, or NULL if it's gone. Recent lines are found through the index */
+static struct line_info *line_info_get(struct history *hst, uint32_t id)
+{
+    struct line_info *line = hst->index[id % LINE_INDEX_SIZE];
+
+    if (line && line->id == id)
+        return line;
+
+    line = hst->line_end;
+
+    while (line && line->id >= id) {
+        if (line->id == id)
+            return line;
 
         line = line->prev;
     }
+
+    return NULL;
+}
+
+void line_info_set(ToxWindow *self, uint32_t id, char *msg)
+{
+    struct line_info *line = line_info_get(self->chatwin->hst, id);
+
+    if (line)
+        snprintf(line->msg, sizeof(line->msg), "%s", msg);
+}
+
+void line_info_set_state(ToxWindow *self, uint32_t id, uint8_t state)
+{
+    struct line_info *line = line_info_get(self->chatwin->hst, id);
+
+    if (line)
+        line->state = state;
 }
 
 /* static void line_info_goto_root(struct history *hst)
@@ -29,6 +29,7 @@
 #define MAX_HISTORY 100000
 #define MIN_HISTORY 40
 #define MAX_QUEUE 128
+#define LINE_INDEX_SIZE 512    /* number of recent lines that can be looked up by id in O(1) */
 
 enum {
     SYS_MSG,
@@ -40,6 +41,13 @@ enum {
     NAME_CHANGE,
 } LINE_TYPE;
 
+/* delivery state of OUT_MSG and ACTION lines */
+enum {
+    MSG_STATE_DONE,
+    MSG_STATE_QUEUED,    /* waiting in the chat's outbound queue */
+    MSG_STATE_SENT,    /* handed to the core; waiting for a read receipt */
+} MSG_STATE;
+
 struct line_info {
     char timestamp[TIME_STR_SIZE];
     char name1[TOXIC_MAX_NAME_LENGTH];
@@ -48,6 +56,7 @@ struct line_info {
     uint8_t type;
     uint8_t bold;
     uint8_t colour;
+    uint8_t state;    /* MSG_STATE_* */
     uint32_t id;
     uint16_t len;   /* combined len of all strings */
     uint8_t newlines;
@@ -65,16 +74,31 @@ struct history {
 
     struct line_info *queue[MAX_QUEUE];
     int queue_sz;
+
+    struct line_info *index[LINE_INDEX_SIZE];    /* queued and history lines by id % LINE_INDEX_SIZE */
 };
 
 /* creates new line_info line and puts it in the queue. 
-   SYS_MSG lines may contain an arbitrary number of arguments for string formatting */
-void line_info_add(ToxWindow *self, char *tmstmp, char *name1, char *name2, uint8_t type, uint8_t bold, 
+   SYS_MSG lines may contain an arbitrary number of arguments for string formatting.
+   Returns the id the line will have in the history, or -1 if the queue is full */
+int line_info_add(ToxWindow *self, char *tmstmp, char *name1, char *name2, uint8_t type, uint8_t bold, 
                    uint8_t colour, const char *msg, ...);
 
+/* appends a previously saved line to hst without going through the queue.
+   call line_info_reset_start() after the last line to show the end of history */
+void line_info_restore(struct history *hst, const char *tmstmp, const char *name1, const char *name2, uint8_t type,
+                       uint8_t bold, uint8_t colour, const char *msg);
+
+/* resets line_start (page end) */
+void line_info_reset_start(ToxWindow *self, struct history *hst);
+
 /* Prints a section of history starting at line_start */
 void line_info_print(ToxWindow *self);
 
+/* moves all queued lines into the history of a window that isn't being drawn, keeping
+   line_start in sync without formatting or painting anything */
+void line_info_flush(ToxWindow *self);
+
 /* frees all history lines */
 void line_info_cleanup(struct history *hst);
 
@@ -84,6 +108,9 @@ void line_info_clear(struct history *hst);
 /* puts msg in specified line_info msg buffer */
 void line_info_set(ToxWindow *self, uint32_t id, char *msg);
 
+/* sets the MSG_STATE of the line with id */
+void line_info_set_state(ToxWindow *self, uint32_t id, uint8_t state);
+
 void line_info_init(struct history *hst);
 bool line_info_onKey(ToxWindow *self, wint_t key);    /* returns true if key is a match */
 
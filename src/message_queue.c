@@ -0,0 +1,254 @@
+/*  message_queue.c
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "toxic.h"
+#include "windows.h"
+#include "message_queue.h"
+#include "line_info.h"
+#include "misc_tools.h"
+#include "log.h"
+#include "friendlist.h"
+
+/* returns the length of the first chunk of msg. A chunk is at most CQUEUE_CHUNK_SIZE bytes and
+   ends after the last space in its second half if there is one, otherwise at the last UTF-8
+   character boundary */
+static size_t cqueue_chunk_len(const char *msg, size_t len)
+{
+    if (len <= CQUEUE_CHUNK_SIZE)
+        return len;
+
+    size_t i;
+
+    for (i = CQUEUE_CHUNK_SIZE; i > CQUEUE_CHUNK_SIZE / 2; --i) {
+        if (msg[i - 1] == ' ')
+            return i;
+    }
+
+    /* don't split a multibyte character; msg[i] is the first byte of the next chunk */
+    for (i = CQUEUE_CHUNK_SIZE; i > 0; --i) {
+        if ((msg[i] & 0xC0) != 0x80)
+            return i;
+    }
+
+    return CQUEUE_CHUNK_SIZE;    /* not UTF-8 */
+}
+
+void cqueue_add(ToxWindow *self, Tox *m, const char *msg, uint8_t type)
+{
+    struct chat_queue *q = self->chatwin->cqueue;
+
+    char selfname[TOX_MAX_NAME_LENGTH];
+    uint16_t n_len = tox_get_self_name(m, (uint8_t *) selfname);
+    selfname[n_len] = '\0';
+
+    char timefrmt[TIME_STR_SIZE];
+    get_time_str(timefrmt, sizeof(timefrmt));
+
+    size_t len = strlen(msg);
+
+    while (len > 0) {
+        size_t n = cqueue_chunk_len(msg, len);
+        struct cqueue_msg *new_m = calloc(1, sizeof(struct cqueue_msg));
+
+        if (new_m == NULL)
+            exit_toxic_err("failed in cqueue_add", FATALERR_MEMORY);
+
+        memcpy(new_m->message, msg, n);
+        new_m->len = n;
+        msg += n;
+        len -= n;
+
+        while (new_m->len > 0 && new_m->message[new_m->len - 1] == ' ')
+            new_m->message[--new_m->len] = '\0';
+
+        if (new_m->len == 0) {
+            free(new_m);
+            continue;
+        }
+
+        new_m->type = type;
+        new_m->line_id = line_info_add(self, timefrmt, selfname, NULL, type, 0, 0, "%s", new_m->message);
+
+        if (new_m->line_id != -1)
+            line_info_set_state(self, new_m->line_id, MSG_STATE_QUEUED);
+
+        if (q->end)
+            q->end->next = new_m;
+        else
+            q->root = new_m;
+
+        q->end = new_m;
+        ++q->num_msgs;
+    }
+}
+
+static void cqueue_remove_root(struct chat_queue *q)
+{
+    struct cqueue_msg *msg = q->root;
+
+    q->root = msg->next;
+
+    if (q->root == NULL)
+        q->end = NULL;
+
+    --q->num_msgs;
+    free(msg);
+}
+
+void cqueue_try_send(ToxWindow *self, Tox *m)
+{
+    ChatContext *ctx = self->chatwin;
+    struct chat_queue *q = ctx->cqueue;
+
+    if (q->root == NULL || !self->stb->is_online)
+        return;
+
+    char selfname[TOX_MAX_NAME_LENGTH];
+    uint16_t n_len = tox_get_self_name(m, (uint8_t *) selfname);
+    selfname[n_len] = '\0';
+
+    uint64_t curtime = get_time_ms();
+    int i;
+
+    /* the queue is sent in order, so a chunk that is waiting to be retried holds up the rest */
+    for (i = 0; i < CQUEUE_SENDS_PER_TICK && q->root; ++i) {
+        struct cqueue_msg *msg = q->root;
+
+        if (msg->last_send_try != 0 && curtime - msg->last_send_try < CQUEUE_RETRY_INTERVAL)
+            return;
+
+        uint32_t id;
+
+        if (msg->type == ACTION)
+            id = tox_send_action(m, self->num, (uint8_t *) msg->message, msg->len);
+        else
+            id = tox_send_message(m, self->num, (uint8_t *) msg->message, msg->len);
+
+        if (id == 0) {
+            msg->last_send_try = curtime;
+            return;
+        }
+
+        struct cqueue_receipt *r = &q->receipts[id % CQUEUE_RECEIPT_RING];
+
+        /* an older message still in the slot is given up on; its line keeps the unread marker */
+        if (r->receipt == 0)
+            ++q->num_unread;
+
+        r->receipt = id;
+        r->line_id = msg->line_id;
+        r->sent = curtime;
+
+        if (msg->line_id != -1)
+            line_info_set_state(self, msg->line_id, MSG_STATE_SENT);
+
+        write_to_log(msg->message, selfname, ctx->log, msg->type == ACTION);
+        cqueue_remove_root(q);
+    }
+}
+
+void cqueue_receipt(ToxWindow *self, uint32_t receipt)
+{
+    struct chat_queue *q = self->chatwin->cqueue;
+    struct cqueue_receipt *r = &q->receipts[receipt % CQUEUE_RECEIPT_RING];
+
+    if (receipt == 0 || r->receipt != receipt)
+        return;
+
+    latency_hist_add(get_friend_latency(self->num), get_time_ms() - r->sent);
+
+    if (r->line_id != -1)
+        line_info_set_state(self, r->line_id, MSG_STATE_DONE);
+
+    r->receipt = 0;
+    --q->num_unread;
+}
+
+static int latency_bucket(uint64_t ms)
+{
+    if (ms < 4)
+        return ms;
+
+    int e = 2;
+
+    while (ms >> (e + 1))
+        ++e;
+
+    return MIN(4 * (e - 1) + ((ms >> (e - 2)) & 3), LATENCY_BUCKETS - 1);
+}
+
+/* returns the largest latency that goes in bucket idx */
+static uint64_t latency_bucket_max(int idx)
+{
+    if (idx < 4)
+        return idx;
+
+    int e = idx / 4 + 1;
+    return ((uint64_t) (4 + idx % 4 + 1) << (e - 2)) - 1;
+}
+
+void latency_hist_add(struct latency_hist *h, uint64_t ms)
+{
+    ++h->buckets[latency_bucket(ms)];
+    ++h->count;
+    h->max = MAX(h->max, ms);
+}
+
+uint64_t latency_hist_percentile(const struct latency_hist *h, int pct)
+{
+    if (h->count == 0)
+        return 0;
+
+    uint64_t rank = ((uint64_t) h->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += h->buckets[i];
+
+        if (seen >= rank)
+            break;
+    }
+
+    return MIN(latency_bucket_max(i), h->max);
+}
+
+void cqueue_cleanup(struct chat_queue *q)
+{
+    while (q->root)
+        cqueue_remove_root(q);
+}
+
+void do_chat_queues(Tox *m)
+{
+    int i;
+
+    for (i = 0; i < get_num_active_windows(); ++i) {
+        ToxWindow *w = get_open_window(i);
+
+        if (w->is_chat)
+            cqueue_try_send(w, m);
+    }
+}
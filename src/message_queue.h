@@ -0,0 +1,93 @@
+/*  message_queue.h
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _message_queue_h
+#define _message_queue_h
+
+#include "toxic.h"
+#include "windows.h"
+
+/* one byte less than the core accepts so a chunk always fits in a history line */
+#define CQUEUE_CHUNK_SIZE (TOX_MAX_MESSAGE_LENGTH - 1)
+#define CQUEUE_SENDS_PER_TICK 4    /* max chunks handed to the core per chat per call to do_chat_queues() */
+#define CQUEUE_RETRY_INTERVAL 500    /* ms to wait before retrying a chunk the core refused */
+#define CQUEUE_RECEIPT_RING 256    /* max sent messages per chat whose read receipt is tracked */
+#define LATENCY_BUCKETS 80    /* buckets of struct latency_hist; the last one holds everything over ~20 min */
+
+struct cqueue_msg {
+    char message[CQUEUE_CHUNK_SIZE + 1];
+    uint16_t len;
+    uint8_t type;    /* OUT_MSG or ACTION */
+    int line_id;
+    uint64_t last_send_try;    /* ms; 0 if the chunk hasn't been tried yet */
+    struct cqueue_msg *next;
+};
+
+/* a sent message waiting for its read receipt */
+struct cqueue_receipt {
+    uint32_t receipt;    /* message id returned by the core; 0 if the slot is free */
+    int line_id;
+    uint64_t sent;    /* ms */
+};
+
+/* Outbound messages of a chat window, sent in order by do_chat_queues(). Sent messages are
+   tracked in receipts, indexed by message id % CQUEUE_RECEIPT_RING, until their read receipt arrives */
+struct chat_queue {
+    struct cqueue_msg *root;
+    struct cqueue_msg *end;
+    int num_msgs;
+
+    struct cqueue_receipt receipts[CQUEUE_RECEIPT_RING];
+    int num_unread;
+};
+
+/* Histogram of a friend's message delivery latencies in ms. Values below 4 get a bucket each;
+   above that every power of two is split into 4 buckets, so a bucket is at most 25% wide */
+struct latency_hist {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+    uint64_t max;
+};
+
+/* Splits msg into chunks on word and UTF-8 boundaries, adds a history line for each and
+   queues them to be sent. type is OUT_MSG or ACTION */
+void cqueue_add(ToxWindow *self, Tox *m, const char *msg, uint8_t type);
+
+/* hands up to CQUEUE_SENDS_PER_TICK queued chunks of self to the core */
+void cqueue_try_send(ToxWindow *self, Tox *m);
+
+/* marks the message with receipt in self's history as delivered and records its latency */
+void cqueue_receipt(ToxWindow *self, uint32_t receipt);
+
+/* adds a latency of ms to h */
+void latency_hist_add(struct latency_hist *h, uint64_t ms);
+
+/* returns the pct'th percentile of the latencies in h, rounded up to the end of its bucket */
+uint64_t latency_hist_percentile(const struct latency_hist *h, int pct);
+
+/* frees all queued messages */
+void cqueue_cleanup(struct chat_queue *q);
+
+/* sends the queued messages of all chat windows. Must be called with Winthread.lock held */
+void do_chat_queues(Tox *m);
+
+#endif /* #define _message_queue_h */
@@ -52,6 +52,17 @@ void host_to_net(uint8_t *num, uint16_t numbytes)
     return;
 }
 
+uint64_t fnv1a_update(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
 void update_unix_time(void)
 {
     current_unix_time = (uint64_t) time(NULL);
@@ -62,6 +73,14 @@ uint64_t get_unix_time(void)
     return current_unix_time;
 }
 
+/* returns the time in milliseconds from a monotonic clock */
+uint64_t get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /* Returns 1 if connection has timed out, 0 otherwise */
 int timed_out(uint64_t timestamp, uint64_t curtime, uint64_t timeout)
 {
@@ -39,12 +39,20 @@
 
 void host_to_net(uint8_t *num, uint16_t numbytes);
 
+#define FNV1A_INIT 14695981039346656037ULL
+
+/* folds len bytes of data into the 64-bit FNV-1a hash; a new hash starts from FNV1A_INIT */
+uint64_t fnv1a_update(uint64_t hash, const void *data, size_t len);
+
 /* convert a hex string to binary */
 char *hex_string_to_bin(const char *hex_string);
 
 /* get the current unix time */
 uint64_t get_unix_time(void);
 
+/* returns the time in milliseconds from a monotonic clock */
+uint64_t get_time_ms(void);
+
 /*Puts the current time in buf in the format of [HH:mm:ss] */
 void get_time_str(char *buf, int bufsize);
 
@@ -41,9 +41,11 @@
 #include "help.h"
 #include "notify.h"
 #include "autocomplete.h"
+#include "friendlist.h"
+#include "key_index.h"
 
-char pending_frnd_requests[MAX_FRIENDS_NUM][TOX_CLIENT_ID_SIZE];
-uint16_t num_frnd_requests = 0;
+struct _FriendRequests FrndRequests = { .tokens = FRIEND_REQUEST_BURST };
+static struct key_index frnd_request_keys;    /* public key -> pending request number */
 extern ToxWindow *prompt;
 struct _Winthread Winthread;
 
@@ -56,14 +58,19 @@ const char glob_cmd_list[AC_NUM_GLOB_COMMANDS][MAX_CMDNAME_SIZE] = {
     { "/clear"      },
     { "/close"      },    /* rm /close when groupchats gets its own list */
     { "/connect"    },
+    { "/decline"    },
     { "/exit"       },
     { "/groupchat"  },
     { "/help"       },
+    { "/import"     },
     { "/log"        },
     { "/myid"       },
+    { "/netstats"   },
     { "/nick"       },
     { "/note"       },
     { "/quit"       },
+    { "/ratelimit"  },
+    { "/requests"   },
     { "/status"     },
 
 #ifdef _AUDIO
@@ -125,27 +132,108 @@ void prompt_update_connectionstatus(ToxWindow *prompt, bool is_connected)
     statusbar->is_online = is_connected;
 }
 
-/* Adds friend request to pending friend requests.
-   Returns request number on success, -1 if queue is full or other error. */
-static int add_friend_request(const char *public_key)
+void del_friend_request(int req)
 {
-    if (num_frnd_requests >= MAX_FRIENDS_NUM)
-        return -1;
+    struct friend_request *fr = &FrndRequests.request[req];
+
+    if (!fr->active)
+        return;
+
+    key_index_del(&frnd_request_keys, fr->key, req);
+    fr->active = false;
+    --FrndRequests.num_requests;
 
     int i;
 
-    for (i = 0; i <= num_frnd_requests; ++i) {
-        if (!strlen(pending_frnd_requests[i])) {
-            memcpy(pending_frnd_requests[i], public_key, TOX_CLIENT_ID_SIZE);
+    for (i = FrndRequests.max_index; i > 0; --i) {
+        if (FrndRequests.request[i - 1].active)
+            break;
+    }
+
+    FrndRequests.max_index = i;
+}
 
-            if (i == num_frnd_requests)
-                ++num_frnd_requests;
+/* returns the index of a free request slot, evicting the oldest request if the queue is full */
+static int get_friend_request_slot(void)
+{
+    int i;
 
-            return i;
+    if (FrndRequests.num_requests < MAX_FRIEND_REQUESTS) {
+        for (i = 0; i < MAX_FRIEND_REQUESTS; ++i) {
+            if (!FrndRequests.request[i].active)
+                return i;
         }
     }
 
-    return -1;
+    int oldest = 0;
+
+    for (i = 1; i < MAX_FRIEND_REQUESTS; ++i) {
+        if (FrndRequests.request[i].seq - FrndRequests.seq < FrndRequests.request[oldest].seq - FrndRequests.seq)
+            oldest = i;
+    }
+
+    del_friend_request(oldest);
+    ++FrndRequests.evicted;
+    return oldest;
+}
+
+/* Adds friend request to pending friend requests, evicting the oldest request if the queue is full.
+   Returns request number. */
+static int add_friend_request(const char *public_key, const char *data, uint16_t length)
+{
+    int req = get_friend_request_slot();
+    struct friend_request *fr = &FrndRequests.request[req];
+
+    fr->active = true;
+    fr->seq = FrndRequests.seq++;
+    fr->timestamp = get_unix_time();
+    memcpy(fr->key, public_key, TOX_CLIENT_ID_SIZE);
+
+    length = MIN(length, sizeof(fr->msg) - 1);
+    memcpy(fr->msg, data, length);
+    fr->msg[length] = '\0';
+
+    key_index_add(&frnd_request_keys, public_key, req);
+    ++FrndRequests.num_requests;
+
+    if (req >= FrndRequests.max_index)
+        FrndRequests.max_index = req + 1;
+
+    return req;
+}
+
+/* Takes a token from the friend request notification bucket.
+   Returns true if the request may be announced. */
+static bool friend_request_take_token(void)
+{
+    uint64_t cur_time = get_unix_time();
+    uint64_t elapsed = cur_time - FrndRequests.last_refill;
+
+    if (elapsed >= FRIEND_REQUEST_NOTIFY_INTERVAL) {
+        uint64_t n = elapsed / FRIEND_REQUEST_NOTIFY_INTERVAL;
+        FrndRequests.tokens = MIN(FrndRequests.tokens + n, FRIEND_REQUEST_BURST);
+        FrndRequests.last_refill += n * FRIEND_REQUEST_NOTIFY_INTERVAL;
+    }
+
+    if (FrndRequests.tokens == FRIEND_REQUEST_BURST)
+        FrndRequests.last_refill = cur_time;
+
+    if (FrndRequests.tokens <= 0)
+        return false;
+
+    --FrndRequests.tokens;
+    return true;
+}
+
+void do_friend_requests(ToxWindow *self)
+{
+    if (FrndRequests.suppressed == 0 || !friend_request_take_token())
+        return;
+
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "%d more friend request%s received. Type \"/requests\" to list them.",
+                  FrndRequests.suppressed, FrndRequests.suppressed == 1 ? " was" : "s were");
+    sound_notify(self, generic_message, NT_WNDALERT_1 | NT_NOTIFWND, NULL);
+    FrndRequests.suppressed = 0;
 }
 
 static void prompt_onKey(ToxWindow *self, Tox *m, wint_t key, bool ltr)
@@ -289,7 +377,7 @@ static void prompt_onDraw(ToxWindow *self, Tox *m)
 
 static void prompt_onConnectionChange(ToxWindow *self, Tox *m, int32_t friendnum , uint8_t status)
 {
-    if (friendnum < 0)
+    if (friendnum < 0 || friend_events_summarized())
         return;
 
     ChatContext *ctx = self->chatwin;
@@ -329,36 +417,79 @@ static void prompt_onConnectionChange(ToxWindow *self, Tox *m, int32_t friendnum
     }
 }
 
-static void prompt_onFriendRequest(ToxWindow *self, Tox *m, const char *key, const char *data,
-                                   uint16_t length)
+/* reports a burst of connection changes with one line per direction and a single notification */
+void prompt_connection_summary(ToxWindow *self, int num_online, int num_offline)
 {
     ChatContext *ctx = self->chatwin;
 
     char timefrmt[TIME_STR_SIZE];
     get_time_str(timefrmt, sizeof(timefrmt));
 
-    line_info_add(self, timefrmt, NULL, NULL, SYS_MSG, 0, 0, "Friend request with the message '%s'", data);
-    write_to_log("Friend request with the message '%s'", "", ctx->log, true);
+    char count[TOXIC_MAX_NAME_LENGTH];
+    char msg[MAX_STR_SIZE];
+
+    if (num_online > 0) {
+        snprintf(count, sizeof(count), "%d friend%s", num_online, num_online == 1 ? "" : "s");
+        snprintf(msg, sizeof(msg), "%s come online", num_online == 1 ? "has" : "have");
+        line_info_add(self, timefrmt, count, NULL, CONNECTION, 0, GREEN, msg);
+        write_to_log(msg, count, ctx->log, true);
+    }
+
+    if (num_offline > 0) {
+        snprintf(count, sizeof(count), "%d friend%s", num_offline, num_offline == 1 ? "" : "s");
+        snprintf(msg, sizeof(msg), "%s gone offline", num_offline == 1 ? "has" : "have");
+        line_info_add(self, timefrmt, count, NULL, CONNECTION, 0, RED, msg);
+        write_to_log(msg, count, ctx->log, true);
+    }
+
+    Notification notif = num_online >= num_offline ? user_log_in : user_log_out;
 
-    int n = add_friend_request(key);
+    if (self->active_box != -1)
+        box_notify2(self, notif, NT_WNDALERT_2 | NT_NOTIFWND | NT_RESTOL, self->active_box,
+                    "%d friends came online, %d went offline", num_online, num_offline);
+    else
+        box_notify(self, notif, NT_WNDALERT_2 | NT_NOTIFWND | NT_RESTOL, &self->active_box,
+                   "Toxic", "%d friends came online, %d went offline", num_online, num_offline);
+}
+
+static void prompt_onFriendRequest(ToxWindow *self, Tox *m, const char *key, const char *data,
+                                   uint16_t length)
+{
+    ChatContext *ctx = self->chatwin;
+
+    /* ignore requests from blocked contacts, existing friends and repeated requests */
+    if (friend_is_blocked(key) || get_friendnum_by_key(key) != -1)
+        return;
 
-    if (n == -1) {
-        const char *errmsg = "Friend request queue is full. Discarding request.";
-        line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, errmsg);
-        write_to_log(errmsg, "", ctx->log, true);
+    if (key_index_get(&frnd_request_keys, key) != -1)
+        return;
+
+    int n = add_friend_request(key, data, length);
+
+    /* during a burst of requests only a few are announced; the rest are summarized later */
+    if (!friend_request_take_token()) {
+        ++FrndRequests.suppressed;
         return;
     }
 
-    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Type \"/accept %d\" to accept it.", n);
+    const char *msg = FrndRequests.request[n].msg;
+
+    char timefrmt[TIME_STR_SIZE];
+    get_time_str(timefrmt, sizeof(timefrmt));
+
+    char logmsg[MAX_STR_SIZE + 64];
+    snprintf(logmsg, sizeof(logmsg), "Friend request with the message '%s'", msg);
+
+    line_info_add(self, timefrmt, NULL, NULL, SYS_MSG, 0, 0, "%s", logmsg);
+    write_to_log(logmsg, "", ctx->log, true);
+
+    line_info_add(self, NULL, NULL, NULL, SYS_MSG, 0, 0, "Type \"/accept %u\" to accept it.",
+                  FrndRequests.request[n].seq);
     sound_notify(self, generic_message, NT_WNDALERT_1 | NT_NOTIFWND, NULL);
 }
 
 void prompt_init_statusbar(ToxWindow *self, Tox *m)
 {
-    int x2, y2;
-    getmaxyx(self->window, y2, x2);
-    (void) y2;
-
     /* Init statusbar info */
     StatusBar *statusbar = self->stb;
     statusbar->status = TOX_USERSTATUS_NONE;
@@ -388,9 +519,6 @@ void prompt_init_statusbar(ToxWindow *self, Tox *m)
     prompt_update_statusmessage(prompt, statusmsg);
     prompt_update_status(prompt, status);
     prompt_update_nick(prompt, nick);
-
-    /* Init statusbar subwindow */
-    statusbar->topline = subwin(self->window, 2, x2, 0, 0);
 }
 
 static void print_welcome_msg(ToxWindow *self)
@@ -412,12 +540,9 @@ static void print_welcome_msg(ToxWindow *self)
 static void prompt_onInit(ToxWindow *self, Tox *m)
 {
     curs_set(1);
-    int y2, x2;
-    getmaxyx(self->window, y2, x2);
 
+    /* the curses sub-windows are created when the window is first focused */
     ChatContext *ctx = self->chatwin;
-    ctx->history = subwin(self->window, y2 - CHATBOX_HEIGHT + 1, x2, 0, 0);
-    ctx->linewin = subwin(self->window, CHATBOX_HEIGHT, x2, y2 - CHATBOX_HEIGHT, 0);
 
     ctx->log = calloc(1, sizeof(struct chatlog));
     ctx->hst = calloc(1, sizeof(struct history));
@@ -433,9 +558,6 @@ static void prompt_onInit(ToxWindow *self, Tox *m)
         log_enable(self->name, myid, ctx->log);
     }
 
-    scrollok(ctx->history, 0);
-    wmove(self->window, y2 - CURS_Y_OFFSET, 0);
-
     print_welcome_msg(self);
 }
 
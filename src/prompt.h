@@ -27,11 +27,33 @@
 #include "windows.h"
 
 #ifdef _AUDIO
-#define AC_NUM_GLOB_COMMANDS 16
+#define AC_NUM_GLOB_COMMANDS 21
 #else
-#define AC_NUM_GLOB_COMMANDS 14
+#define AC_NUM_GLOB_COMMANDS 19
 #endif /* _AUDIO */
 
+#define FRIEND_REQUEST_BURST 3              /* number of requests announced in a row before rate limiting */
+#define FRIEND_REQUEST_NOTIFY_INTERVAL 10   /* seconds per additional announced request when rate limited */
+
+struct friend_request {
+    bool active;
+    uint32_t seq;       /* request number shown to the user; arrival order, never reused */
+    uint64_t timestamp;
+    char key[TOX_CLIENT_ID_SIZE];
+    char msg[MAX_STR_SIZE];
+};
+
+struct _FriendRequests {
+    struct friend_request request[MAX_FRIEND_REQUESTS];
+    int max_index;      /* 1 + highest index of an active request */
+    int num_requests;
+    uint32_t seq;
+    uint32_t evicted;   /* number of requests dropped to make room for newer ones */
+    int tokens;         /* requests that may be announced in the prompt right away */
+    uint64_t last_refill;
+    int suppressed;     /* requests received but not yet announced */
+};
+
 ToxWindow new_prompt(void);
 void prep_prompt_win(void);
 void prompt_init_statusbar(ToxWindow *self, Tox *m);
@@ -39,6 +61,15 @@ void prompt_update_nick(ToxWindow *prompt, const char *nick);
 void prompt_update_statusmessage(ToxWindow *prompt, const char *statusmsg);
 void prompt_update_status(ToxWindow *prompt, uint8_t status);
 void prompt_update_connectionstatus(ToxWindow *prompt, bool is_connected);
+
+/* reports a burst of connection changes with one line per direction and a single notification */
+void prompt_connection_summary(ToxWindow *self, int num_online, int num_offline);
 void kill_prompt_window(ToxWindow *self);
 
+/* removes request number req from the pending friend requests */
+void del_friend_request(int req);
+
+/* announces requests that were held back by the notification rate limit. Call once per main loop iteration */
+void do_friend_requests(ToxWindow *self);
+
 #endif /* end of include guard: PROMPT_H_UZYGWFFL */
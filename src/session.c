@@ -0,0 +1,408 @@
+/*  session.c
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "toxic.h"
+#include "windows.h"
+#include "session.h"
+#include "friendlist.h"
+#include "chat.h"
+#include "line_info.h"
+#include "misc_tools.h"
+
+extern ToxWindow *prompt;
+extern struct arg_opts arg_opts;
+
+/* The snapshot is a cache of the UI state and is stored in host byte order.
+   Layout: header, then for each window a session_win record followed by num_lines
+   session_line records (each followed by its strings) and num_inputs input lines
+   (each a uint16_t length followed by the multibyte string). Strings are not null terminated. */
+#define SESSION_MAGIC "TOXICSS"
+#define SESSION_VERSION 1
+
+enum {
+    SESSION_WIN_PROMPT,
+    SESSION_WIN_CHAT,
+} SESSION_WIN_TYPE;
+
+struct session_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_windows;
+};
+
+struct session_win {
+    uint8_t type;
+    uint16_t num_lines;
+    uint16_t num_inputs;
+    char pub_key[TOX_CLIENT_ID_SIZE];
+};
+
+struct session_line {
+    uint8_t type;
+    uint8_t bold;
+    uint8_t colour;
+    uint8_t tmstmp_len;
+    uint8_t name1_len;
+    uint8_t name2_len;
+    uint16_t msg_len;
+};
+
+static bool session_win_is_saved(ToxWindow *w)
+{
+    return w != NULL && (w->is_prompt || w->is_chat) && w->chatwin != NULL && w->chatwin->hst != NULL;
+}
+
+static int session_write_line(FILE *fp, struct line_info *line)
+{
+    struct session_line rec;
+    memset(&rec, 0, sizeof(struct session_line));
+
+    rec.type = line->type;
+    rec.bold = line->bold;
+    rec.colour = line->colour;
+    rec.tmstmp_len = strlen(line->timestamp);
+    rec.name1_len = strlen(line->name1);
+    rec.name2_len = strlen(line->name2);
+    rec.msg_len = strlen(line->msg);
+
+    if (fwrite(&rec, sizeof(struct session_line), 1, fp) != 1)
+        return -1;
+
+    if (fwrite(line->timestamp, rec.tmstmp_len, 1, fp) != 1 && rec.tmstmp_len)
+        return -1;
+
+    if (fwrite(line->name1, rec.name1_len, 1, fp) != 1 && rec.name1_len)
+        return -1;
+
+    if (fwrite(line->name2, rec.name2_len, 1, fp) != 1 && rec.name2_len)
+        return -1;
+
+    if (fwrite(line->msg, rec.msg_len, 1, fp) != 1 && rec.msg_len)
+        return -1;
+
+    return 0;
+}
+
+static int session_write_win(FILE *fp, ToxWindow *w)
+{
+    ChatContext *ctx = w->chatwin;
+    struct history *hst = ctx->hst;
+    struct session_win rec;
+    memset(&rec, 0, sizeof(struct session_win));
+
+    if (w->is_chat) {
+        rec.type = SESSION_WIN_CHAT;
+        memcpy(rec.pub_key, get_friend(w->num)->pub_key, TOX_CLIENT_ID_SIZE);
+    } else {
+        rec.type = SESSION_WIN_PROMPT;
+    }
+
+    /* find the line preceding the tail we want to keep (the root line is never printed) */
+    struct line_info *line = hst->line_end;
+    int num_lines = 0;
+
+    while (line->prev && num_lines < SESSION_HISTORY_LINES) {
+        line = line->prev;
+        ++num_lines;
+    }
+
+    rec.num_lines = num_lines + hst->queue_sz;
+    rec.num_inputs = ctx->hst_tot;
+
+    if (fwrite(&rec, sizeof(struct session_win), 1, fp) != 1)
+        return -1;
+
+    for (line = line->next; line; line = line->next) {
+        if (session_write_line(fp, line) == -1)
+            return -1;
+    }
+
+    int i;
+
+    for (i = 0; i < hst->queue_sz; ++i) {
+        if (session_write_line(fp, hst->queue[i]) == -1)
+            return -1;
+    }
+
+    char buf[MAX_STR_SIZE * MB_LEN_MAX];
+
+    for (i = 0; i < ctx->hst_tot; ++i) {
+        int len = wcs_to_mbs_buf(buf, ctx->ln_history[i], sizeof(buf));
+        uint16_t n = len > 0 ? len : 0;
+
+        if (fwrite(&n, sizeof(uint16_t), 1, fp) != 1)
+            return -1;
+
+        if (n > 0 && fwrite(buf, n, 1, fp) != 1)
+            return -1;
+    }
+
+    return 0;
+}
+
+int session_save(const char *path)
+{
+    if (arg_opts.ignore_data_file)
+        return 0;
+
+    if (path == NULL)
+        return -1;
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+
+    if (fp == NULL)
+        return -1;
+
+    struct session_header hdr;
+    memset(&hdr, 0, sizeof(struct session_header));
+    memcpy(hdr.magic, SESSION_MAGIC, sizeof(hdr.magic));
+    hdr.version = SESSION_VERSION;
+
+    int i;
+
+    for (i = 0; i < get_num_active_windows(); ++i) {
+        if (session_win_is_saved(get_open_window(i)))
+            ++hdr.num_windows;
+    }
+
+    int ret = 0;
+
+    if (fwrite(&hdr, sizeof(struct session_header), 1, fp) != 1)
+        ret = -1;
+
+    for (i = 0; i < get_num_active_windows() && ret == 0; ++i) {
+        ToxWindow *w = get_open_window(i);
+
+        if (session_win_is_saved(w))
+            ret = session_write_win(fp, w);
+    }
+
+    if (fclose(fp) != 0)
+        ret = -1;
+
+    if (ret == 0 && rename(tmp_path, path) != 0)
+        ret = -1;
+
+    if (ret != 0)
+        remove(tmp_path);
+
+    return ret;
+}
+
+/* bounds-checked reader over the mapped snapshot */
+struct session_reader {
+    const char *data;
+    size_t size;
+    size_t pos;
+};
+
+static const void *session_read(struct session_reader *rd, size_t len)
+{
+    if (len > rd->size - rd->pos)
+        return NULL;
+
+    const void *p = rd->data + rd->pos;
+    rd->pos += len;
+    return p;
+}
+
+/* copies a string of len bytes from the reader into buf and null terminates it */
+static int session_read_str(struct session_reader *rd, char *buf, size_t bufsize, size_t len)
+{
+    const char *p = session_read(rd, len);
+
+    if (p == NULL)
+        return -1;
+
+    if (len >= bufsize)
+        len = bufsize - 1;
+
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return 0;
+}
+
+static int session_restore_lines(struct session_reader *rd, ToxWindow *self, int num_lines)
+{
+    struct history *hst = self ? self->chatwin->hst : NULL;
+    int i;
+
+    for (i = 0; i < num_lines; ++i) {
+        struct session_line rec;
+        const void *p = session_read(rd, sizeof(struct session_line));
+
+        if (p == NULL)
+            return -1;
+
+        memcpy(&rec, p, sizeof(struct session_line));
+
+        char tmstmp[TIME_STR_SIZE];
+        char name1[TOXIC_MAX_NAME_LENGTH];
+        char name2[TOXIC_MAX_NAME_LENGTH];
+        char msg[MAX_STR_SIZE];
+
+        if (session_read_str(rd, tmstmp, sizeof(tmstmp), rec.tmstmp_len) == -1
+                || session_read_str(rd, name1, sizeof(name1), rec.name1_len) == -1
+                || session_read_str(rd, name2, sizeof(name2), rec.name2_len) == -1
+                || session_read_str(rd, msg, sizeof(msg), rec.msg_len) == -1)
+            return -1;
+
+        if (hst)
+            line_info_restore(hst, tmstmp, name1, name2, rec.type, rec.bold, rec.colour, msg);
+    }
+
+    if (hst && num_lines > 0) {
+        line_info_reset_start(self, hst);
+        hst->start_id = hst->line_start->id;
+    }
+
+    return 0;
+}
+
+static int session_restore_inputs(struct session_reader *rd, ToxWindow *self, int num_inputs)
+{
+    ChatContext *ctx = self ? self->chatwin : NULL;
+    int i;
+
+    for (i = 0; i < num_inputs; ++i) {
+        const void *p = session_read(rd, sizeof(uint16_t));
+
+        if (p == NULL)
+            return -1;
+
+        uint16_t len;
+        memcpy(&len, p, sizeof(uint16_t));
+
+        char buf[MAX_STR_SIZE * MB_LEN_MAX];
+
+        if (session_read_str(rd, buf, sizeof(buf), len) == -1)
+            return -1;
+
+        if (ctx == NULL || ctx->hst_tot >= MAX_LINE_HIST)
+            continue;
+
+        if (mbs_to_wcs_buf(ctx->ln_history[ctx->hst_tot], buf, MAX_STR_SIZE) == -1)
+            continue;
+
+        ctx->hst_pos = ++ctx->hst_tot;
+    }
+
+    return 0;
+}
+
+/* returns the window a saved window record should be restored into, or NULL if it should be skipped */
+static ToxWindow *session_open_win(Tox *m, struct session_win *rec)
+{
+    if (rec->type == SESSION_WIN_PROMPT)
+        return prompt;
+
+    if (rec->type != SESSION_WIN_CHAT)
+        return NULL;
+
+    int32_t num = get_friendnum_by_key(rec->pub_key);
+
+    if (num < 0 || !get_friend(num)->active || get_friend(num)->chatwin != -1)
+        return NULL;
+
+    if (get_num_active_windows() >= MAX_WINDOWS_NUM)
+        return NULL;
+
+    get_friend(num)->chatwin = add_window(m, new_chat(m, get_friend(num)->num));
+
+    if (get_friend(num)->chatwin == -1)
+        return NULL;
+
+    return get_window_ptr(get_friend(num)->chatwin);
+}
+
+int session_load(Tox *m, const char *path)
+{
+    if (arg_opts.ignore_data_file || path == NULL)
+        return -1;
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct session_header)) {
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return -1;
+
+    struct session_reader rd = { .data = data, .size = st.st_size, .pos = 0 };
+    struct session_header hdr;
+    memcpy(&hdr, session_read(&rd, sizeof(struct session_header)), sizeof(struct session_header));
+
+    if (memcmp(hdr.magic, SESSION_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != SESSION_VERSION) {
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    int restored = 0;
+    uint32_t i;
+
+    for (i = 0; i < hdr.num_windows; ++i) {
+        struct session_win rec;
+        const void *p = session_read(&rd, sizeof(struct session_win));
+
+        if (p == NULL)
+            break;
+
+        memcpy(&rec, p, sizeof(struct session_win));
+
+        /* records for windows we can't restore are still parsed so we can skip past them */
+        ToxWindow *self = session_open_win(m, &rec);
+
+        if (session_restore_lines(&rd, self, rec.num_lines) == -1)
+            break;
+
+        if (session_restore_inputs(&rd, self, rec.num_inputs) == -1)
+            break;
+
+        if (self)
+            ++restored;
+    }
+
+    munmap(data, st.st_size);
+    return restored;
+}
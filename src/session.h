@@ -0,0 +1,41 @@
+/*  session.h
+ *
+ *
+ *  Copyright (C) 2014 Toxic All Rights Reserved.
+ *
+ *  This file is part of Toxic.
+ *
+ *  Toxic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Toxic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Toxic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _session_h
+#define _session_h
+
+#include "toxic.h"
+#include "windows.h"
+
+#define SESSION_HISTORY_LINES 200    /* max number of history lines saved per window */
+
+/* Writes a snapshot of the open prompt and chat windows, the tail of their history
+   and their input history to path. Must be called with Winthread.lock held: the autosave
+   takes it and exit_toxic_success() is only called with it held.
+   Returns 0 on success, -1 on failure. */
+int session_save(const char *path);
+
+/* Restores the windows saved by session_save(). Should be called once on startup after
+   the friend list has been loaded. Returns the number of restored windows or -1 on failure. */
+int session_load(Tox *m, const char *path);
+
+#endif /* #define _session_h */
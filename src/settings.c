@@ -36,6 +36,7 @@
 
 #include "settings.h"
 #include "line_info.h"
+#include "misc_tools.h"
 
 #ifndef PACKAGE_DATADIR
     #define PACKAGE_DATADIR "."
@@ -53,6 +54,7 @@ const struct _ui_strings {
     const char* history_size;
     const char* show_typing_self;
     const char* show_typing_other;
+    const char* paste_split_lines;
 } ui_strings = {
     "ui",
     "timestamps",
@@ -63,6 +65,7 @@ const struct _ui_strings {
     "history_size",
     "show_typing_self",
     "show_typing_other",
+    "paste_split_lines",
 };
 
 static void ui_defaults(struct user_settings* settings) 
@@ -75,6 +78,7 @@ static void ui_defaults(struct user_settings* settings)
     settings->history_size = 700;
     settings->show_typing_self = SHOW_TYPING_ON;
     settings->show_typing_other = SHOW_TYPING_ON;
+    settings->paste_split_lines = PASTE_SPLIT_LINES;
 }
 
 const struct _keys_strings {
@@ -118,14 +122,23 @@ static void key_defaults(struct user_settings* settings)
 const struct _tox_strings {
     const char* self;
     const char* download_path;
+    const char* upload_limit;
+    const char* download_limit;
+    const char* call_rate_limit;
 } tox_strings = {
     "tox",
     "download_path",
+    "upload_limit",
+    "download_limit",
+    "call_rate_limit",
 };
 
 static void tox_defaults(struct user_settings* settings)
 {
     strcpy(settings->download_path, "");    /* explicitly set default to pwd */
+    settings->upload_limit = 0;
+    settings->download_limit = 0;
+    settings->call_rate_limit = 0;
 }
 
 #ifdef _AUDIO
@@ -244,6 +257,7 @@ int settings_load(struct user_settings *s, const char *patharg)
         config_setting_lookup_int(setting, ui_strings.history_size, &s->history_size);
         config_setting_lookup_bool(setting, ui_strings.show_typing_self, &s->show_typing_self);
         config_setting_lookup_bool(setting, ui_strings.show_typing_other, &s->show_typing_other);
+        config_setting_lookup_bool(setting, ui_strings.paste_split_lines, &s->paste_split_lines);
         config_setting_lookup_int(setting, ui_strings.time_format, &s->time);
         s->time = s->time == TIME_24 || s->time == TIME_12 ? s->time : TIME_24; /* Check defaults */
     }
@@ -252,6 +266,13 @@ int settings_load(struct user_settings *s, const char *patharg)
         if ( config_setting_lookup_string(setting, tox_strings.download_path, &str) ) {
             strcpy(s->download_path, str);
         }
+
+        config_setting_lookup_int(setting, tox_strings.upload_limit, &s->upload_limit);
+        config_setting_lookup_int(setting, tox_strings.download_limit, &s->download_limit);
+        config_setting_lookup_int(setting, tox_strings.call_rate_limit, &s->call_rate_limit);
+        s->upload_limit = MAX(s->upload_limit, 0);
+        s->download_limit = MAX(s->download_limit, 0);
+        s->call_rate_limit = MAX(s->call_rate_limit, 0);
     }
 
 	/* keys */
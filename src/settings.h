@@ -33,8 +33,12 @@ struct user_settings {
     int history_size;      /* int between MIN_HISTORY and MAX_HISTORY */
     int show_typing_self;  /* boolean */
     int show_typing_other; /* boolean */
+    int paste_split_lines; /* boolean */
 
     char download_path[MAX_STR_SIZE];
+    int upload_limit;      /* KiB/s; 0 for no limit */
+    int download_limit;    /* KiB/s; 0 for no limit */
+    int call_rate_limit;   /* KiB/s in each direction while a call is running; 0 for no limit */
 
 	int key_next_tab;			/* character code */
 	int key_prev_tab;			/* character code */
@@ -71,6 +75,9 @@ enum {
     SHOW_TYPING_OFF = 0,
     SHOW_TYPING_ON = 1,
 
+    PASTE_JOIN_LINES = 0,
+    PASTE_SPLIT_LINES = 1,
+
     DFLT_HST_SIZE = 700,
 } settings_values;
 
@@ -39,12 +39,15 @@
 #include <unistd.h>
 
 #include <tox/tox.h>
+#include <sodium.h>
 
 #include "configdir.h"
 #include "toxic.h"
 #include "windows.h"
 #include "friendlist.h"
+#include "chat.h"
 #include "prompt.h"
+#include "import.h"
 #include "misc_tools.h"
 #include "file_senders.h"
 #include "line_info.h"
@@ -52,6 +55,10 @@
 #include "log.h"
 #include "notify.h"
 #include "device.h"
+#include "session.h"
+#include "file_writer.h"
+#include "checkpoint.h"
+#include "message_queue.h"
 
 #ifdef _AUDIO
 #include "audio_call.h"
@@ -68,6 +75,8 @@ ToxAv *av;
 /* Export for use in Callbacks */
 char *DATA_FILE = NULL;
 char *BLOCK_FILE = NULL;
+char *SESSION_FILE = NULL;
+char *TRANSFERS_FILE = NULL;
 ToxWindow *prompt = NULL;
 
 #define AUTOSAVE_FREQ 60
@@ -81,9 +90,17 @@ static void catch_SIGINT(int sig)
     Winthread.sig_exit_toxic = true;
 }
 
+/* tells the terminal to mark pasted text with ESC[200~ and ESC[201~ */
+static void set_bracketed_paste(bool enable)
+{
+    printf(enable ? "\033[?2004h" : "\033[?2004l");
+    fflush(stdout);
+}
+
 static void catch_SIGSEGV(int sig)
 {
     endwin();
+    set_bracketed_paste(false);
     fprintf(stderr, "Caught SIGSEGV: Aborting toxic session.\n");
     exit(EXIT_FAILURE);
 }
@@ -103,11 +120,16 @@ static void init_signal_catchers(void)
 void exit_toxic_success(Tox *m)
 {
     store_data(m, DATA_FILE);
+    session_save(SESSION_FILE);
     close_all_file_senders(m);
+    close_all_file_receivers();
+    checkpoint_save();
     kill_all_windows();
 
     free(DATA_FILE);
     free(BLOCK_FILE);
+    free(SESSION_FILE);
+    free(TRANSFERS_FILE);
     free(user_settings_);
 
 #ifdef _SOUND_NOTIFY
@@ -119,6 +141,7 @@ void exit_toxic_success(Tox *m)
 #endif /* _AUDIO */
     tox_kill(m);
     endwin();
+    set_bracketed_paste(false);
     exit(EXIT_SUCCESS);
 }
 
@@ -128,6 +151,7 @@ void exit_toxic_err(const char *errmsg, int errcode)
         errmsg = "No error message";
 
     endwin();
+    set_bracketed_paste(false);
     fprintf(stderr, "Toxic session aborted with error code %d (%s)\n", errcode, errmsg);
     exit(EXIT_FAILURE);
 }
@@ -150,6 +174,11 @@ static void init_term(void)
     noecho();
     timeout(100);
 
+    /* terminals that support bracketed paste deliver pastes between these markers; others ignore the request */
+    define_key("\033[200~", T_KEY_PASTE_START);
+    define_key("\033[201~", T_KEY_PASTE_END);
+    set_bracketed_paste(true);
+
     if (has_colors()) {
         short bg_color = COLOR_BLACK;
         start_color();
@@ -197,6 +226,7 @@ static Tox *init_tox(int ipv4)
     /* Callbacks */
     tox_callback_connection_status(m, on_connectionchange, NULL);
     tox_callback_typing_change(m, on_typing_change, NULL);
+    tox_callback_read_receipt(m, on_read_receipt, NULL);
     tox_callback_friend_request(m, on_request, NULL);
     tox_callback_friend_message(m, on_message, NULL);
     tox_callback_name_change(m, on_nickchange, NULL);
@@ -466,24 +496,41 @@ static void do_toxic(Tox *m, ToxWindow *prompt)
     pthread_mutex_lock(&Winthread.lock);
     do_connection(m, prompt);
     do_file_senders(m);
+    do_file_receivers(m);
+    do_file_writers(m);
+    do_checkpoints();
+    do_typing_notifications(m);
+    do_chat_queues(m);
+    do_friend_requests(prompt);
+    do_import(m);
     tox_do(m);    /* main tox-core loop */
+    do_friend_events(m);
+    friendlist_refresh_filter();
     pthread_mutex_unlock(&Winthread.lock);
 }
 
 #define INACTIVE_WIN_REFRESH_RATE 10
+#define RESIZE_DEBOUNCE 150    /* ms without a new SIGWINCH before the windows are resized */
 
 void *thread_winref(void *data)
 {
     Tox *m = (Tox *) data;
     uint8_t draw_count = 0;
+    uint64_t last_resize = 0;
 
     while (true) {
         draw_active_window(m);
         draw_count++;
 
+        /* dragging a terminal border sends a storm of SIGWINCH; only resize once it settles */
         if (Winthread.flag_resize) {
-            on_window_resize();
             Winthread.flag_resize = false;
+            last_resize = get_time_ms();
+        }
+
+        if (last_resize && get_time_ms() - last_resize >= RESIZE_DEBOUNCE) {
+            on_window_resize();
+            last_resize = 0;
         } else if (draw_count >= INACTIVE_WIN_REFRESH_RATE) {
             refresh_inactive_windows();
             draw_count = 0;
@@ -505,6 +552,7 @@ static void print_usage(void)
     fprintf(stderr, "  -d, --default_locale     Use default locale\n");
     fprintf(stderr, "  -c, --config             Use specified config file\n");
     fprintf(stderr, "  -n, --nodes              Use specified DHTnodes file\n");
+    fprintf(stderr, "  -i, --import             Send friend requests to the contacts listed in file\n");
     fprintf(stderr, "  -h, --help               Show this message and exit\n");
 }
 
@@ -527,10 +575,11 @@ static void parse_args(int argc, char *argv[])
         {"default_locale", no_argument, 0, 'd'},
         {"config", required_argument, 0, 'c'},
         {"nodes", required_argument, 0, 'n'},
+        {"import", required_argument, 0, 'i'},
         {"help", no_argument, 0, 'h'},
     };
 
-    const char *opts_str = "4xdf:c:n:h";
+    const char *opts_str = "4xdf:c:n:i:h";
     int opt, indexptr;
 
     while ((opt = getopt_long(argc, argv, opts_str, long_opts, &indexptr)) != -1) {
@@ -539,12 +588,20 @@ static void parse_args(int argc, char *argv[])
                 arg_opts.use_custom_data = 1;
                 DATA_FILE = strdup(optarg);
                 BLOCK_FILE = malloc(strlen(optarg) + strlen("-blocklist") + 1);
+                SESSION_FILE = malloc(strlen(optarg) + strlen("-session") + 1);
+                TRANSFERS_FILE = malloc(strlen(optarg) + strlen("-transfers") + 1);
 
-                if (DATA_FILE == NULL || BLOCK_FILE == NULL)
+                if (DATA_FILE == NULL || BLOCK_FILE == NULL || SESSION_FILE == NULL || TRANSFERS_FILE == NULL)
                     exit_toxic_err("failed in parse_args", FATALERR_MEMORY);
 
                 strcpy(BLOCK_FILE, optarg);
                 strcat(BLOCK_FILE, "-blocklist");
+
+                strcpy(SESSION_FILE, optarg);
+                strcat(SESSION_FILE, "-session");
+
+                strcpy(TRANSFERS_FILE, optarg);
+                strcat(TRANSFERS_FILE, "-transfers");
                 break;
 
             case 'x':
@@ -563,6 +620,10 @@ static void parse_args(int argc, char *argv[])
                 snprintf(arg_opts.nodes_path, sizeof(arg_opts.nodes_path), "%s", optarg);
                 break;
 
+            case 'i':
+                snprintf(arg_opts.import_path, sizeof(arg_opts.import_path), "%s", optarg);
+                break;
+
             case 'd':
                 arg_opts.default_locale = 1;
                 break;
@@ -577,6 +638,8 @@ static void parse_args(int argc, char *argv[])
 
 #define DATANAME "data"
 #define BLOCKNAME "data-blocklist"
+#define SESSIONNAME "data-session"
+#define TRANSFERSNAME "data-transfers"
 static int init_data_files(void)
 {
     if (arg_opts.use_custom_data)
@@ -589,14 +652,18 @@ static int init_data_files(void)
         if (config_err) {
             DATA_FILE = strdup(DATANAME);
             BLOCK_FILE = strdup(BLOCKNAME);
+            SESSION_FILE = strdup(SESSIONNAME);
+            TRANSFERS_FILE = strdup(TRANSFERSNAME);
 
-            if (DATA_FILE == NULL || BLOCK_FILE == NULL)
+            if (DATA_FILE == NULL || BLOCK_FILE == NULL || SESSION_FILE == NULL || TRANSFERS_FILE == NULL)
                 exit_toxic_err("failed in load_data_structures", FATALERR_MEMORY);
         } else {
             DATA_FILE = malloc(strlen(user_config_dir) + strlen(CONFIGDIR) + strlen(DATANAME) + 1);
             BLOCK_FILE = malloc(strlen(user_config_dir) + strlen(CONFIGDIR) + strlen(BLOCKNAME) + 1);
+            SESSION_FILE = malloc(strlen(user_config_dir) + strlen(CONFIGDIR) + strlen(SESSIONNAME) + 1);
+            TRANSFERS_FILE = malloc(strlen(user_config_dir) + strlen(CONFIGDIR) + strlen(TRANSFERSNAME) + 1);
 
-            if (DATA_FILE == NULL || BLOCK_FILE == NULL)
+            if (DATA_FILE == NULL || BLOCK_FILE == NULL || SESSION_FILE == NULL || TRANSFERS_FILE == NULL)
                 exit_toxic_err("failed in load_data_structures", FATALERR_MEMORY);
 
             strcpy(DATA_FILE, user_config_dir);
@@ -606,6 +673,14 @@ static int init_data_files(void)
             strcpy(BLOCK_FILE, user_config_dir);
             strcat(BLOCK_FILE, CONFIGDIR);
             strcat(BLOCK_FILE, BLOCKNAME);
+
+            strcpy(SESSION_FILE, user_config_dir);
+            strcat(SESSION_FILE, CONFIGDIR);
+            strcat(SESSION_FILE, SESSIONNAME);
+
+            strcpy(TRANSFERS_FILE, user_config_dir);
+            strcat(TRANSFERS_FILE, CONFIGDIR);
+            strcat(TRANSFERS_FILE, TRANSFERSNAME);
         }
     }
 
@@ -637,6 +712,10 @@ int main(int argc, char *argv[])
     init_signal_catchers();
     parse_args(argc, argv);
 
+    /* picks the fastest hash implementation for the CPU */
+    if (sodium_init() == -1)
+        exit_toxic_err("failed in main", FATALERR_CRYPTO_INIT);
+
     /* Make sure all written files are read/writeable only by the current user. */
     umask(S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
     int config_err = init_data_files();
@@ -656,12 +735,17 @@ int main(int argc, char *argv[])
     if (m == NULL)
         exit_toxic_err("failed in main", FATALERR_NETWORKINIT);
 
-    if (!arg_opts.ignore_data_file)
+    if (!arg_opts.ignore_data_file) {
         load_data(m, DATA_FILE);
+        checkpoint_load();
+    }
 
     prompt = init_windows(m);
     prompt_init_statusbar(prompt, m);
 
+    if (!arg_opts.ignore_data_file)
+        session_load(m, SESSION_FILE);
+
     /* thread for ncurses stuff */
     if (pthread_mutex_init(&Winthread.lock, NULL) != 0)
         exit_toxic_err("failed in main", FATALERR_MUTEX_INIT);
@@ -700,6 +784,12 @@ int main(int argc, char *argv[])
         line_info_add(prompt, NULL, NULL, NULL, SYS_MSG, 0, 0, msg);
     }
 
+    if (arg_opts.import_path[0]) {
+        pthread_mutex_lock(&Winthread.lock);
+        import_start(prompt, m, arg_opts.import_path);
+        pthread_mutex_unlock(&Winthread.lock);
+    }
+
     uint64_t last_save = (uint64_t) time(NULL);
     uint64_t looptimer = last_save;
     useconds_t msleepval = 40000;
@@ -719,6 +809,7 @@ int main(int argc, char *argv[])
         if (timed_out(last_save, cur_time, AUTOSAVE_FREQ)) {
             pthread_mutex_lock(&Winthread.lock);
             store_data(m, DATA_FILE);
+            session_save(SESSION_FILE);
             pthread_mutex_unlock(&Winthread.lock);
 
             last_save = cur_time;
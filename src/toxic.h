@@ -42,7 +42,7 @@
 
 #define UNKNOWN_NAME "Anonymous"
 
-#define MAX_FRIENDS_NUM 999
+#define MAX_FRIEND_REQUESTS 256
 #define MAX_STR_SIZE TOX_MAX_MESSAGE_LENGTH
 #define MAX_CMDNAME_SIZE 64
 #define TOXIC_MAX_NAME_LENGTH 32   /* Must be <= TOX_MAX_NAME_LENGTH */
@@ -65,6 +65,10 @@
 #define T_KEY_C_Y        0x19     /* ctrl-y */
 #define T_KEY_TAB        0x09     /* TAB key */
 
+/* key codes for the bracketed paste markers, defined with define_key() in init_term() */
+#define T_KEY_PASTE_START (KEY_MAX + 1)
+#define T_KEY_PASTE_END   (KEY_MAX + 2)
+
 #define ONLINE_CHAR "*"
 #define OFFLINE_CHAR "o"
 
@@ -79,12 +83,15 @@ typedef enum _FATAL_ERRS {
     FATALERR_NETWORKINIT = -8,      /* Tox network failed to init */
     FATALERR_INFLOOP = -9,          /* infinite loop detected */
     FATALERR_WININIT = -10,         /* window init failed */
+    FATALERR_CRYPTO_INIT = -11,     /* libsodium failed to init */
 } FATAL_ERRS;
 
 /* Fixes text color problem on some terminals.
    Uncomment if necessary */
 /* #define URXVT_FIX */
 
+/* saves and exits. Must be called with Winthread.lock held, which is never released, so the
+   session and transfer state it writes can't change under it */
 void exit_toxic_success(Tox *m);
 void exit_toxic_err(const char *errmsg, int errcode);
 
@@ -97,7 +104,7 @@ void on_action(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t len
 void on_nickchange(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata);
 void on_statuschange(Tox *m, int32_t friendnumber, uint8_t status, void *userdata);
 void on_statusmessagechange(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata);
-void on_friendadded(Tox *m, int32_t friendnumber, bool sort);
+void on_friendadded(Tox *m, int32_t friendnumber, bool sort, bool save);
 void on_groupmessage(Tox *m, int groupnumber, int peernumber, const uint8_t *message, uint16_t length, void *userdata);
 void on_groupaction(Tox *m, int groupnumber, int peernumber, const uint8_t *action, uint16_t length, void *userdata);
 void on_groupinvite(Tox *m, int32_t friendnumber, const uint8_t *group_pub_key, void *userdata);
@@ -108,5 +115,6 @@ void on_file_control(Tox *m, int32_t friendnumber, uint8_t receive_send, uint8_t
                      const uint8_t *data, uint16_t length, void *userdata);
 void on_file_data(Tox *m, int32_t friendnumber, uint8_t filenumber, const uint8_t *data, uint16_t length, void *userdata);
 void on_typing_change(Tox *m, int32_t friendnumber, uint8_t is_typing, void *userdata);
+void on_read_receipt(Tox *m, int32_t friendnumber, uint32_t receipt, void *userdata);
 
 #endif  /* #define _toxic_h */
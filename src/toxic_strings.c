@@ -43,6 +43,24 @@ int add_char_to_buf(ChatContext *ctx, wint_t ch)
     return 0;
 }
 
+/* Adds up to len chars from str to line at pos. Returns the number of chars added,
+   which is less than len if the line buffer fills up */
+int add_str_to_buf(ChatContext *ctx, const wchar_t *str, int len)
+{
+    int n = MIN(len, MAX_STR_SIZE - 1 - ctx->len);
+
+    if (n <= 0)
+        return 0;
+
+    wmemmove(&ctx->line[ctx->pos + n], &ctx->line[ctx->pos], ctx->len - ctx->pos);
+    wmemcpy(&ctx->line[ctx->pos], str, n);
+    ctx->pos += n;
+    ctx->len += n;
+    ctx->line[ctx->len] = L'\0';
+
+    return n;
+}
+
 /* Deletes the character before pos. Return 0 on success, -1 if nothing to delete */
 int del_char_buf_bck(ChatContext *ctx)
 {
@@ -28,6 +28,10 @@
 /* Adds char to line at pos. Return 0 on success, -1 if line buffer is full */
 int add_char_to_buf(ChatContext *ctx, wint_t ch);
 
+/* Adds up to len chars from str to line at pos. Returns the number of chars added,
+   which is less than len if the line buffer fills up */
+int add_str_to_buf(ChatContext *ctx, const wchar_t *str, int len);
+
 /* Deletes the character before pos. Return 0 on success, -1 if nothing to delete */
 int del_char_buf_bck(ChatContext *ctx);
 
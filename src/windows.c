@@ -24,6 +24,8 @@
 #include <string.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 
 #include "friendlist.h"
 #include "prompt.h"
@@ -32,11 +34,19 @@
 #include "groupchat.h"
 #include "chat.h"
 #include "line_info.h"
+#include "misc_tools.h"
+#include "input.h"
 
 #include "settings.h"
 extern char *DATA_FILE;
 extern struct _Winthread Winthread;
-static ToxWindow windows[MAX_WINDOWS_NUM];
+/* Windows are heap allocated so pointers to them stay valid as the table grows. A window's
+   index in the table is stable (friends[].chatwin and groupchats[].chatwin refer to it) while
+   tab_order holds the open windows densely so tab cycling and the tab bar never scan empty slots */
+static ToxWindow **windows;
+static ToxWindow **tab_order;
+static int windows_size;
+static int tab_bar_start;    /* tab_pos of the leftmost tab drawn in the bar */
 static ToxWindow *active_window;
 
 extern ToxWindow *prompt;
@@ -44,246 +54,653 @@ extern struct user_settings *user_settings_;
 
 static int num_active_windows;
 
-/* CALLBACKS START */
-void on_request(Tox *m, const uint8_t *public_key, const uint8_t *data, uint16_t length, void *userdata)
+/* Chat and groupchat windows only care about the events of their own friend or group, so they are
+   looked up by number in the route tables. Every other window (prompt, friendlist) subscribes to all
+   events. Dispatching an event therefore costs one call per global subscriber plus one for the
+   routed window instead of one per window slot */
+static ToxWindow *global_subscribers[MAX_WINDOWS_NUM];
+static int num_global_subscribers;
+
+static ToxWindow **friend_routes;    /* friend number -> chat window, or NULL */
+static int friend_routes_size;
+static ToxWindow *group_routes[MAX_WINDOWS_NUM];    /* group number -> groupchat window, or NULL */
+
+static ToxWindow *get_friend_window(int32_t friendnumber)
 {
-    int i;
+    if (friendnumber < 0 || friendnumber >= friend_routes_size)
+        return NULL;
+
+    return friend_routes[friendnumber];
+}
+
+static ToxWindow *get_group_window(int groupnumber)
+{
+    if (groupnumber < 0 || groupnumber >= MAX_WINDOWS_NUM)
+        return NULL;
+
+    return group_routes[groupnumber];
+}
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onFriendRequest != NULL)
-            windows[i].onFriendRequest(&windows[i], m, (const char *) public_key, (const char *) data, length);
+static void window_route_add(ToxWindow *w)
+{
+    if (w->is_chat) {
+        if (w->num < 0)
+            return;
+
+        if (w->num >= friend_routes_size) {
+            int n = MAX(w->num + 1, friend_routes_size * 2);
+            ToxWindow **tmp = realloc(friend_routes, n * sizeof(ToxWindow *));
+
+            if (tmp == NULL)
+                exit_toxic_err("failed in window_route_add", FATALERR_MEMORY);
+
+            memset(&tmp[friend_routes_size], 0, (n - friend_routes_size) * sizeof(ToxWindow *));
+            friend_routes = tmp;
+            friend_routes_size = n;
+        }
+
+        friend_routes[w->num] = w;
+    } else if (w->is_groupchat) {
+        if (w->num >= 0 && w->num < MAX_WINDOWS_NUM)
+            group_routes[w->num] = w;
+    } else {
+        global_subscribers[num_global_subscribers++] = w;
     }
 }
 
-void on_connectionchange(Tox *m, int32_t friendnumber, uint8_t status, void *userdata)
+static void window_route_del(ToxWindow *w)
 {
-    int i;
+    if (w->is_chat) {
+        if (get_friend_window(w->num) == w)
+            friend_routes[w->num] = NULL;
+    } else if (w->is_groupchat) {
+        if (get_group_window(w->num) == w)
+            group_routes[w->num] = NULL;
+    } else {
+        int i;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onConnectionChange != NULL)
-            windows[i].onConnectionChange(&windows[i], m, friendnumber, status);
+        for (i = 0; i < num_global_subscribers; ++i) {
+            if (global_subscribers[i] == w) {
+                global_subscribers[i] = global_subscribers[--num_global_subscribers];
+                break;
+            }
+        }
     }
 }
 
-void on_typing_change(Tox *m, int32_t friendnumber, uint8_t is_typing, void *userdata)
+/* Calls onFunc on every global subscriber */
+#define DISPATCH_GLOBAL(onFunc, ...) do { int i_;\
+for (i_ = 0; i_ < num_global_subscribers; ++i_) { ToxWindow *w_ = global_subscribers[i_];\
+if (w_->onFunc != NULL) w_->onFunc(w_, __VA_ARGS__); } } while (0)
+
+/* Calls onFunc on the global subscribers, then on the window routed to by target. The route is looked up
+   after the global subscribers run because they may open the window (e.g. the friendlist on a new message) */
+#define DISPATCH_ROUTED(get_target, target, onFunc, ...) do { DISPATCH_GLOBAL(onFunc, __VA_ARGS__);\
+ToxWindow *t_ = get_target(target); if (t_ != NULL && t_->onFunc != NULL) t_->onFunc(t_, __VA_ARGS__); } while (0)
+
+/* Presence events (nick, status message, status, connection and typing changes) come in bursts when
+   the network flaps or we rejoin. Each one is folded into a pending record for its friend that keeps
+   only the latest state of each kind, and do_friend_events() delivers the records at most once every
+   FRIEND_EVENTS_INTERVAL ms. A friend's record is delivered right away before a message or file event
+   of theirs, so e.g. a friend who comes online and says hi isn't shown talking while offline */
+enum {
+    FRIEND_EVENT_NICK = 1 << 0,
+    FRIEND_EVENT_STATUSMSG = 1 << 1,
+    FRIEND_EVENT_STATUS = 1 << 2,
+    FRIEND_EVENT_CONNECTION = 1 << 3,
+    FRIEND_EVENT_TYPING = 1 << 4,
+} FRIEND_EVENT_TYPE;
+
+struct friend_event {
+    int32_t num;
+    uint8_t types;
+    uint8_t connection;
+    uint8_t status;
+    uint8_t is_typing;
+    uint16_t nick_len;
+    uint16_t statusmsg_len;
+    char nick[TOX_MAX_NAME_LENGTH + 1];
+    char statusmsg[TOX_MAX_STATUSMESSAGE_LENGTH + 1];
+};
+
+static struct _FriendEvents {
+    struct friend_event *pending;    /* in order of each friend's first event */
+    int num_pending;
+    int pending_size;
+    int *slot;    /* friend number -> index in pending plus one, or 0 if the friend has no pending events */
+    int slot_size;
+    uint64_t last_flush;
+    bool summarize;
+    bool save;    /* a record delivered early changed data that do_friend_events() must save */
+} FriendEvents;
+
+/* returns friendnumber's pending event record, adding one if necessary */
+static struct friend_event *get_friend_event(int32_t friendnumber)
 {
-    if (user_settings_->show_typing_other == SHOW_TYPING_OFF)
-        return;
+    if (friendnumber >= FriendEvents.slot_size) {
+        int n = MAX(friendnumber + 1, FriendEvents.slot_size * 2);
+        int *tmp = realloc(FriendEvents.slot, n * sizeof(int));
 
-    int i;
+        if (tmp == NULL)
+            exit_toxic_err("failed in get_friend_event", FATALERR_MEMORY);
+
+        memset(&tmp[FriendEvents.slot_size], 0, (n - FriendEvents.slot_size) * sizeof(int));
+        FriendEvents.slot = tmp;
+        FriendEvents.slot_size = n;
+    }
+
+    int idx = FriendEvents.slot[friendnumber];
+
+    if (idx > 0)
+        return &FriendEvents.pending[idx - 1];
+
+    if (FriendEvents.num_pending == FriendEvents.pending_size) {
+        int n = MAX(16, FriendEvents.pending_size * 2);
+        struct friend_event *tmp = realloc(FriendEvents.pending, n * sizeof(struct friend_event));
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onTypingChange != NULL)
-            windows[i].onTypingChange(&windows[i], m, friendnumber, is_typing);
+        if (tmp == NULL)
+            exit_toxic_err("failed in get_friend_event", FATALERR_MEMORY);
+
+        FriendEvents.pending = tmp;
+        FriendEvents.pending_size = n;
     }
+
+    struct friend_event *ev = &FriendEvents.pending[FriendEvents.num_pending++];
+    ev->num = friendnumber;
+    ev->types = 0;
+    FriendEvents.slot[friendnumber] = FriendEvents.num_pending;
+
+    return ev;
 }
 
-void on_message(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata)
+bool friend_events_summarized(void)
 {
-    int i;
+    return FriendEvents.summarize;
+}
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onMessage != NULL)
-            windows[i].onMessage(&windows[i], m, friendnumber, (const char *) string, length);
-    }
+void del_friend_events(int32_t friendnumber)
+{
+    if (friendnumber >= 0 && friendnumber < FriendEvents.slot_size && FriendEvents.slot[friendnumber] > 0)
+        FriendEvents.pending[FriendEvents.slot[friendnumber] - 1].types = 0;
 }
 
-void on_action(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata)
+/* delivers the events in ev, one per type, and clears it. Returns true if the data file must be saved */
+static bool deliver_friend_event(Tox *m, struct friend_event *ev)
 {
-    int i;
+    int32_t num = ev->num;
+    bool save = false;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onAction != NULL)
-            windows[i].onAction(&windows[i], m, friendnumber, (const char *) string, length);
+    if (ev->types & FRIEND_EVENT_NICK) {
+        DISPATCH_ROUTED(get_friend_window, num, onNickChange, m, num, ev->nick, ev->nick_len);
+        save = true;
     }
+
+    if (ev->types & FRIEND_EVENT_STATUSMSG)
+        DISPATCH_ROUTED(get_friend_window, num, onStatusMessageChange, num, ev->statusmsg, ev->statusmsg_len);
+
+    if (ev->types & FRIEND_EVENT_STATUS)
+        DISPATCH_ROUTED(get_friend_window, num, onStatusChange, m, num, ev->status);
+
+    if (ev->types & FRIEND_EVENT_CONNECTION) {
+        DISPATCH_ROUTED(get_friend_window, num, onConnectionChange, m, num, ev->connection);
+        save = true;
+    }
+
+    if (ev->types & FRIEND_EVENT_TYPING)
+        DISPATCH_ROUTED(get_friend_window, num, onTypingChange, m, num, ev->is_typing);
+
+    ev->types = 0;
+    return save;
 }
 
-void on_nickchange(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata)
+/* delivers friendnumber's pending presence events ahead of an event that must not overtake them */
+static void flush_friend_events(Tox *m, int32_t friendnumber)
 {
-    if (friendnumber < 0 || friendnumber > MAX_FRIENDS_NUM)
+    if (friendnumber < 0 || friendnumber >= FriendEvents.slot_size || FriendEvents.slot[friendnumber] == 0)
         return;
 
+    struct friend_event *ev = &FriendEvents.pending[FriendEvents.slot[friendnumber] - 1];
+    FriendEvents.slot[friendnumber] = 0;
+
+    if ((ev->types & FRIEND_EVENT_CONNECTION) && (ev->connection == 1) == friend_is_online(friendnumber))
+        ev->types &= ~FRIEND_EVENT_CONNECTION;
+
+    /* the emptied record stays in pending until the next do_friend_events() */
+    if (deliver_friend_event(m, ev))
+        FriendEvents.save = true;
+}
+
+/* Delivers the pending presence events, one per friend and type. Connection changes that
+   were undone within the interval are dropped. Must be called after tox_do() */
+void do_friend_events(Tox *m)
+{
+    if (FriendEvents.num_pending == 0)
+        return;
+
+    uint64_t curtime = get_time_ms();
+
+    if (curtime - FriendEvents.last_flush < FRIEND_EVENTS_INTERVAL)
+        return;
+
+    FriendEvents.last_flush = curtime;
+
+    int num_online = 0;
+    int num_offline = 0;
     int i;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onNickChange != NULL)
-            windows[i].onNickChange(&windows[i], m, friendnumber, (const char *) string, length);
+    for (i = 0; i < FriendEvents.num_pending; ++i) {
+        struct friend_event *ev = &FriendEvents.pending[i];
+
+        if (!(ev->types & FRIEND_EVENT_CONNECTION))
+            continue;
+
+        if ((ev->connection == 1) == friend_is_online(ev->num))
+            ev->types &= ~FRIEND_EVENT_CONNECTION;
+        else if (ev->connection == 1)
+            ++num_online;
+        else
+            ++num_offline;
+    }
+
+    FriendEvents.summarize = num_online + num_offline > FRIEND_EVENTS_SUMMARY_MIN;
+    bool save = FriendEvents.save;
+    FriendEvents.save = false;
+
+    for (i = 0; i < FriendEvents.num_pending; ++i) {
+        struct friend_event *ev = &FriendEvents.pending[i];
+        FriendEvents.slot[ev->num] = 0;
+
+        if (deliver_friend_event(m, ev))
+            save = true;
     }
 
-    store_data(m, DATA_FILE);
+    FriendEvents.num_pending = 0;
+
+    if (FriendEvents.summarize) {
+        prompt_connection_summary(prompt, num_online, num_offline);
+        FriendEvents.summarize = false;
+    }
+
+    if (save)
+        store_data(m, DATA_FILE);
+}
+
+/* CALLBACKS START */
+void on_request(Tox *m, const uint8_t *public_key, const uint8_t *data, uint16_t length, void *userdata)
+{
+    DISPATCH_GLOBAL(onFriendRequest, m, (const char *) public_key, (const char *) data, length);
+}
+
+void on_connectionchange(Tox *m, int32_t friendnumber, uint8_t status, void *userdata)
+{
+    if (friendnumber < 0)
+        return;
+
+    struct friend_event *ev = get_friend_event(friendnumber);
+    ev->types |= FRIEND_EVENT_CONNECTION;
+    ev->connection = status;
+}
+
+void on_typing_change(Tox *m, int32_t friendnumber, uint8_t is_typing, void *userdata)
+{
+    if (user_settings_->show_typing_other == SHOW_TYPING_OFF || friendnumber < 0)
+        return;
+
+    struct friend_event *ev = get_friend_event(friendnumber);
+    ev->types |= FRIEND_EVENT_TYPING;
+    ev->is_typing = is_typing;
+}
+
+void on_message(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata)
+{
+    flush_friend_events(m, friendnumber);
+    DISPATCH_ROUTED(get_friend_window, friendnumber, onMessage, m, friendnumber, (const char *) string, length);
+}
+
+void on_read_receipt(Tox *m, int32_t friendnumber, uint32_t receipt, void *userdata)
+{
+    flush_friend_events(m, friendnumber);
+    DISPATCH_ROUTED(get_friend_window, friendnumber, onReadReceipt, m, friendnumber, receipt);
+}
+
+void on_action(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata)
+{
+    flush_friend_events(m, friendnumber);
+    DISPATCH_ROUTED(get_friend_window, friendnumber, onAction, m, friendnumber, (const char *) string, length);
+}
+
+void on_nickchange(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata)
+{
+    if (friendnumber < 0 || length > TOX_MAX_NAME_LENGTH)
+        return;
+
+    struct friend_event *ev = get_friend_event(friendnumber);
+    ev->types |= FRIEND_EVENT_NICK;
+    ev->nick_len = length;
+    memcpy(ev->nick, string, length);
+    ev->nick[length] = '\0';
 }
 
 void on_statusmessagechange(Tox *m, int32_t friendnumber, const uint8_t *string, uint16_t length, void *userdata)
 {
-    int i;
+    if (friendnumber < 0 || length > TOX_MAX_STATUSMESSAGE_LENGTH)
+        return;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onStatusMessageChange != NULL)
-            windows[i].onStatusMessageChange(&windows[i], friendnumber, (const char *) string, length);
-    }
+    struct friend_event *ev = get_friend_event(friendnumber);
+    ev->types |= FRIEND_EVENT_STATUSMSG;
+    ev->statusmsg_len = length;
+    memcpy(ev->statusmsg, string, length);
+    ev->statusmsg[length] = '\0';
 }
 
 void on_statuschange(Tox *m, int32_t friendnumber, uint8_t status, void *userdata)
 {
-    int i;
+    if (friendnumber < 0)
+        return;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onStatusChange != NULL)
-            windows[i].onStatusChange(&windows[i], m, friendnumber, status);
-    }
+    struct friend_event *ev = get_friend_event(friendnumber);
+    ev->types |= FRIEND_EVENT_STATUS;
+    ev->status = status;
 }
 
-void on_friendadded(Tox *m, int32_t friendnumber, bool sort)
+/* if save is false the caller is adding friends in a batch and must call store_data() when done */
+void on_friendadded(Tox *m, int32_t friendnumber, bool sort, bool save)
 {
-    int i;
-
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onFriendAdded != NULL)
-            windows[i].onFriendAdded(&windows[i], m, friendnumber, sort);
-    }
+    DISPATCH_GLOBAL(onFriendAdded, m, friendnumber, sort);
 
-    store_data(m, DATA_FILE);
+    if (save)
+        store_data(m, DATA_FILE);
 }
 
 void on_groupmessage(Tox *m, int groupnumber, int peernumber, const uint8_t *message, uint16_t length,
                      void *userdata)
 {
-    int i;
-
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onGroupMessage != NULL)
-            windows[i].onGroupMessage(&windows[i], m, groupnumber, peernumber, (const char *) message, length);
-    }
+    DISPATCH_ROUTED(get_group_window, groupnumber, onGroupMessage, m, groupnumber, peernumber,
+                    (const char *) message, length);
 }
 
 void on_groupaction(Tox *m, int groupnumber, int peernumber, const uint8_t *action, uint16_t length,
                     void *userdata)
 {
-    int i;
-
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onGroupAction != NULL)
-            windows[i].onGroupAction(&windows[i], m, groupnumber, peernumber, (const char *) action, length);
-    }
+    DISPATCH_ROUTED(get_group_window, groupnumber, onGroupAction, m, groupnumber, peernumber,
+                    (const char *) action, length);
 }
 
 void on_groupinvite(Tox *m, int32_t friendnumber, const uint8_t *group_pub_key, void *userdata)
 {
-    int i;
-
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onGroupInvite != NULL)
-            windows[i].onGroupInvite(&windows[i], m, friendnumber, (const char *) group_pub_key);
-    }
+    flush_friend_events(m, friendnumber);
+    DISPATCH_ROUTED(get_friend_window, friendnumber, onGroupInvite, m, friendnumber, (const char *) group_pub_key);
 }
 
 void on_group_namelistchange(Tox *m, int groupnumber, int peernumber, uint8_t change, void *userdata)
 {
-    int i;
-
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onGroupNamelistChange != NULL)
-            windows[i].onGroupNamelistChange(&windows[i], m, groupnumber, peernumber, change);
-    }
+    DISPATCH_ROUTED(get_group_window, groupnumber, onGroupNamelistChange, m, groupnumber, peernumber, change);
 }
 
 void on_file_sendrequest(Tox *m, int32_t friendnumber, uint8_t filenumber, uint64_t filesize,
                          const uint8_t *filename, uint16_t filename_length, void *userdata)
 {
-    int i;
-
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onFileSendRequest != NULL)
-            windows[i].onFileSendRequest(&windows[i], m, friendnumber, filenumber, filesize,
-                                         (const char *) filename, filename_length);
-    }
+    flush_friend_events(m, friendnumber);
+    DISPATCH_ROUTED(get_friend_window, friendnumber, onFileSendRequest, m, friendnumber, filenumber, filesize,
+                    (const char *) filename, filename_length);
 }
 
 void on_file_control (Tox *m, int32_t friendnumber, uint8_t receive_send, uint8_t filenumber,
                       uint8_t control_type, const uint8_t *data, uint16_t length, void *userdata)
 {
-    int i;
-
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onFileControl != NULL)
-            windows[i].onFileControl(&windows[i], m, friendnumber, receive_send, filenumber,
-                                     control_type, (const char *) data, length);
-    }
+    flush_friend_events(m, friendnumber);
+    DISPATCH_ROUTED(get_friend_window, friendnumber, onFileControl, m, friendnumber, receive_send, filenumber,
+                    control_type, (const char *) data, length);
 }
 
 void on_file_data(Tox *m, int32_t friendnumber, uint8_t filenumber, const uint8_t *data, uint16_t length,
                   void *userdata)
 {
-    int i;
+    flush_friend_events(m, friendnumber);
+    DISPATCH_ROUTED(get_friend_window, friendnumber, onFileData, m, friendnumber, filenumber,
+                    (const char *) data, length);
+}
+
+/* CALLBACKS END */
+
+#define MIN_WINDOWS_SIZE 8
+
+static void windows_grow(void)
+{
+    int n = windows_size ? MIN(windows_size * 2, MAX_WINDOWS_NUM) : MIN_WINDOWS_SIZE;
+
+    ToxWindow **tmp_windows = realloc(windows, n * sizeof(ToxWindow *));
+
+    if (tmp_windows == NULL)
+        exit_toxic_err("failed in windows_grow", FATALERR_MEMORY);
+
+    windows = tmp_windows;
+
+    ToxWindow **tmp_order = realloc(tab_order, n * sizeof(ToxWindow *));
+
+    if (tmp_order == NULL)
+        exit_toxic_err("failed in windows_grow", FATALERR_MEMORY);
+
+    tab_order = tmp_order;
+
+    memset(&windows[windows_size], 0, (n - windows_size) * sizeof(ToxWindow *));
+    windows_size = n;
+}
+
+/* creates w's curses window and sub-windows at the current terminal size. Returns -1 on failure */
+static int window_alloc_curses(ToxWindow *w)
+{
+    /* equivalent to LINES and COLS */
+    int x2, y2;
+    getmaxyx(stdscr, y2, x2);
+    y2 -= 2;
+
+    w->window = newwin(y2, x2, 0, 0);
+
+    if (w->window == NULL)
+        return -1;
+
+#ifdef URXVT_FIX
+    /* Fixes text color problem on some terminals. */
+    wbkgd(w->window, COLOR_PAIR(6));
+#endif
+
+    w->x = x2;
+
+    if (w->is_friendlist)
+        return 0;
+
+    ChatContext *ctx = w->chatwin;
+    ctx->linewin = subwin(w->window, CHATBOX_HEIGHT, x2, y2 - CHATBOX_HEIGHT, 0);
+
+    if (w->is_groupchat) {
+        ctx->history = subwin(w->window, y2 - CHATBOX_HEIGHT + 1, x2 - SIDEBAR_WIDTH - 1, 0, 0);
+        ctx->sidebar = subwin(w->window, y2 - CHATBOX_HEIGHT + 1, SIDEBAR_WIDTH, 0, x2 - SIDEBAR_WIDTH);
+    } else {
+        ctx->history = subwin(w->window, y2 - CHATBOX_HEIGHT + 1, x2, 0, 0);
+        w->stb->topline = subwin(w->window, 2, x2, 0, 0);
+    }
+
+#ifdef _AUDIO
+    if (ctx->infobox.active)
+        ctx->infobox.win = newwin(INFOBOX_HEIGHT, INFOBOX_WIDTH + 1, 1, x2 - INFOBOX_WIDTH);
+#endif   /* _AUDIO */
+
+    scrollok(ctx->history, 0);
+    wmove(w->window, y2 - CURS_Y_OFFSET, 0);
+
+    return 0;
+}
+
+/* deletes w's curses window and sub-windows. Its history and input line are kept */
+static void window_free_curses(ToxWindow *w)
+{
+    if (w->window == NULL)
+        return;
+
+    if (!w->is_friendlist) {
+        ChatContext *ctx = w->chatwin;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].onFileData != NULL)
-            windows[i].onFileData(&windows[i], m, friendnumber, filenumber, (const char *) data, length);
+        if (w->is_groupchat) {
+            delwin(ctx->sidebar);
+            ctx->sidebar = NULL;
+        } else {
+            delwin(w->stb->topline);
+            w->stb->topline = NULL;
+        }
+
+        delwin(ctx->linewin);
+        delwin(ctx->history);
+        ctx->linewin = NULL;
+        ctx->history = NULL;
+
+#ifdef _AUDIO
+        if (ctx->infobox.win) {
+            delwin(ctx->infobox.win);
+            ctx->infobox.win = NULL;
+        }
+#endif   /* _AUDIO */
     }
+
+    delwin(w->window);
+    w->window = NULL;
 }
 
-/* CALLBACKS END */
+/* moves and resizes sub-window sub in place. Its parent must be large enough to hold
+   it both where it is and where it's going */
+static int resize_subwin(WINDOW *sub, int height, int width, int y, int x)
+{
+    if (sub == NULL)
+        return 0;
+
+    /* the parent is at 0,0 so sub's position in the parent is also its position on the screen */
+    if (mvderwin(sub, 0, 0) == ERR || wresize(sub, height, width) == ERR
+            || mvderwin(sub, y, x) == ERR || mvwin(sub, y, x) == ERR)
+        return -1;
+
+    return 0;
+}
+
+/* resizes w's curses window and moves and resizes its sub-windows to fit a y2 by x2 window.
+   Returns -1 on failure, in which case the windows must be recreated */
+static int window_resize_curses(ToxWindow *w, int y2, int x2)
+{
+    int cur_y2, cur_x2;
+    getmaxyx(w->window, cur_y2, cur_x2);
+
+    /* grow first so the sub-windows fit at both their old and new positions, then shrink */
+    if (wresize(w->window, MAX(y2, cur_y2), MAX(x2, cur_x2)) == ERR)
+        return -1;
+
+    w->x = x2;
+
+    if (!w->is_friendlist) {
+        ChatContext *ctx = w->chatwin;
+
+        if (resize_subwin(ctx->linewin, CHATBOX_HEIGHT, x2, y2 - CHATBOX_HEIGHT, 0) == -1)
+            return -1;
+
+        if (w->is_groupchat) {
+            if (resize_subwin(ctx->history, y2 - CHATBOX_HEIGHT + 1, x2 - SIDEBAR_WIDTH - 1, 0, 0) == -1
+                    || resize_subwin(ctx->sidebar, y2 - CHATBOX_HEIGHT + 1, SIDEBAR_WIDTH, 0, x2 - SIDEBAR_WIDTH) == -1)
+                return -1;
+        } else {
+            if (resize_subwin(ctx->history, y2 - CHATBOX_HEIGHT + 1, x2, 0, 0) == -1
+                    || resize_subwin(w->stb->topline, 2, x2, 0, 0) == -1)
+                return -1;
+        }
+
+#ifdef _AUDIO
+        if (ctx->infobox.win && mvwin(ctx->infobox.win, 1, x2 - INFOBOX_WIDTH) == ERR)
+            return -1;
+#endif   /* _AUDIO */
+    }
+
+    if (wresize(w->window, y2, x2) == ERR)
+        return -1;
+
+    if (!w->is_friendlist)
+        wmove(w->window, y2 - CURS_Y_OFFSET, 0);
+
+    return 0;
+}
+
+/* makes w the active window, allocating its curses windows if it doesn't have them.
+   Lines that arrived since the last refresh_inactive_windows() are merged into its history;
+   the window is laid out and painted by its onDraw on the next frame.
+   Returns -1 if they can't be allocated, in which case the active window is unchanged */
+static int window_focus(ToxWindow *w)
+{
+    if (w->window == NULL && window_alloc_curses(w) == -1)
+        return -1;
+
+    if (!w->is_friendlist)
+        line_info_flush(w);
+
+    w->last_focus = get_unix_time();
+    active_window = w;
+    return 0;
+}
 
 int add_window(Tox *m, ToxWindow w)
 {
     if (LINES < 2)
         return -1;
 
+    if (get_num_active_windows() >= MAX_WINDOWS_NUM)
+        return -1;
+
     int i;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; i++) {
-        if (windows[i].active)
-            continue;
+    for (i = 0; i < windows_size; ++i) {
+        if (windows[i] == NULL)
+            break;
+    }
 
-        w.window = newwin(LINES - 2, COLS, 0, 0);
+    if (i == windows_size)
+        windows_grow();
 
-        if (w.window == NULL)
-            return -1;
+    ToxWindow *new_w = malloc(sizeof(ToxWindow));
 
-#ifdef URXVT_FIX
-        /* Fixes text color problem on some terminals. */
-        wbkgd(w.window, COLOR_PAIR(6));
-#endif
-        windows[i] = w;
+    if (new_w == NULL)
+        exit_toxic_err("failed in add_window", FATALERR_MEMORY);
 
-        if (w.onInit)
-            w.onInit(&w, m);
+    *new_w = w;
+    new_w->window = NULL;
+    new_w->index = i;
+    new_w->tab_pos = num_active_windows;
+    new_w->last_focus = get_unix_time();
 
-        ++num_active_windows;
+    windows[i] = new_w;
+    tab_order[num_active_windows++] = new_w;
+    window_route_add(new_w);
 
-        return i;
-    }
+    if (new_w->onInit)
+        new_w->onInit(new_w, m);
 
-    return -1;
+    return i;
 }
 
 void set_active_window(int index)
 {
-    if (index < 0 || index >= MAX_WINDOWS_NUM)
+    if (index < 0 || index >= windows_size || windows[index] == NULL)
         return;
 
-    active_window = windows + index;
+    window_focus(windows[index]);
 }
 
 /* Shows next window when tab or back-tab is pressed */
 void set_next_window(int ch)
 {
-    ToxWindow *end = windows + MAX_WINDOWS_NUM - 1;
-    ToxWindow *inf = active_window;
+    int pos = active_window->tab_pos;
+    int n = num_active_windows;
 
-    while (true) {
-        if (ch == user_settings_->key_next_tab) {
-            if (++active_window > end)
-                active_window = windows;
-        } else if (--active_window < windows)
-            active_window = end;
-
-        if (active_window->window)
-            return;
+    if (ch == user_settings_->key_next_tab)
+        pos = (pos + 1) % n;
+    else
+        pos = (pos + n - 1) % n;
 
-        if (active_window == inf)    /* infinite loop check */
-            exit_toxic_err("failed in set_next_window", FATALERR_INFLOOP);
-    }
+    window_focus(tab_order[pos]);
 }
 
 /* Deletes window w and cleans up */
@@ -291,8 +708,18 @@ void del_window(ToxWindow *w)
 {
     set_active_window(0);    /* Go to prompt screen */
 
-    delwin(w->window);
-    memset(w, 0, sizeof(ToxWindow));
+    window_route_del(w);
+    delwin(w->window);    /* the kill_*_window() functions delete the sub-windows */
+
+    int i;
+
+    for (i = w->tab_pos; i < num_active_windows - 1; ++i) {
+        tab_order[i] = tab_order[i + 1];
+        tab_order[i]->tab_pos = i;
+    }
+
+    windows[w->index] = NULL;
+    free(w);
 
     clear();
     refresh();
@@ -306,16 +733,30 @@ ToxWindow *init_windows(Tox *m)
     if (n_prompt == -1 || add_window(m, new_friendlist()) == -1)
         exit_toxic_err("failed in init_windows", FATALERR_WININIT);
 
-    prompt = &windows[n_prompt];
-    active_window = prompt;
+    prompt = windows[n_prompt];
+
+    if (window_focus(prompt) == -1)
+        exit_toxic_err("failed in init_windows", FATALERR_WININIT);
 
     return prompt;
 }
 
+/* Resizes the curses windows in place for the new terminal size. Windows are not repainted here:
+   the focused window redraws its history on the next frame and the others when they're focused.
+   Line heights aren't cached, they are derived from the window width wherever they're needed */
 void on_window_resize(void)
 {
-    endwin();
-    refresh();
+    pthread_mutex_lock(&Winthread.lock);
+
+    struct winsize ws;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        resizeterm(ws.ws_row, ws.ws_col);
+    } else {
+        endwin();
+        refresh();
+    }
+
     clear();
 
     /* equivalent to LINES and COLS */
@@ -325,61 +766,45 @@ void on_window_resize(void)
 
     int i;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (!windows[i].active)
-            continue;
-
-        ToxWindow *w = &windows[i];
+    for (i = 0; i < num_active_windows; ++i) {
+        ToxWindow *w = tab_order[i];
 
-        if (windows[i].is_friendlist)  {
-            delwin(w->window);
-            w->window = newwin(y2, x2, 0, 0);
+        /* windows without curses windows get them at the new size when they're focused */
+        if (w->window == NULL)
             continue;
-        }
 
         if (w->help->active)
             wclear(w->help->win);
 
-        if (w->is_groupchat)
-            delwin(w->chatwin->sidebar);
-        else
-            delwin(w->stb->topline);
-
-        delwin(w->chatwin->linewin);
-        delwin(w->chatwin->history);
-        delwin(w->window);
-
-        w->window = newwin(y2, x2, 0, 0);
-        w->chatwin->linewin = subwin(w->window, CHATBOX_HEIGHT, x2, y2 - CHATBOX_HEIGHT, 0);
-
-        if (w->is_groupchat) {
-            w->chatwin->history = subwin(w->window, y2 - CHATBOX_HEIGHT + 1, x2 - SIDEBAR_WIDTH - 1, 0, 0);
-            w->chatwin->sidebar = subwin(w->window, y2 - CHATBOX_HEIGHT + 1, SIDEBAR_WIDTH, 0, x2 - SIDEBAR_WIDTH);
-        } else {
-            w->chatwin->history = subwin(w->window, y2 - CHATBOX_HEIGHT + 1, x2, 0, 0);
-            w->stb->topline = subwin(w->window, 2, x2, 0, 0);
-        }
+        if (window_resize_curses(w, y2, x2) == 0)
+            continue;
 
-#ifdef _AUDIO
-        if (w->chatwin->infobox.active) {
-            delwin(w->chatwin->infobox.win);
-            w->chatwin->infobox.win = newwin(INFOBOX_HEIGHT, INFOBOX_WIDTH + 1, 1, x2 - INFOBOX_WIDTH);
-        }
-#endif   /* _AUDIO */
+        window_free_curses(w);
 
-        scrollok(w->chatwin->history, 0);
+        if (window_alloc_curses(w) == -1)
+            exit_toxic_err("failed in on_window_resize", FATALERR_WININIT);
     }
+
+    pthread_mutex_unlock(&Winthread.lock);
 }
 
-static void draw_window_tab(ToxWindow toxwin)
+static void draw_window_tab(ToxWindow *toxwin)
 {
-    if (toxwin.alert) attron(COLOR_PAIR(toxwin.alert));
+    if (toxwin->alert) attron(COLOR_PAIR(toxwin->alert));
     clrtoeol();
-    printw(" [%s]", toxwin.name);
+    printw(" [%s]", toxwin->name);
 
-    if (toxwin.alert) attroff(COLOR_PAIR(toxwin.alert));
+    if (toxwin->alert) attroff(COLOR_PAIR(toxwin->alert));
 }
 
+/* width of the tab drawn by draw_window_tab() */
+static int window_tab_width(ToxWindow *toxwin)
+{
+    return strlen(toxwin->name) + 3;
+}
+
+/* Draws the tabs that fit on the bar, scrolled so that the active window's tab is visible.
+   Only the visible tabs are looked at */
 static void draw_bar(void)
 {
     attron(COLOR_PAIR(BLUE));
@@ -392,13 +817,37 @@ static void draw_bar(void)
     printw(" TOXIC " TOXICVER " |");
     attroff(COLOR_PAIR(BLUE) | A_BOLD);
 
+    int avail = COLS - getcurx(stdscr) - 4;    /* leave room for the " <" and " >" markers */
+    int active_pos = active_window->tab_pos;
+
+    if (tab_bar_start > active_pos)
+        tab_bar_start = active_pos;
+
     int i;
+    int width = 0;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (!windows[i].active)
-            continue;
+    for (i = active_pos; i >= tab_bar_start; --i) {
+        width += window_tab_width(tab_order[i]);
+
+        if (width > avail) {
+            tab_bar_start = MIN(i + 1, active_pos);
+            break;
+        }
+    }
+
+    if (tab_bar_start > 0)
+        printw(" <");
 
-        if (windows + i == active_window)
+    for (i = tab_bar_start; i < num_active_windows; ++i) {
+        ToxWindow *w = tab_order[i];
+
+        if (w != active_window && getcurx(stdscr) + window_tab_width(w) > COLS - 2) {
+            clrtoeol();
+            printw(" >");
+            break;
+        }
+
+        if (w == active_window)
 
 #ifdef URXVT_FIX
             attron(A_BOLD | COLOR_PAIR(GREEN));
@@ -407,9 +856,9 @@ static void draw_bar(void)
 
             attron(A_BOLD);
 
-        draw_window_tab(windows[i]);
+        draw_window_tab(w);
 
-        if (windows + i == active_window)
+        if (w == active_window)
 
 #ifdef URXVT_FIX
             attroff(A_BOLD | COLOR_PAIR(GREEN));
@@ -422,26 +871,77 @@ static void draw_bar(void)
     refresh();
 }
 
+static wchar_t paste_buf[MAX_PASTE_SIZE];
+
+#define PASTE_END_TIMEOUT 2000    /* ms without input after which a paste missing its end marker is cut off */
+
+/* reads the keys of a bracketed paste up to the end marker into paste_buf.
+   Returns the number of chars read */
+static int read_paste(void)
+{
+    int len = 0;
+    uint64_t last_input = get_time_ms();
+    wint_t ch;
+
+    while (true) {
+        bool is_key;    /* ch is a key code rather than a character */
+
+#ifdef HAVE_WIDECHAR
+        int status = wget_wch(stdscr, &ch);
+        is_key = status == KEY_CODE_YES;
+#else
+        int c = getch();
+        int status = c == ERR ? ERR : OK;
+        is_key = c > 0xff;
+        ch = c;
+#endif /* HAVE_WIDECHAR */
+
+        /* getch times out between chunks of a large paste; keep waiting for the end marker */
+        if (status == ERR) {
+            if (get_time_ms() - last_input >= PASTE_END_TIMEOUT)
+                break;
+
+            continue;
+        }
+
+        last_input = get_time_ms();
+
+        if (is_key && ch == T_KEY_PASTE_END)
+            break;
+
+        if (len < MAX_PASTE_SIZE)
+            paste_buf[len++] = ch;
+    }
+
+    return len;
+}
+
 void draw_active_window(Tox *m)
 {
+    pthread_mutex_lock(&Winthread.lock);
+
     ToxWindow *a = active_window;
     a->alert = WINDOW_ALERT_NONE;
+    draw_bar();
 
-    wint_t ch = 0;
+    pthread_mutex_unlock(&Winthread.lock);
 
-    draw_bar();
+    wint_t ch = 0;
 
     touchwin(a->window);
     a->onDraw(a, m);
 
     /* Handle input */
     bool ltr;
+    bool is_key;    /* ch is a key code rather than a character */
 #ifdef HAVE_WIDECHAR
     int status = wget_wch(stdscr, &ch);
 
     if (status == ERR)
         return;
 
+    is_key = status == KEY_CODE_YES;
+
     if (status == OK)
         ltr = iswprint(ch);
     else /* if (status == KEY_CODE_YES) */
@@ -455,40 +955,87 @@ void draw_active_window(Tox *m)
 
     /* TODO verify if this works */
     ltr = isprint(ch);
+    is_key = ch > 0xff;
 #endif /* HAVE_WIDECHAR */
 
-    if (!ltr && (ch == user_settings_->key_next_tab || ch == user_settings_->key_prev_tab)) {
-        set_next_window((int) ch);
-    } else {
+    /* a paste is inserted in one go instead of one key per frame */
+    if (is_key && ch == T_KEY_PASTE_START) {
+        int len = read_paste();
+        int i;
+
         pthread_mutex_lock(&Winthread.lock);
-        a->onKey(a, m, ch, ltr);
+
+        if (a->chatwin != NULL) {
+            input_paste(a, m, paste_buf, len);
+        } else {
+            for (i = 0; i < len; ++i)
+                a->onKey(a, m, paste_buf[i], iswprint(paste_buf[i]));
+        }
+
         pthread_mutex_unlock(&Winthread.lock);
+        return;
     }
+
+    pthread_mutex_lock(&Winthread.lock);
+
+    if (!ltr && (ch == user_settings_->key_next_tab || ch == user_settings_->key_prev_tab))
+        set_next_window((int) ch);
+    else
+        a->onKey(a, m, ch, ltr);
+
+    pthread_mutex_unlock(&Winthread.lock);
 }
 
-/* refresh inactive windows to prevent scrolling bugs. 
+/* moves the queued lines of inactive windows into their history and keeps their line_start in
+   sync so they don't scroll out of place; they aren't painted until they're focused. Also releases
+   the curses windows of chats that haven't been focused in WINDOW_IDLE_RELEASE seconds.
    call at least once per second */
 void refresh_inactive_windows(void)
 {
+    pthread_mutex_lock(&Winthread.lock);
+
+    uint64_t curtime = get_unix_time();
+    active_window->last_focus = curtime;
+
     int i;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        ToxWindow *a = &windows[i];
+    for (i = 0; i < num_active_windows; ++i) {
+        ToxWindow *a = tab_order[i];
 
-        if (a->active && a != active_window && !a->is_friendlist)
-            line_info_print(a);
+        if (a == active_window || a->is_friendlist)
+            continue;
+
+        if (a->window && (a->is_chat || a->is_groupchat) && curtime - a->last_focus >= WINDOW_IDLE_RELEASE) {
+            if (a->help->active) {
+                delwin(a->help->win);
+                memset(a->help, 0, sizeof(Help));
+            }
+
+            window_free_curses(a);
+        }
+
+        line_info_flush(a);
     }
+
+    pthread_mutex_unlock(&Winthread.lock);
 }
 
 /* returns a pointer to the ToxWindow in the ith index. Returns NULL if no ToxWindow exists */
 ToxWindow *get_window_ptr(int i)
 {
-    ToxWindow *toxwin = NULL;
+    if (i < 0 || i >= windows_size)
+        return NULL;
 
-    if (windows[i].active)
-        toxwin = &windows[i];
+    return windows[i];
+}
 
-    return toxwin;
+/* returns the nth open window in tab order or NULL if n is out of range */
+ToxWindow *get_open_window(int n)
+{
+    if (n < 0 || n >= num_active_windows)
+        return NULL;
+
+    return tab_order[n];
 }
 
 int get_num_active_windows(void)
@@ -503,10 +1050,13 @@ void kill_all_windows(void)
 
     int i;
 
-    for (i = 0; i < MAX_WINDOWS_NUM; ++i) {
-        if (windows[i].is_chat)
-            kill_chat_window(&windows[i]);
-        else if (windows[i].is_groupchat)
-            kill_groupchat_window(&windows[i]);
+    /* killing a window removes it from tab_order so walk it backwards */
+    for (i = num_active_windows - 1; i >= 0; --i) {
+        ToxWindow *w = tab_order[i];
+
+        if (w->is_chat)
+            kill_chat_window(w);
+        else if (w->is_groupchat)
+            kill_groupchat_window(w);
     }
 }
@@ -35,7 +35,11 @@
 
 #include "toxic.h"
 
-#define MAX_WINDOWS_NUM 32
+#define MAX_WINDOWS_NUM 1024    /* upper bound on open windows; the window table grows on demand */
+#define WINDOW_IDLE_RELEASE 600    /* seconds an unfocused chat keeps its curses windows */
+#define FRIEND_EVENTS_INTERVAL 250    /* ms over which presence events are folded before delivery */
+#define FRIEND_EVENTS_SUMMARY_MIN 5    /* bursts of more connection changes than this are summarized */
+#define MAX_PASTE_SIZE (MAX_STR_SIZE * 16)    /* chars of a bracketed paste kept; the rest is dropped */
 #define MAX_WINDOW_NAME_LENGTH 16
 #define CURS_Y_OFFSET 1    /* y-axis cursor offset for chat contexts */
 #define CHATBOX_HEIGHT 2
@@ -78,6 +82,7 @@ struct arg_opts {
     int use_custom_data;
     char config_path[MAX_STR_SIZE];
     char nodes_path[MAX_STR_SIZE];
+    char import_path[MAX_STR_SIZE];
 };
 
 typedef struct ToxWindow ToxWindow;
@@ -106,6 +111,7 @@ struct ToxWindow {
     void(*onFileControl)(ToxWindow *, Tox *, int32_t, uint8_t, uint8_t, uint8_t, const char *, uint16_t);
     void(*onFileData)(ToxWindow *, Tox *, int32_t, uint8_t, const char *, uint16_t);
     void(*onTypingChange)(ToxWindow *, Tox *, int32_t, uint8_t);
+    void(*onReadReceipt)(ToxWindow *, Tox *, int32_t, uint32_t);
 
 #ifdef _AUDIO
 
@@ -142,11 +148,15 @@ struct ToxWindow {
 
     WINDOW_ALERTS alert;
 
+    int index;    /* slot in the window table; stable for the lifetime of the window */
+    int tab_pos;    /* position in the tab bar */
+    uint64_t last_focus;
+
     ChatContext *chatwin;
     StatusBar *stb;
     Help *help;
 
-    WINDOW *window;
+    WINDOW *window;    /* NULL until the window is first focused */
 };
 
 /* statusbar info holder */
@@ -199,12 +209,18 @@ struct ChatContext {
 
     struct history *hst;
     struct chatlog *log;
+    struct chat_queue *cqueue;    /* outbound messages; chat windows only */
 
 #ifdef _AUDIO
     struct infobox infobox;
 #endif
 
-    uint8_t self_is_typing;
+    uint8_t self_is_typing;    /* the typing state we last sent */
+    bool typing_want;    /* the typing state the input line asks for */
+    bool typing_stop_now;    /* a message was sent; report that we stopped without waiting */
+    uint64_t typing_last_key;    /* ms */
+    uint32_t typing_sent;    /* number of typing notifications sent */
+    uint32_t typing_suppressed;    /* number of notifications the keystroke path asked for but didn't need */
 
     WINDOW *history;
     WINDOW *linewin;
@@ -218,6 +234,18 @@ struct Help {
 };
 
 ToxWindow *init_windows(Tox *m);
+
+/* delivers the presence events folded since the last call. Call after every tox_do() */
+void do_friend_events(Tox *m);
+
+/* returns true while do_friend_events() is delivering more than FRIEND_EVENTS_SUMMARY_MIN
+   connection changes. Handlers should update their state but not report each change;
+   the burst is reported by prompt_connection_summary() */
+bool friend_events_summarized(void);
+
+/* drops the pending presence events of friendnumber. Call when the friend is deleted */
+void del_friend_events(int32_t friendnumber);
+
 void draw_active_window(Tox *m);
 int add_window(Tox *m, ToxWindow w);
 void del_window(ToxWindow *w);
@@ -227,7 +255,12 @@ void kill_all_windows(void);    /* should only be called on shutdown */
 void on_window_resize(void);
 ToxWindow *get_window_ptr(int i);
 
-/* refresh inactive windows to prevent scrolling bugs. 
+/* returns the nth open window in tab order or NULL if n is out of range.
+   use with get_num_active_windows() to iterate over all windows */
+ToxWindow *get_open_window(int n);
+
+/* moves the queued lines of inactive windows into their history without painting them and
+   releases the curses windows of chats that haven't been focused in WINDOW_IDLE_RELEASE seconds.
    call at least once per second */
 void refresh_inactive_windows(void);
 